@@ -0,0 +1,499 @@
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "client.h"
+#include "numconv.h"
+#include "simd.h"
+
+#define CLIENT_READ_MIN (16 * 1024)  // free space ensured before each recv
+#define CLIENT_MAX_HEAD (64 * 1024)
+#define CLIENT_RESERVE (1024 * 1024) // most of a body allocated ahead
+#define CLIENT_POOL_IDLE 64          // idle connections kept per origin
+
+// ---- URLs ----
+
+bool http_url_parse(const char* url, size_t length, HttpUrl* out) {
+    if (length < 7 || memcmp(url, "http://", 7) != 0) return false;
+    const char* start = url + 7;
+    const char* end = url + length;
+    const char* slash = memchr(start, '/', end - start);
+    const char* authority_end = slash != NULL ? slash : end;
+    const char* host = start;
+    const char* host_end;
+    const char* port = NULL;
+    if (start < authority_end && *start == '[') {
+        const char* close = memchr(start, ']', authority_end - start);
+        if (close == NULL) return false;
+        host = start + 1;
+        host_end = close;
+        if (close + 1 < authority_end) {
+            if (close[1] != ':') return false;
+            port = close + 2;
+        }
+    } else {
+        const char* colon = memchr(start, ':', authority_end - start);
+        host_end = colon != NULL ? colon : authority_end;
+        if (colon != NULL) port = colon + 1;
+    }
+    size_t host_len = host_end - host;
+    if (host_len == 0 || host_len >= sizeof(out->host)) return false;
+    memcpy(out->host, host, host_len);
+    out->host[host_len] = '\0';
+    out->port = 80;
+    if (port != NULL) {
+        int64_t number;
+        if (!parse_int(port, (int64_t)(authority_end - port), &number) || number <= 0 || number > 65535) return false;
+        out->port = (int)number;
+    }
+    out->authority = start;
+    out->authority_len = authority_end - start;
+    out->path = slash != NULL ? slash : "/";
+    out->path_len = slash != NULL ? (size_t)(end - slash) : 1;
+    return true;
+}
+
+// ---- the pool ----
+
+typedef struct {
+    char host[256];
+    int port;
+    int fds[CLIENT_POOL_IDLE];
+    int count;
+} PoolEntry;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static PoolEntry* pool;
+static int pool_count;
+
+// Called with pool_lock held.
+static PoolEntry* pool_entry(const char* host, int port, bool create) {
+    for (int i = 0; i < pool_count; i++) {
+        if (pool[i].port == port && strcmp(pool[i].host, host) == 0) return &pool[i];
+    }
+    if (!create) return NULL;
+    pool = realloc(pool, sizeof(PoolEntry) * (pool_count + 1));
+    PoolEntry* entry = &pool[pool_count++];
+    snprintf(entry->host, sizeof(entry->host), "%s", host);
+    entry->port = port;
+    entry->count = 0;
+    return entry;
+}
+
+// An idle connection to host:port that the server has not closed, or -1.
+static int pool_take(const char* host, int port) {
+    for (;;) {
+        int fd = -1;
+        pthread_mutex_lock(&pool_lock);
+        PoolEntry* entry = pool_entry(host, port, false);
+        if (entry != NULL && entry->count > 0) fd = entry->fds[--entry->count];
+        pthread_mutex_unlock(&pool_lock);
+        if (fd < 0) return -1;
+        char byte;
+        ssize_t n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return fd;
+        close(fd); // closed by the server, or holding bytes nobody asked for
+    }
+}
+
+static void pool_put(const char* host, int port, int fd) {
+    pthread_mutex_lock(&pool_lock);
+    PoolEntry* entry = pool_entry(host, port, true);
+    if (entry->count < CLIENT_POOL_IDLE) {
+        entry->fds[entry->count++] = fd;
+        fd = -1;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (fd >= 0) close(fd);
+}
+
+// ---- calls ----
+
+enum { READ_HEAD, READ_LENGTH, READ_CHUNKED, READ_CLOSE };
+
+struct HttpCall {
+    char host[256];
+    int port;
+    struct addrinfo* addrs; // resolved once a new connection is needed
+    struct addrinfo* next_addr;
+    int fd;
+    bool connecting;
+    bool reused;   // fd came from the pool
+    bool retried;  // a reused connection failed and was replaced
+    bool received; // response bytes have come in on fd
+    char* out;
+    size_t out_len;
+    size_t out_sent;
+    bool* head;
+    bool idempotent; // every request may be sent again
+    int count;     // responses expected
+    int done;      // responses read
+    bool stream;
+    char* in;
+    size_t in_len;
+    size_t in_cap;
+    size_t consume; // bytes of in to drop at the next step
+    int state;
+    bool keep_alive; // the response being read allows another
+    bool ended;      // its body is complete, to be reported next step
+    bool closed;     // the server ends the connection after it
+    uint64_t left;   // READ_LENGTH: body bytes yet to come
+    HttpParser chunks;
+    char* body;
+    size_t body_len;
+    size_t body_cap;
+    uint32_t events;
+    char error[128];
+};
+
+HttpCall* http_call_new(const char* host, int port, char* data, size_t length, int count, const bool* head,
+                        bool idempotent, bool stream) {
+    HttpCall* c = calloc(1, sizeof(HttpCall));
+    snprintf(c->host, sizeof(c->host), "%s", host);
+    c->port = port;
+    c->fd = -1;
+    c->out = data;
+    c->out_len = length;
+    c->head = malloc(sizeof(bool) * (count > 0 ? count : 1));
+    memcpy(c->head, head, sizeof(bool) * count);
+    c->idempotent = idempotent;
+    c->count = count;
+    c->stream = stream;
+    return c;
+}
+
+void http_call_free(HttpCall* c) {
+    if (c->fd >= 0) close(c->fd);
+    if (c->addrs != NULL) freeaddrinfo(c->addrs);
+    free(c->out);
+    free(c->head);
+    free(c->in);
+    free(c->body);
+    free(c);
+}
+
+int http_call_fd(const HttpCall* c) {
+    return c->fd;
+}
+
+uint32_t http_call_events(const HttpCall* c) {
+    return c->events;
+}
+
+const char* http_call_error(const HttpCall* c) {
+    return c->error;
+}
+
+char* http_call_take_body(HttpCall* c, size_t* capacity) {
+    char* body = c->body != NULL ? c->body : malloc(1);
+    *capacity = c->body_cap;
+    c->body = NULL;
+    c->body_len = c->body_cap = 0;
+    return body;
+}
+
+static int call_fail(HttpCall* c, const char* error) {
+    snprintf(c->error, sizeof(c->error), "%s", error);
+    return HTTP_CALL_ERROR;
+}
+
+static void body_reserve(HttpCall* c, size_t extra) {
+    if (c->body_len + extra <= c->body_cap && c->body != NULL) return;
+    size_t capacity = c->body_cap < 256 ? 256 : c->body_cap * 2;
+    if (capacity < c->body_len + extra) capacity = c->body_len + extra;
+    c->body = realloc(c->body, capacity + 1);
+    c->body_cap = capacity;
+}
+
+static void in_drop(HttpCall* c, size_t length) {
+    memmove(c->in, c->in + length, c->in_len - length);
+    c->in_len -= length;
+}
+
+// Opens a connection, from the pool unless a pooled one just failed, or by
+// trying each address of the host in turn.
+static bool call_connect(HttpCall* c) {
+    c->reused = c->received = c->connecting = false;
+    if (!c->retried && (c->fd = pool_take(c->host, c->port)) >= 0) {
+        c->reused = true;
+        return true;
+    }
+    if (c->addrs == NULL) {
+        struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+        char port[16];
+        snprintf(port, sizeof(port), "%d", c->port);
+        int err = getaddrinfo(c->host, port, &hints, &c->addrs);
+        if (err != 0) {
+            c->addrs = NULL;
+            call_fail(c, gai_strerror(err));
+            return false;
+        }
+        c->next_addr = c->addrs;
+    }
+    int err = ECONNREFUSED;
+    for (; c->next_addr != NULL; c->next_addr = c->next_addr->ai_next) {
+        struct addrinfo* addr = c->next_addr;
+        int fd = socket(addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int rc = connect(fd, addr->ai_addr, addr->ai_addrlen);
+        if (rc == 0 || errno == EINPROGRESS) {
+            c->connecting = rc != 0;
+            c->fd = fd;
+            c->next_addr = addr->ai_next;
+            return true;
+        }
+        err = errno;
+        close(fd);
+    }
+    call_fail(c, strerror(err));
+    return false;
+}
+
+// Drops the connection to start over on a new one: once when a pooled
+// connection turns out dead before answering, and for each address when
+// connecting fails. A request the server may already have acted on is only
+// sent again when doing so is harmless.
+static bool call_reconnect(HttpCall* c, bool connect_failed) {
+    bool stale = c->reused && !c->received && (c->out_sent == 0 || c->idempotent);
+    if (!stale && !(connect_failed && c->next_addr != NULL)) return false;
+    if (c->reused) c->retried = true;
+    close(c->fd);
+    c->fd = -1;
+    c->out_sent = 0;
+    c->in_len = 0;
+    c->consume = 0;
+    c->state = READ_HEAD;
+    return true;
+}
+
+static int call_end(HttpCall* c, HttpResponse* res) {
+    c->state = READ_HEAD;
+    c->done++;
+    if (!c->keep_alive) c->closed = true;
+    res->data = c->stream ? (HttpSlice){ "", 0 } : (HttpSlice){ c->body != NULL ? c->body : "", c->body_len };
+    return HTTP_CALL_END;
+}
+
+// Reads the status line and headers of the next response.
+static int read_head(HttpCall* c, HttpResponse* res) {
+    int64_t found = simd_find_bytes(c->in, (int64_t)c->in_len, "\r\n\r\n", 4);
+    if (found < 0) {
+        if (c->in_len > CLIENT_MAX_HEAD) return call_fail(c, "response head too large");
+        return HTTP_CALL_WAIT;
+    }
+    size_t head_len = (size_t)found + 4;
+    const char* line_end = memchr(c->in, '\r', head_len);
+    int64_t status;
+    if (line_end - c->in < 12 || memcmp(c->in, "HTTP/1.", 7) != 0 || c->in[8] != ' ' ||
+        !parse_int(c->in + 9, 3, &status)) {
+        return call_fail(c, "invalid response");
+    }
+    c->keep_alive = c->in[7] != '0';
+    const char* fields = line_end + 2;
+    size_t fields_len = c->in + head_len - 2 - fields;
+    HttpSlice names[HTTP_MAX_HEADERS];
+    HttpSlice values[HTTP_MAX_HEADERS];
+    int count = http_parse_headers(fields, fields_len, names, values, HTTP_MAX_HEADERS);
+    if (count < 0) return call_fail(c, "invalid response header");
+    int64_t length = -1;
+    bool chunked = false;
+    for (int i = 0; i < count; i++) {
+        if (http_slice_is(names[i], "content-length")) {
+            if (!parse_int(values[i].chars, (int64_t)values[i].length, &length) || length < 0) {
+                return call_fail(c, "invalid Content-Length");
+            }
+        } else if (http_slice_is(names[i], "transfer-encoding")) {
+            chunked = http_slice_is(values[i], "chunked");
+        } else if (http_slice_is(names[i], "connection")) {
+            if (http_slice_is(values[i], "close")) c->keep_alive = false;
+            else if (http_slice_is(values[i], "keep-alive")) c->keep_alive = true;
+        }
+    }
+    if (status >= 100 && status < 200) {
+        in_drop(c, head_len); // an interim response, before the real one
+        return read_head(c, res);
+    }
+
+    res->status = (int)status;
+    res->headers = (HttpSlice){ fields, fields_len };
+    c->consume = head_len;
+    c->chunks = (HttpParser){ .read = head_len };
+    c->body_len = 0;
+    c->left = 0;
+    if (c->head[c->done] || status == 204 || status == 304) {
+        c->state = READ_LENGTH;
+    } else if (chunked) {
+        c->state = READ_CHUNKED;
+    } else if (length >= 0) {
+        c->state = READ_LENGTH;
+        c->left = (uint64_t)length;
+        if (!c->stream) body_reserve(c, c->left < CLIENT_RESERVE ? c->left : CLIENT_RESERVE);
+    } else {
+        c->state = READ_CLOSE;
+        c->keep_alive = false;
+    }
+    return HTTP_CALL_HEAD;
+}
+
+// Makes what progress the bytes in hand allow. HTTP_CALL_WAIT means more
+// are needed.
+static int call_read(HttpCall* c, HttpResponse* res) {
+    switch (c->state) {
+        case READ_HEAD:
+            return read_head(c, res);
+        case READ_LENGTH:
+        case READ_CLOSE: {
+            size_t take = c->in_len;
+            if (c->state == READ_LENGTH && take > c->left) take = c->left;
+            if (take > 0) {
+                if (c->state == READ_LENGTH) c->left -= take;
+                if (c->stream) {
+                    res->data = (HttpSlice){ c->in, take };
+                    c->consume = take;
+                    return HTTP_CALL_DATA;
+                }
+                body_reserve(c, take);
+                memcpy(c->body + c->body_len, c->in, take);
+                c->body_len += take;
+                in_drop(c, take);
+            }
+            if (c->state == READ_LENGTH && c->left == 0) return call_end(c, res);
+            return HTTP_CALL_WAIT;
+        }
+        case READ_CHUNKED: {
+            int64_t total = http_parse_chunks(&c->chunks, c->in, c->in_len);
+            if (total < 0) return call_fail(c, "invalid chunked body");
+            size_t decoded = c->chunks.body_len;
+            if (c->stream && decoded > 0) {
+                res->data = (HttpSlice){ c->in, decoded };
+                c->consume = c->chunks.read;
+                c->ended = total > 0;
+                return HTTP_CALL_DATA;
+            }
+            if (decoded > 0) {
+                body_reserve(c, decoded);
+                memcpy(c->body + c->body_len, c->in, decoded);
+                c->body_len += decoded;
+            }
+            in_drop(c, c->chunks.read);
+            c->chunks.read = 0;
+            c->chunks.body_len = 0;
+            return total > 0 ? call_end(c, res) : HTTP_CALL_WAIT;
+        }
+    }
+    return HTTP_CALL_WAIT;
+}
+
+int http_call_step(HttpCall* c, HttpResponse* res) {
+    if (c->consume > 0) {
+        in_drop(c, c->consume);
+        if (c->state == READ_CHUNKED) {
+            c->chunks.read -= c->consume;
+            c->chunks.body_len = 0;
+        }
+        c->consume = 0;
+    }
+    if (c->ended) {
+        c->ended = false;
+        return call_end(c, res);
+    }
+    if (c->done == c->count) {
+        // Back to the pool, unless the server is done with it.
+        if (c->fd >= 0 && !c->closed && c->in_len == 0) pool_put(c->host, c->port, c->fd);
+        else if (c->fd >= 0) close(c->fd);
+        c->fd = -1;
+        return HTTP_CALL_DONE;
+    }
+    if (c->closed) return call_fail(c, "the server closed the connection before answering every request");
+
+    for (;;) {
+        if (c->fd < 0 && !call_connect(c)) return HTTP_CALL_ERROR;
+        if (c->connecting) {
+            struct pollfd p = { c->fd, POLLOUT, 0 };
+            if (poll(&p, 1, 0) == 0) {
+                c->events = EPOLLOUT;
+                return HTTP_CALL_WAIT;
+            }
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+            if (err != 0) {
+                if (call_reconnect(c, true)) continue;
+                return call_fail(c, strerror(err));
+            }
+            c->connecting = false;
+        }
+
+        // Requests go out while responses come in, so that a long pipeline
+        // cannot stall with both sides' buffers full.
+        bool sent = false;
+        if (c->out_sent < c->out_len) {
+            ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                c->out_sent += n;
+                sent = true;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                if (call_reconnect(c, false)) continue;
+                return call_fail(c, strerror(errno));
+            }
+        }
+        int r = call_read(c, res);
+        if (r != HTTP_CALL_WAIT) return r;
+
+        // A body of known length is read straight into place.
+        bool direct = !c->stream && c->state == READ_LENGTH && c->in_len == 0;
+        char* into;
+        size_t space;
+        if (direct) {
+            body_reserve(c, c->left < CLIENT_RESERVE ? c->left : CLIENT_RESERVE);
+            into = c->body + c->body_len;
+            space = c->body_cap - c->body_len < c->left ? c->body_cap - c->body_len : c->left;
+        } else {
+            if (c->in_cap - c->in_len < CLIENT_READ_MIN) {
+                c->in_cap = c->in_cap < CLIENT_READ_MIN ? CLIENT_READ_MIN * 2 : c->in_cap * 2;
+                c->in = realloc(c->in, c->in_cap);
+            }
+            into = c->in + c->in_len;
+            space = c->in_cap - c->in_len;
+        }
+        ssize_t n = recv(c->fd, into, space, 0);
+        if (n > 0) {
+            c->received = true;
+            if (direct) {
+                c->body_len += n;
+                c->left -= n;
+            } else {
+                c->in_len += n;
+            }
+            continue;
+        }
+        if (n == 0) {
+            if (c->state == READ_CLOSE) return call_end(c, res);
+            if (call_reconnect(c, false)) continue;
+            return call_fail(c, "the connection closed before the response was complete");
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (sent && c->out_sent < c->out_len) continue;
+            c->events = EPOLLIN | (c->out_sent < c->out_len ? EPOLLOUT : 0);
+            return HTTP_CALL_WAIT;
+        }
+        if (call_reconnect(c, false)) continue;
+        return call_fail(c, strerror(errno));
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef OPO_CLIENT_H
+#define OPO_CLIENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "http.h"
+
+// HTTP/1.1 client behind httpRequest() and its siblings. A call writes one
+// or more requests to an origin in one go, over a keep-alive connection
+// taken from a process-wide pool, and reads the responses back in order.
+// Calls never block: http_call_step does what it can and says what to wait
+// for, leaving the waiting, in poll() or by parking a goroutine, to the
+// embedder.
+
+typedef struct {
+    char host[256];
+    int port;
+    const char* path; // into the URL, "/" when it has none
+    size_t path_len;
+    const char* authority; // host[:port] as written, for the Host header
+    size_t authority_len;
+} HttpUrl;
+
+// Splits "http://host[:port][/path]". False when url is not of that form.
+bool http_url_parse(const char* url, size_t length, HttpUrl* out);
+
+typedef struct HttpCall HttpCall;
+
+// Starts a call to host:port that sends the `count` requests in data,
+// taking data over. head[i] says whether request i is a HEAD, whose
+// response has no body. idempotent says every request may safely be sent
+// twice. Bodies come back piece by piece when stream is set, and whole
+// otherwise.
+HttpCall* http_call_new(const char* host, int port, char* data, size_t length, int count, const bool* head,
+                        bool idempotent, bool stream);
+void http_call_free(HttpCall* call);
+
+typedef struct {
+    int status;
+    HttpSlice headers; // HTTP_CALL_HEAD: the raw header lines
+    HttpSlice data;    // HTTP_CALL_DATA: the next piece of the body;
+                       // HTTP_CALL_END: the whole body, unless streamed
+} HttpResponse;
+
+enum {
+    HTTP_CALL_WAIT,  // wait until http_call_fd is ready for http_call_events
+    HTTP_CALL_HEAD,  // the next response's status and headers are in
+    HTTP_CALL_DATA,  // more of its body has arrived
+    HTTP_CALL_END,   // its body is complete
+    HTTP_CALL_DONE,  // every response has been read
+    HTTP_CALL_ERROR, // see http_call_error
+};
+
+// Moves the call on. Slices in res stay valid until the next step.
+int http_call_step(HttpCall* call, HttpResponse* res);
+int http_call_fd(const HttpCall* call);
+uint32_t http_call_events(const HttpCall* call);
+const char* http_call_error(const HttpCall* call);
+
+// After HTTP_CALL_END, hands over the buffer of a whole body. It has room
+// for a terminating byte after the data; *capacity excludes that byte.
+char* http_call_take_body(HttpCall* call, size_t* capacity);
+
+#endif
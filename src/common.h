@@ -59,7 +59,9 @@ typedef enum {
     OP_SEND,
     OP_RECV,
     OP_CHECK_TYPE,
-    OP_AS_TYPE
+    OP_AS_TYPE,
+    OP_SLICE,
+    OP_CONCAT_LOCAL
 } OpCode;
 
 typedef enum {
@@ -81,9 +83,16 @@ typedef enum {
     VAL_ERR,
     VAL_ANY,
     VAL_ENUM,
-    VAL_CHAN
+    VAL_CHAN,
+    VAL_HANDLE // native-backed object; the subtype says which kind
 } ValueType;
 
+#define HANDLE_STRBUF 1
+#define HANDLE_FILEREADER 2
+#define HANDLE_FILEWRITER 3
+#define HANDLE_ROUTER 4
+#define HANDLE_NETBUF 5
+
 #define OPTION_ENUM_ID 0xFF
 #define RESULT_ENUM_ID 0xFE
 
@@ -101,7 +110,12 @@ typedef enum {
     OBJ_MAP,
     OBJ_ENUM,
     OBJ_CHAN,
-    OBJ_CLOSURE
+    OBJ_CLOSURE,
+    OBJ_STRBUF,
+    OBJ_FILEREADER,
+    OBJ_FILEWRITER,
+    OBJ_ROUTER,
+    OBJ_NETBUF
 } ObjType;
 
 struct HeapObject {
@@ -122,17 +136,46 @@ typedef struct {
     } as;
 } Value;
 
-typedef struct {
+// Strings up to this many bytes keep their chars inline, right after the
+// header, so they cost a single allocation.
+#define STRING_INLINE_MAX 22
+
+// A substring view has an owner and points into the owner's chars, so
+// its chars are not NUL-terminated. Code that needs a C string calls
+// string_cstr, which gives the view its own copy first; the view keeps
+// its owner until it is freed, and frees the copy then.
+typedef struct ObjString {
     HeapObject obj;
-    char* chars;
-    int length;
+    char* chars; // inline_chars for short strings
+    int64_t length;
+    int64_t capacity; // bytes available for chars, excluding the NUL
+    struct ObjString* owner;
+    uint32_t hash;  // precomputed for interned strings
+    bool interned;  // one immortal copy per content, so equal means same pointer
+    bool mapped;    // chars are a read-only file mapping, unmapped on free
+    char inline_chars[];
 } ObjString;
 
-typedef struct {
+typedef struct ArrayBuffer {
+    Value* items;
+    int count;
+    struct ArrayBuffer* next;
+} ArrayBuffer;
+
+// A slice view has an owner and borrows `items` from it. The owner
+// counts its live views. When it has to mutate a buffer that views still
+// share, it moves that buffer onto `retired` and keeps it alive until the
+// last view is gone. Views may live on other threads than their owner, so
+// `retired` is only touched under the VM's retire lock.
+typedef struct ObjArray {
     HeapObject obj;
     Value* items;
     int count;
     int capacity;
+    struct ObjArray* owner;
+    _Atomic int view_count;
+    _Atomic bool items_shared;
+    ArrayBuffer* retired;
 } ObjArray;
 
 typedef struct {
@@ -148,11 +191,14 @@ typedef struct {
     bool is_used;
 } MapEntry;
 
+// A map can hold its entries as raw HTTP header lines in `pending` until
+// something first looks at it; they are split into views of `pending` then.
 typedef struct {
     HeapObject obj;
     MapEntry* entries;
     int count;
     int capacity;
+    ObjString* pending;
 } ObjMap;
 
 typedef struct {
@@ -58,6 +58,18 @@ typedef struct {
     bool is_public;
 } EnumDef;
 
+// Placeholder types for natives that work on any array. They are resolved at
+// the call site against the static type of the first argument.
+#define TYPE_ARG0 ((Type)0xFF000001)
+#define TYPE_ARG0_ELEM ((Type)0xFF000002)
+// Anything len() can measure: strings, arrays, maps and string builders.
+#define TYPE_SIZED ((Type)0xFF000003)
+#define TYPE_STRBUF MAKE_TYPE(VAL_HANDLE, HANDLE_STRBUF, 0)
+#define TYPE_FILEREADER MAKE_TYPE(VAL_HANDLE, HANDLE_FILEREADER, 0)
+#define TYPE_FILEWRITER MAKE_TYPE(VAL_HANDLE, HANDLE_FILEWRITER, 0)
+#define TYPE_ROUTER MAKE_TYPE(VAL_HANDLE, HANDLE_ROUTER, 0)
+#define TYPE_NETBUF MAKE_TYPE(VAL_HANDLE, HANDLE_NETBUF, 0)
+
 typedef struct {
     Token name;
     int index;
@@ -81,7 +93,7 @@ typedef struct {
     int struct_count;
     EnumDef enums[64];
     int enum_count;
-    Native natives[64];
+    Native natives[NATIVES_MAX];
     int native_count;
     int scope_depth;
     Loop* current_loop;
@@ -611,11 +623,13 @@ static int add_string(const char* start, int length) {
     if (current_chunk->strings_count >= current_chunk->strings_capacity) {
         current_chunk->strings_capacity = current_chunk->strings_capacity < 8 ? 8 : current_chunk->strings_capacity * 2;
         current_chunk->strings = realloc(current_chunk->strings, sizeof(char*) * current_chunk->strings_capacity);
+        current_chunk->string_lengths = realloc(current_chunk->string_lengths, sizeof(int) * current_chunk->strings_capacity);
     }
     char* s = malloc(length + 1);
     memcpy(s, start, length);
     s[length] = '\0';
     current_chunk->strings[current_chunk->strings_count] = s;
+    current_chunk->string_lengths[current_chunk->strings_count] = length;
     return current_chunk->strings_count++;
 }
 
@@ -798,6 +812,12 @@ static Type unify_inferred_types(Type current, Type next) {
     return VAL_NONE;
 }
 
+static Type resolve_native_type(Type type, Type first_arg_type) {
+    if (type == TYPE_ARG0) return first_arg_type;
+    if (type == TYPE_ARG0_ELEM) return TYPE_SUB(first_arg_type) != 0 ? (Type)TYPE_SUB(first_arg_type) : VAL_ANY;
+    return type;
+}
+
 static void add_native(const char* name, int index, Type ret, int p_count, ...) {
     Native* n = &current_compiler->natives[current_compiler->native_count++];
     n->name.start = name;
@@ -922,6 +942,11 @@ static Type parse_type() {
         else if (t.length == 4 && memcmp(t.start, "void", 4) == 0) type = VAL_VOID;
         else if (t.length == 3 && memcmp(t.start, "fun", 3) == 0) type = VAL_FUNC;
         else if (t.length == 3 && memcmp(t.start, "any", 3) == 0) type = VAL_ANY;
+        else if (t.length == 6 && memcmp(t.start, "strbuf", 6) == 0) type = TYPE_STRBUF;
+        else if (t.length == 10 && memcmp(t.start, "fileReader", 10) == 0) type = TYPE_FILEREADER;
+        else if (t.length == 10 && memcmp(t.start, "fileWriter", 10) == 0) type = TYPE_FILEWRITER;
+        else if (t.length == 6 && memcmp(t.start, "router", 6) == 0) type = TYPE_ROUTER;
+        else if (t.length == 6 && memcmp(t.start, "netbuf", 6) == 0) type = TYPE_NETBUF;
         else if (t.length == 4 && memcmp(t.start, "chan", 4) == 0) {
             consume(TOKEN_LANGLE, "Expect '<' after 'chan' type.");
             Type element = parse_type();
@@ -1037,6 +1062,18 @@ static void expression() {
     parse_precedence(PREC_ASSIGNMENT);
 }
 
+// True when the expression just parsed is followed by "=> name" and name is
+// the local `arg`, so the result is stored straight back into it.
+static bool assigns_back_to(int arg) {
+    if (parser.current.type != TOKEN_ASSIGN) return false;
+    Lexer saved = lexer;
+    Token name = lexer_next_token();
+    Token after = lexer_next_token();
+    lexer = saved;
+    if (name.type != TOKEN_ID || after.type == TOKEN_DOT) return false;
+    return resolve_local(current_compiler, &name) == arg;
+}
+
 static void binary() {
     TokenType operator_type = parser.previous.type;
     ParseRule* rule = get_rule(operator_type);
@@ -1044,6 +1081,7 @@ static void binary() {
 
     Type b = type_pop();
     Type a = type_pop();
+    int a_local = popped_local;
 
     switch (operator_type) {
         case TOKEN_PLUS:
@@ -1055,7 +1093,11 @@ static void binary() {
             }
             if (operator_type == TOKEN_PLUS) {
                 if (a == VAL_STR && b == VAL_STR) {
-                    emit_byte(OP_ADD);
+                    if (a_local != -1 && assigns_back_to(a_local)) {
+                        emit_bytes(OP_CONCAT_LOCAL, (uint8_t)a_local);
+                    } else {
+                        emit_byte(OP_ADD);
+                    }
                     type_push(VAL_STR);
                 } else {
                     if (a != b) {
@@ -1237,6 +1279,26 @@ static void dot() {
         if (TYPE_KIND(lhs_type) == VAL_MAP) type_push(TYPE_SUB(lhs_type));
         else if (TYPE_KIND(lhs_type) == VAL_STR) type_push(VAL_STR);
         else type_push(VAL_ANY);
+    } else if (match(TOKEN_LBRACKET)) {
+        // Slice: arr.[lo..hi], with either bound optional.
+        if (TYPE_KIND(lhs_type) != VAL_OBJ || TYPE_SUB(lhs_type) == 0) {
+            error_at(&parser.previous, "Can only slice arrays.");
+        }
+        uint8_t bounds = 0;
+        if (parser.current.type != TOKEN_DOT_DOT) {
+            expression();
+            if (!is_assignable(VAL_INT, type_pop())) error_at(&parser.previous, "Slice bound must be an int.");
+            bounds |= 1;
+        }
+        consume(TOKEN_DOT_DOT, "Expect '..' in slice.");
+        if (parser.current.type != TOKEN_RBRACKET) {
+            expression();
+            if (!is_assignable(VAL_INT, type_pop())) error_at(&parser.previous, "Slice bound must be an int.");
+            bounds |= 2;
+        }
+        consume(TOKEN_RBRACKET, "Expect ']' after slice.");
+        emit_bytes(OP_SLICE, bounds);
+        type_push(lhs_type);
     } else if (match(TOKEN_LPAREN)) {
         if (TYPE_KIND(lhs_type) == VAL_ANY) {
             error_at(&parser.previous, "Cannot index 'any'. Match it first.");
@@ -1657,11 +1719,11 @@ static void variable() {
                     if (arg_count == 0) first_arg_type = arg_type;
                     
                     if (arg_count < n->param_count) {
-                        Type expected = n->param_types[arg_count];
-                        if (n_idx == 1 && arg_count == 1) { // append
-                            if (TYPE_SUB(first_arg_type) != 0) expected = TYPE_SUB(first_arg_type);
-                        }
-                        if (!is_assignable(expected, arg_type)) {
+                        Type expected = resolve_native_type(n->param_types[arg_count], first_arg_type);
+                        bool ok = expected == TYPE_SIZED
+                            ? is_assignable(VAL_OBJ, arg_type) || arg_type == TYPE_STRBUF || arg_type == TYPE_NETBUF
+                            : is_assignable(expected, arg_type);
+                        if (!ok) {
                             error_at(&parser.previous, "Native function argument type mismatch.");
                         }
                     }
@@ -1680,8 +1742,17 @@ static void variable() {
             } else {
                 emit_bytes(OP_INVOKE, (uint8_t)arg_count);
             }
-            if (n_idx == 1) type_push(first_arg_type); // append returns its first arg type
-            else type_push(n->return_type);
+            Type ret = resolve_native_type(n->return_type, first_arg_type);
+            // A reduction over an empty array has no item to take the kind
+            // from and answers int 0; tag it with the static element type,
+            // whose zero has the same bits.
+            if (n->return_type == TYPE_ARG0_ELEM && ret != VAL_ANY && !current_compiler->is_go) {
+                emit_byte(OP_AS_TYPE);
+                emit_int32(ret);
+            }
+            // Natives always push a result; void ones must leave the stack as user functions do.
+            if (ret == VAL_VOID && !current_compiler->is_go) emit_byte(OP_POP);
+            type_push(ret);
         } else {
             emit_bytes(OP_LOAD_G, (uint8_t)n_idx);
             type_push(VAL_OBJ);
@@ -2062,6 +2133,11 @@ static Type type_from_name(Token t) {
     if (t.length == 3 && memcmp(t.start, "err", 3) == 0) return VAL_ERR;
     if (t.length == 3 && memcmp(t.start, "fun", 3) == 0) return VAL_FUNC;
     if (t.length == 4 && memcmp(t.start, "chan", 4) == 0) return VAL_CHAN;
+    if (t.length == 6 && memcmp(t.start, "strbuf", 6) == 0) return TYPE_STRBUF;
+    if (t.length == 10 && memcmp(t.start, "fileReader", 10) == 0) return TYPE_FILEREADER;
+    if (t.length == 10 && memcmp(t.start, "fileWriter", 10) == 0) return TYPE_FILEWRITER;
+    if (t.length == 6 && memcmp(t.start, "router", 6) == 0) return TYPE_ROUTER;
+    if (t.length == 6 && memcmp(t.start, "netbuf", 6) == 0) return TYPE_NETBUF;
     if (t.length == 4 && memcmp(t.start, "list", 4) == 0) return MAKE_TYPE(VAL_OBJ, VAL_ANY, 0);
     if (t.length == 3 && memcmp(t.start, "map", 3) == 0) return MAKE_TYPE(VAL_MAP, VAL_ANY, VAL_ANY);
     return VAL_NONE;
@@ -2582,6 +2658,7 @@ Chunk* compiler_compile(const char* source, const char* base_dir, const char* st
     current_chunk->count = 0;
     current_chunk->capacity = 0;
     current_chunk->strings = NULL;
+    current_chunk->string_lengths = NULL;
     current_chunk->strings_count = 0;
     current_chunk->strings_capacity = 0;
     add_string("none", 4);
@@ -2603,12 +2680,12 @@ Chunk* compiler_compile(const char* source, const char* base_dir, const char* st
     current_compiler->current_return_type = VAL_VOID;
     current_compiler->type_stack_ptr = 0;
     current_compiler->is_go = false;
-    add_native("len", 0, VAL_INT, 1, VAL_OBJ);
-    add_native("append", 1, VAL_OBJ, 2, VAL_OBJ, VAL_ANY);
+    add_native("len", 0, VAL_INT, 1, TYPE_SIZED);
+    add_native("append", 1, TYPE_ARG0, 2, VAL_OBJ, TYPE_ARG0_ELEM);
     add_native("str", 2, VAL_STR, 1, VAL_ANY);
     add_native("readFile", 3, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_STR), 1, VAL_STR);
     add_native("writeFile", 4, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_BOOL), 2, VAL_STR, VAL_STR);
-    add_native("args", 5, VAL_OBJ, 0);
+    add_native("args", 5, MAKE_TYPE(VAL_OBJ, VAL_STR, 0), 0);
     add_native("int", 6, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_INT), 1, VAL_ANY);
     add_native("print", 7, VAL_VOID, 1, VAL_ANY);
     add_native("println", 8, VAL_VOID, 1, VAL_ANY);
@@ -2648,6 +2725,57 @@ Chunk* compiler_compile(const char* source, const char* base_dir, const char* st
     add_native("tcpClose", 42, VAL_VOID, 1, VAL_INT);
     add_native("httpParse", 43, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_MAP), 1, VAL_STR);
     add_native("httpFormat", 44, VAL_STR, 1, VAL_MAP);
+    add_native("arraySum", 45, TYPE_ARG0_ELEM, 1, VAL_OBJ);
+    add_native("arrayMin", 46, TYPE_ARG0_ELEM, 1, VAL_OBJ);
+    add_native("arrayMax", 47, TYPE_ARG0_ELEM, 1, VAL_OBJ);
+    add_native("arrayIndexOf", 48, VAL_INT, 2, VAL_OBJ, TYPE_ARG0_ELEM);
+    add_native("arrayCount", 49, VAL_INT, 2, VAL_OBJ, TYPE_ARG0_ELEM);
+    add_native("arrayDot", 50, TYPE_ARG0_ELEM, 2, VAL_OBJ, TYPE_ARG0);
+    add_native("sort", 51, TYPE_ARG0, 1, VAL_OBJ);
+    add_native("sortBy", 52, TYPE_ARG0, 2, VAL_OBJ, VAL_FUNC);
+    add_native("substr", 53, VAL_STR, 3, VAL_STR, VAL_INT, VAL_INT);
+    add_native("strbuf", 54, TYPE_STRBUF, 0);
+    add_native("strbufPush", 55, VAL_VOID, 2, TYPE_STRBUF, VAL_STR);
+    add_native("strbufPushInt", 56, VAL_VOID, 2, TYPE_STRBUF, VAL_INT);
+    add_native("strbufPushFlt", 57, VAL_VOID, 2, TYPE_STRBUF, VAL_FLT);
+    add_native("strbufFinish", 58, VAL_STR, 1, TYPE_STRBUF);
+    add_native("strFind", 59, VAL_INT, 2, VAL_STR, VAL_STR);
+    add_native("strContains", 60, VAL_BOOL, 2, VAL_STR, VAL_STR);
+    add_native("strCount", 61, VAL_INT, 2, VAL_STR, VAL_STR);
+    add_native("strSplit", 62, MAKE_TYPE(VAL_OBJ, VAL_STR, 0), 2, VAL_STR, VAL_STR);
+    add_native("strReplace", 63, VAL_STR, 3, VAL_STR, VAL_STR, VAL_STR);
+    add_native("readAll", 64, VAL_STR, 0);
+    add_native("readInts", 65, MAKE_TYPE(VAL_OBJ, VAL_INT, 0), 1, VAL_INT);
+    add_native("readTokens", 66, MAKE_TYPE(VAL_OBJ, VAL_STR, 0), 0);
+    add_native("lines", 67, MAKE_TYPE(VAL_OBJ, VAL_STR, 0), 0);
+    add_native("mmapFile", 68, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_STR), 1, VAL_STR);
+    add_native("fileReader", 69, TYPE_FILEREADER, 1, VAL_STR);
+    add_native("readerChunk", 70, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_STR), 2, TYPE_FILEREADER, VAL_INT);
+    add_native("readerLine", 71, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_STR), 1, TYPE_FILEREADER);
+    add_native("readerEof", 72, VAL_BOOL, 1, TYPE_FILEREADER);
+    add_native("fileOpen", 73, TYPE_FILEWRITER, 2, VAL_STR, VAL_STR);
+    add_native("fileWrite", 74, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_BOOL), 2, TYPE_FILEWRITER, VAL_STR);
+    add_native("fileWriteLine", 75, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_BOOL), 2, TYPE_FILEWRITER, VAL_STR);
+    add_native("fileWritev", 76, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_BOOL), 2, TYPE_FILEWRITER, MAKE_TYPE(VAL_OBJ, VAL_STR, 0));
+    add_native("fileFlush", 77, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_BOOL), 1, TYPE_FILEWRITER);
+    add_native("fileClose", 78, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_BOOL), 1, TYPE_FILEWRITER);
+    add_native("httpServe", 79, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_BOOL), 2, VAL_INT, VAL_FUNC);
+    add_native("router", 80, TYPE_ROUTER, 0);
+    add_native("routerAdd", 81, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_BOOL), 4, TYPE_ROUTER, VAL_STR, VAL_STR, VAL_INT);
+    add_native("routerMatch", 82, VAL_INT, 4, TYPE_ROUTER, VAL_STR, VAL_STR, MAKE_TYPE(VAL_MAP, VAL_STR, VAL_STR));
+    add_native("httpTemplate", 83, VAL_STR, 1, MAKE_TYPE(VAL_MAP, VAL_STR, VAL_STR));
+    add_native("httpRespond", 84, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_INT), 4, VAL_INT, VAL_INT, VAL_STR, VAL_STR);
+    add_native("tcpSendv", 85, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_INT), 2, VAL_INT, MAKE_TYPE(VAL_OBJ, VAL_STR, 0));
+    add_native("tcpSendFile", 86, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_INT), 4, VAL_INT, VAL_STR, VAL_INT, VAL_INT);
+    add_native("httpRequest", 87, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_MAP), 4, VAL_STR, VAL_STR, MAKE_TYPE(VAL_MAP, VAL_STR, VAL_STR), VAL_STR);
+    add_native("httpPipeline", 88, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_OBJ), 1, MAKE_TYPE(VAL_OBJ, VAL_MAP, 0));
+    add_native("httpStream", 89, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_MAP), 5, VAL_STR, VAL_STR, MAKE_TYPE(VAL_MAP, VAL_STR, VAL_STR), VAL_STR, VAL_FUNC);
+    add_native("tcpListenWith", 90, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_INT), 2, VAL_INT, MAKE_TYPE(VAL_MAP, VAL_INT, VAL_STR));
+    add_native("httpServeWith", 91, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_BOOL), 3, VAL_INT, VAL_FUNC, MAKE_TYPE(VAL_MAP, VAL_INT, VAL_STR));
+    add_native("netbuf", 92, TYPE_NETBUF, 1, VAL_INT);
+    add_native("recvInto", 93, MAKE_TYPE(VAL_ENUM, RESULT_ENUM_ID, VAL_INT), 2, VAL_INT, TYPE_NETBUF);
+    add_native("netbufPeek", 94, VAL_STR, 1, TYPE_NETBUF);
+    add_native("netbufTake", 95, VAL_STR, 2, TYPE_NETBUF, VAL_INT);
 
     parser.had_error = false;
     parser.panic_mode = false;
@@ -2686,6 +2814,7 @@ void chunk_free(Chunk* chunk) {
         free(chunk->code);
         for (int i = 0; i < chunk->strings_count; i++) free(chunk->strings[i]);
         free(chunk->strings);
+        free(chunk->string_lengths);
         free(chunk);
     }
 }
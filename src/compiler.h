@@ -10,6 +10,7 @@ typedef struct {
     int count;
     int capacity;
     char** strings;
+    int* string_lengths;
     int strings_count;
     int strings_capacity;
 } Chunk;
@@ -0,0 +1,815 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "http.h"
+#include "numconv.h"
+#include "simd.h"
+
+#define HTTP_EVENTS 256
+#define HTTP_IOV 64
+#define HTTP_READ_MIN (16 * 1024)       // free space ensured before each recv
+#define HTTP_MAX_HEAD (64 * 1024)       // request line and headers
+#define HTTP_MAX_BODY (16 * 1024 * 1024)
+#define HTTP_MAX_IN (2 * HTTP_MAX_BODY) // unparsed bytes held: a request with its chunk framing
+#define HTTP_OUT_HIGH (1024 * 1024)     // queued response bytes that pause reading
+#define HTTP_FILES_MAX 1024             // open files per worker
+#define HTTP_FILES_SLOTS 2048
+#define HTTP_FILES_RECHECK 1            // seconds an entry is trusted
+
+typedef struct {
+    int fd;
+    char* in;
+    size_t in_len;
+    size_t in_cap;
+    HttpParser parser;
+    HttpOut out;
+    size_t out_sent;
+    uint32_t events; // what it is registered for
+    bool held;       // requests left unparsed while out was backlogged
+    bool eof;        // the peer is done sending
+    bool closing;    // close once out is sent
+} HttpConn;
+
+typedef struct {
+    int listen_fd;
+    int epoll_fd;
+    HttpHandler handler;
+    void* state;
+} HttpWorker;
+
+typedef struct {
+    int listen_fd;
+    HttpHandler handler;
+    HttpWorkerInit init;
+    void* arg;
+} HttpSpawn;
+
+// ---- responses ----
+
+void http_out_append(HttpOut* out, const char* chars, size_t length) {
+    if (out->length + length > out->capacity) {
+        size_t capacity = out->capacity < 4096 ? 4096 : out->capacity * 2;
+        while (capacity < out->length + length) capacity *= 2;
+        out->data = realloc(out->data, capacity);
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->length, chars, length);
+    out->length += length;
+    out->total += length;
+}
+
+static void push_segment(HttpOut* out, HttpSegment segment) {
+    if (out->segment_count == out->segment_capacity) {
+        out->segment_capacity = out->segment_capacity < 8 ? 8 : out->segment_capacity * 2;
+        out->segments = realloc(out->segments, sizeof(HttpSegment) * out->segment_capacity);
+    }
+    out->segments[out->segment_count++] = segment;
+}
+
+// Ends the range of data not yet covered by a segment, before a segment
+// that lives elsewhere.
+static void out_seal(HttpOut* out) {
+    if (out->length > out->sealed) {
+        push_segment(out, (HttpSegment){ NULL, out->sealed, out->length - out->sealed, -1, NULL, NULL });
+        out->sealed = out->length;
+    }
+}
+
+void http_out_attach(HttpOut* out, const char* chars, size_t length, void (*release)(void* ref), void* ref) {
+    out_seal(out);
+    push_segment(out, (HttpSegment){ chars, 0, length, -1, release, ref });
+    out->total += length;
+}
+
+void http_out_reset(HttpOut* out) {
+    for (int i = 0; i < out->segment_count; i++) {
+        if (out->segments[i].release != NULL) out->segments[i].release(out->segments[i].ref);
+    }
+    out->segment_count = 0;
+    out->length = out->sealed = out->total = 0;
+}
+
+// Fills iov with what is queued after the first `skip` bytes, up to the
+// next file. Returns how many entries it used, 0 once nothing is left or
+// when a file comes first. *file is the file segment it stopped at, if
+// any, and *file_skip how much of that has been sent.
+static int out_iov(const HttpOut* out, size_t skip, struct iovec* iov, int max,
+                   const HttpSegment** file, size_t* file_skip) {
+    int count = 0;
+    *file = NULL;
+    for (int i = 0; i <= out->segment_count && count < max; i++) {
+        const char* chars;
+        size_t length;
+        if (i < out->segment_count) {
+            const HttpSegment* segment = &out->segments[i];
+            if (segment->file >= 0 && skip < segment->length) {
+                *file = segment;
+                *file_skip = skip;
+                break;
+            }
+            chars = segment->chars != NULL ? segment->chars : out->data + segment->offset;
+            length = segment->length;
+        } else {
+            chars = out->data + out->sealed;
+            length = out->length - out->sealed;
+        }
+        if (skip >= length) {
+            skip -= length;
+            continue;
+        }
+        iov[count++] = (struct iovec){ (void*)(chars + skip), length - skip };
+        skip = 0;
+    }
+    return count;
+}
+
+static const char* reason_phrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Content Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        default: return status < 400 ? "OK" : "Error";
+    }
+}
+
+size_t http_status_line(char* line, int status) {
+    memcpy(line, "HTTP/1.1 ", 9);
+    size_t length = 9 + fmt_int(line + 9, status);
+    line[length++] = ' ';
+    const char* reason = reason_phrase(status);
+    size_t reason_len = strlen(reason);
+    memcpy(line + length, reason, reason_len);
+    length += reason_len;
+    line[length++] = '\r';
+    line[length++] = '\n';
+    return length;
+}
+
+size_t http_length_line(char* line, size_t body_len) {
+    memcpy(line, "Content-Length: ", 16);
+    size_t length = 16 + fmt_int(line + 16, (int64_t)body_len);
+    memcpy(line + length, "\r\n\r\n", 4);
+    return length + 4;
+}
+
+void http_out_status(HttpOut* out, int status) {
+    char line[HTTP_LINE_MAX];
+    http_out_append(out, line, http_status_line(line, status));
+}
+
+void http_out_header(HttpOut* out, const char* name, size_t name_len, const char* value, size_t value_len) {
+    http_out_append(out, name, name_len);
+    http_out_append(out, ": ", 2);
+    http_out_append(out, value, value_len);
+    http_out_append(out, "\r\n", 2);
+}
+
+bool http_out_end(HttpOut* out, const HttpRequest* req, int status, size_t body_len) {
+    if (req == NULL || !req->keep_alive) http_out_append(out, "Connection: close\r\n", 19);
+    else if (req->http10) http_out_append(out, "Connection: keep-alive\r\n", 24);
+    // 1xx and 204 responses carry neither a body nor its length.
+    if (status < 200 || status == 204) {
+        http_out_append(out, "\r\n", 2);
+        return false;
+    }
+    char line[HTTP_LINE_MAX];
+    http_out_append(out, line, http_length_line(line, body_len));
+    return status != 304 && (req == NULL || !http_slice_is(req->method, "head"));
+}
+
+// ---- parsing ----
+
+bool http_slice_is(HttpSlice s, const char* lower) {
+    size_t n = strlen(lower);
+    if (s.length != n) return false;
+    for (size_t i = 0; i < n; i++) {
+        char c = s.chars[i];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if (c != lower[i]) return false;
+    }
+    return true;
+}
+
+static HttpSlice trim(const char* start, const char* end) {
+    while (start < end && (*start == ' ' || *start == '\t')) start++;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    return (HttpSlice){ start, (size_t)(end - start) };
+}
+
+int http_parse_headers(const char* chars, size_t length, HttpSlice* names, HttpSlice* values, int max) {
+    const char* line = chars;
+    const char* stop = chars + length;
+    int count = 0;
+    while (line < stop && count < max) {
+        const char* end = memchr(line, '\r', stop - line);
+        if (end == NULL) end = stop;
+        const char* colon = memchr(line, ':', end - line);
+        if (colon == NULL || colon == line) return -1;
+        names[count] = (HttpSlice){ line, (size_t)(colon - line) };
+        values[count] = trim(colon + 1, end);
+        count++;
+        line = end + 2;
+    }
+    return count;
+}
+
+// Fills in everything but the body from a complete head. Returns 0, or the
+// status to reject the request with.
+static int parse_head(const char* data, size_t head_len, HttpRequest* req, int64_t* content_length, bool* chunked) {
+    const char* head_end = data + head_len - 2; // after the last header's CRLF
+    const char* line_end = memchr(data, '\r', head_end - data);
+    const char* sp1 = memchr(data, ' ', line_end - data);
+    if (sp1 == NULL || sp1 == data) return 400;
+    const char* sp2 = memchr(sp1 + 1, ' ', line_end - sp1 - 1);
+    if (sp2 == NULL || sp2 == sp1 + 1) return 400;
+    req->method = (HttpSlice){ data, (size_t)(sp1 - data) };
+    req->path = (HttpSlice){ sp1 + 1, (size_t)(sp2 - sp1 - 1) };
+    HttpSlice version = { sp2 + 1, (size_t)(line_end - sp2 - 1) };
+    if (version.length != 8 || memcmp(version.chars, "HTTP/1.", 7) != 0) return 400;
+    req->http10 = version.chars[7] == '0';
+    req->keep_alive = !req->http10;
+
+    const char* fields = line_end + 2;
+    size_t fields_len = fields < head_end ? (size_t)(head_end - fields) : 0;
+    req->headers = (HttpSlice){ fields, fields_len };
+    req->header_count = http_parse_headers(fields, fields_len, req->header_names, req->header_values, HTTP_MAX_HEADERS);
+    if (req->header_count < 0) return 400;
+    if (req->header_count == HTTP_MAX_HEADERS) {
+        const char* last = req->header_values[HTTP_MAX_HEADERS - 1].chars;
+        const char* after = memchr(last, '\r', fields + fields_len - last);
+        if (after != NULL && after + 2 < fields + fields_len) return 431;
+    }
+
+    *content_length = 0;
+    *chunked = false;
+    bool has_length = false;
+    for (int i = 0; i < req->header_count; i++) {
+        HttpSlice name = req->header_names[i];
+        HttpSlice value = req->header_values[i];
+        if (http_slice_is(name, "content-length")) {
+            if (!parse_int(value.chars, (int64_t)value.length, content_length) || *content_length < 0) return 400;
+            if (*content_length > HTTP_MAX_BODY) return 413;
+            has_length = true;
+        } else if (http_slice_is(name, "transfer-encoding")) {
+            if (!http_slice_is(value, "chunked")) return 501;
+            *chunked = true;
+        } else if (http_slice_is(name, "connection")) {
+            if (http_slice_is(value, "close")) req->keep_alive = false;
+            else if (http_slice_is(value, "keep-alive")) req->keep_alive = true;
+        }
+    }
+    // A peer framing the body both ways may disagree with us about where it
+    // ends, so the request is refused rather than one framing picked.
+    if (has_length && *chunked) return 400;
+    return 0;
+}
+
+enum { CHUNK_SIZE, CHUNK_DATA, CHUNK_END, CHUNK_TRAILER };
+
+int64_t http_parse_chunks(HttpParser* p, char* data, size_t length) {
+    for (;;) {
+        switch (p->chunk_state) {
+            case CHUNK_SIZE: {
+                const char* line = data + p->read;
+                const char* end = memchr(line, '\r', length - p->read);
+                if (end == NULL || end + 1 >= data + length) return length - p->read > 64 ? -400 : 0;
+                if (end[1] != '\n') return -400;
+                uint64_t size = 0;
+                const char* c = line;
+                for (; c < end && *c != ';'; c++) {
+                    int digit = *c >= '0' && *c <= '9' ? *c - '0'
+                              : (*c | 0x20) >= 'a' && (*c | 0x20) <= 'f' ? (*c | 0x20) - 'a' + 10 : -1;
+                    if (digit < 0 || size > HTTP_MAX_BODY) return -400;
+                    size = size * 16 + digit;
+                }
+                if (c == line) return -400;
+                if (p->body_len + size > HTTP_MAX_BODY) return -413;
+                p->read = end + 2 - data;
+                p->chunk_left = size;
+                p->chunk_state = size == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+                break;
+            }
+            case CHUNK_DATA: {
+                size_t take = length - p->read;
+                if (take > p->chunk_left) take = p->chunk_left;
+                memmove(data + p->head_len + p->body_len, data + p->read, take);
+                p->body_len += take;
+                p->read += take;
+                p->chunk_left -= take;
+                if (p->chunk_left > 0) return 0;
+                p->chunk_state = CHUNK_END;
+                break;
+            }
+            case CHUNK_END:
+                if (length - p->read < 2) return 0;
+                if (data[p->read] != '\r' || data[p->read + 1] != '\n') return -400;
+                p->read += 2;
+                p->chunk_state = CHUNK_SIZE;
+                break;
+            case CHUNK_TRAILER: {
+                // Trailer fields are skipped up to the empty line ending them.
+                const char* line = data + p->read;
+                const char* end = memchr(line, '\n', length - p->read);
+                if (end == NULL) return length - p->read > HTTP_MAX_HEAD ? -431 : 0;
+                p->read = end + 1 - data;
+                if (end == line + 1 && line[0] == '\r') return (int64_t)p->read;
+                if (end == line) return -400;
+                break;
+            }
+        }
+    }
+}
+
+int64_t http_parse(HttpParser* p, char* data, size_t length, HttpRequest* req) {
+    if (p->head_len == 0) {
+        size_t from = p->scanned > 3 ? p->scanned - 3 : 0;
+        int64_t found = simd_find_bytes(data + from, (int64_t)(length - from), "\r\n\r\n", 4);
+        if (found < 0) {
+            p->scanned = length;
+            return length > HTTP_MAX_HEAD ? -431 : 0;
+        }
+        p->head_len = from + found + 4;
+        p->read = p->head_len;
+    }
+
+    // The head is parsed again on each call rather than kept, as the buffer
+    // it points into may have moved since.
+    int64_t content_length;
+    bool chunked;
+    int status = parse_head(data, p->head_len, req, &content_length, &chunked);
+    if (status != 0) return -status;
+
+    int64_t total;
+    if (chunked) {
+        total = http_parse_chunks(p, data, length);
+        if (total <= 0) return total;
+        req->body = (HttpSlice){ data + p->head_len, p->body_len };
+    } else {
+        if (length - p->head_len < (size_t)content_length) return 0;
+        req->body = (HttpSlice){ data + p->head_len, (size_t)content_length };
+        total = (int64_t)(p->head_len + content_length);
+    }
+    memset(p, 0, sizeof(HttpParser));
+    return total;
+}
+
+// ---- files ----
+
+typedef struct {
+    int fd;
+    size_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char* head;       // Content-Type, ETag and Last-Modified lines
+    size_t head_len;
+    const char* etag; // within head
+    size_t etag_len;
+    int refs;         // the cache's, and one per queued segment
+} HttpFile;
+
+typedef struct {
+    char* path;     // NULL for a free slot
+    size_t path_len;
+    uint64_t hash;
+    HttpFile* file; // NULL while path is not a readable file
+    time_t checked;
+} FileSlot;
+
+struct HttpFiles {
+    FileSlot slots[HTTP_FILES_SLOTS];
+    int count;
+};
+
+static const char* content_type(const char* path, size_t length) {
+    static const char* types[][2] = {
+        { "html", "text/html; charset=utf-8" }, { "htm", "text/html; charset=utf-8" },
+        { "css", "text/css; charset=utf-8" }, { "js", "text/javascript; charset=utf-8" },
+        { "json", "application/json" }, { "txt", "text/plain; charset=utf-8" },
+        { "xml", "application/xml" }, { "svg", "image/svg+xml" }, { "png", "image/png" },
+        { "jpg", "image/jpeg" }, { "jpeg", "image/jpeg" }, { "gif", "image/gif" },
+        { "webp", "image/webp" }, { "ico", "image/x-icon" }, { "woff2", "font/woff2" },
+        { "wasm", "application/wasm" }, { "pdf", "application/pdf" },
+    };
+    size_t dot = length;
+    while (dot > 0 && path[dot - 1] != '.' && path[dot - 1] != '/') dot--;
+    if (dot == 0 || path[dot - 1] != '.') return "application/octet-stream";
+    HttpSlice ext = { path + dot, length - dot };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (http_slice_is(ext, types[i][0])) return types[i][1];
+    }
+    return "application/octet-stream";
+}
+
+static bool file_same(const HttpFile* file, const struct stat* st) {
+    return file->dev == st->st_dev && file->ino == st->st_ino && file->size == (size_t)st->st_size &&
+           file->mtime.tv_sec == st->st_mtim.tv_sec && file->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void file_release(void* ref) {
+    HttpFile* file = ref;
+    if (--file->refs > 0) return;
+    close(file->fd);
+    free(file->head);
+    free(file);
+}
+
+static HttpFile* file_open(const char* path, size_t length) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    HttpFile* file = malloc(sizeof(HttpFile));
+    file->fd = fd;
+    file->size = (size_t)st.st_size;
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->mtime = st.st_mtim;
+    file->refs = 1;
+
+    char date[64];
+    struct tm tm;
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&st.st_mtim.tv_sec, &tm));
+    const char* type = content_type(path, length);
+    size_t capacity = strlen(type) + strlen(date) + 128;
+    file->head = malloc(capacity);
+    int etag_at = snprintf(file->head, capacity, "Content-Type: %s\r\nETag: ", type);
+    int etag_end = etag_at + snprintf(file->head + etag_at, capacity - etag_at, "\"%llx-%llx\"",
+                                      (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + (unsigned long long)st.st_mtim.tv_nsec,
+                                      (unsigned long long)st.st_size);
+    file->head_len = etag_end + snprintf(file->head + etag_end, capacity - etag_end, "\r\nLast-Modified: %s\r\n", date);
+    file->etag = file->head + etag_at;
+    file->etag_len = etag_end - etag_at;
+    return file;
+}
+
+HttpFiles* http_files_new(void) {
+    return calloc(1, sizeof(HttpFiles));
+}
+
+static void files_clear(HttpFiles* files) {
+    for (int i = 0; i < HTTP_FILES_SLOTS; i++) {
+        FileSlot* slot = &files->slots[i];
+        if (slot->path == NULL) continue;
+        if (slot->file != NULL) file_release(slot->file);
+        free(slot->path);
+        slot->path = NULL;
+    }
+    files->count = 0;
+}
+
+void http_files_free(HttpFiles* files) {
+    files_clear(files);
+    free(files);
+}
+
+// The open file at path, from the cache while its entry is fresh. Paths
+// that are not readable files are remembered too, so repeated misses cost
+// no more than hits.
+static HttpFile* files_get(HttpFiles* files, const char* path, size_t length) {
+    if (length == 0 || length >= PATH_MAX) return NULL;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) hash = (hash ^ (unsigned char)path[i]) * 1099511628211ULL;
+    size_t i = hash & (HTTP_FILES_SLOTS - 1);
+    while (files->slots[i].path != NULL && (files->slots[i].hash != hash || files->slots[i].path_len != length ||
+                                            memcmp(files->slots[i].path, path, length) != 0)) {
+        i = (i + 1) & (HTTP_FILES_SLOTS - 1);
+    }
+    FileSlot* slot = &files->slots[i];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if (slot->path != NULL && now.tv_sec - slot->checked < HTTP_FILES_RECHECK) return slot->file;
+
+    char name[PATH_MAX];
+    memcpy(name, path, length);
+    name[length] = '\0';
+    struct stat st;
+    bool found = stat(name, &st) == 0 && S_ISREG(st.st_mode);
+    if (slot->path != NULL && slot->file != NULL && found && file_same(slot->file, &st)) {
+        slot->checked = now.tv_sec;
+        return slot->file;
+    }
+    if (slot->path == NULL) {
+        if (files->count == HTTP_FILES_MAX) {
+            files_clear(files);
+            slot = &files->slots[hash & (HTTP_FILES_SLOTS - 1)];
+        }
+        slot->path = malloc(length);
+        memcpy(slot->path, path, length);
+        slot->path_len = length;
+        slot->hash = hash;
+        files->count++;
+    } else if (slot->file != NULL) {
+        file_release(slot->file); // queued responses keep their reference
+    }
+    slot->file = found ? file_open(name, length) : NULL;
+    slot->checked = now.tv_sec;
+    return slot->file;
+}
+
+bool http_out_file(HttpOut* out, HttpFiles* files, const HttpRequest* req, const char* path, size_t path_len,
+                   const char* headers, size_t headers_len) {
+    HttpFile* file = files_get(files, path, path_len);
+    if (file == NULL) return false;
+    int status = 200;
+    for (int i = 0; i < req->header_count; i++) {
+        if (!http_slice_is(req->header_names[i], "if-none-match")) continue;
+        HttpSlice tags = req->header_values[i];
+        if ((tags.length == 1 && tags.chars[0] == '*') || simd_find_bytes(tags.chars, (int64_t)tags.length, file->etag, (int64_t)file->etag_len) >= 0) {
+            status = 304;
+        }
+    }
+    http_out_status(out, status);
+    http_out_append(out, file->head, file->head_len);
+    http_out_append(out, headers, headers_len);
+    if (http_out_end(out, req, status, file->size) && file->size > 0) {
+        out_seal(out);
+        file->refs++;
+        push_segment(out, (HttpSegment){ NULL, 0, file->size, file->fd, file_release, file });
+        out->total += file->size;
+    }
+    return true;
+}
+
+// ---- connections ----
+
+// Leaves the epoll set first: a child that system() forked may still hold
+// the socket, and close() alone would leave it registered.
+static void conn_close(HttpWorker* w, HttpConn* conn) {
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    http_out_reset(&conn->out);
+    free(conn->out.segments);
+    free(conn->out.data);
+    free(conn);
+}
+
+static void conn_error(HttpConn* conn, int status) {
+    const char* reason = reason_phrase(status);
+    http_out_status(&conn->out, status);
+    http_out_end(&conn->out, NULL, status, strlen(reason));
+    http_out_append(&conn->out, reason, strlen(reason));
+    conn->closing = true;
+}
+
+// A client that sends requests without reading the answers stops being
+// read from while this much is queued for it.
+static bool conn_backlogged(const HttpConn* conn) {
+    return conn->out.total - conn->out_sent >= HTTP_OUT_HIGH;
+}
+
+// Registers for what the connection waits on: more requests unless it is
+// backlogged or ending, and room to send while anything is pending.
+static void conn_watch(HttpWorker* w, HttpConn* conn) {
+    bool reading = !conn_backlogged(conn) && !conn->eof && !conn->closing;
+    uint32_t events = (reading ? EPOLLIN : 0) | (conn->out_sent < conn->out.total ? EPOLLOUT : 0);
+    if (events != conn->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = conn };
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = events;
+    }
+}
+
+static void conn_process(HttpWorker* w, HttpConn* conn);
+
+// Sends what is pending, then answers requests held back meanwhile. False
+// once the connection is gone.
+static bool conn_flush(HttpWorker* w, HttpConn* conn) {
+    for (;;) {
+        while (conn->out_sent < conn->out.total) {
+            struct iovec iov[HTTP_IOV];
+            const HttpSegment* file;
+            size_t file_skip;
+            int count = out_iov(&conn->out, conn->out_sent, iov, HTTP_IOV, &file, &file_skip);
+            ssize_t n;
+            if (count > 0) {
+                // With a file next, the head waits to share a packet with it.
+                struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+                n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | (file != NULL ? MSG_MORE : 0));
+            } else {
+                off_t offset = (off_t)(file->offset + file_skip);
+                n = sendfile(conn->fd, file->file, &offset, file->length - file_skip);
+            }
+            if (n > 0) {
+                conn->out_sent += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                conn_watch(w, conn);
+                return true;
+            }
+            conn_close(w, conn);
+            return false;
+        }
+        http_out_reset(&conn->out);
+        conn->out_sent = 0;
+        if (conn->held && !conn->closing) {
+            conn->held = false;
+            conn_process(w, conn);
+            if (conn->out.total > 0) continue;
+        }
+        if (conn->closing || conn->eof) {
+            conn_close(w, conn);
+            return false;
+        }
+        break;
+    }
+    conn_watch(w, conn);
+    return true;
+}
+
+// Answers every complete request received so far, in order, until the
+// responses queued reach the high-water mark.
+static void conn_process(HttpWorker* w, HttpConn* conn) {
+    size_t pos = 0;
+    HttpRequest req;
+    while (!conn->closing && pos < conn->in_len) {
+        if (conn_backlogged(conn)) {
+            conn->held = true;
+            break;
+        }
+        int64_t used = http_parse(&conn->parser, conn->in + pos, conn->in_len - pos, &req);
+        if (used == 0) break;
+        if (used < 0) {
+            conn_error(conn, (int)-used);
+            break;
+        }
+        w->handler(w->state, &req, &conn->out);
+        if (!req.keep_alive) conn->closing = true;
+        pos += used;
+    }
+    if (pos > 0) {
+        memmove(conn->in, conn->in + pos, conn->in_len - pos);
+        conn->in_len -= pos;
+    }
+    // What is left is one request that has not fully arrived; past this
+    // size it never will within the limits.
+    if (!conn->closing && !conn->held && conn->in_len >= HTTP_MAX_IN) conn_error(conn, 413);
+}
+
+// Reads until the socket is drained or the buffer holds as much as one
+// request may span, then answers what arrived.
+static void conn_readable(HttpWorker* w, HttpConn* conn) {
+    bool eof = false;
+    while (!conn_backlogged(conn) && conn->in_len < HTTP_MAX_IN) {
+        if (conn->in_cap - conn->in_len < HTTP_READ_MIN) {
+            conn->in_cap = conn->in_cap < HTTP_READ_MIN ? HTTP_READ_MIN * 2 : conn->in_cap * 2;
+            conn->in = realloc(conn->in, conn->in_cap);
+        }
+        size_t space = conn->in_cap - conn->in_len;
+        if (space > HTTP_MAX_IN - conn->in_len) space = HTTP_MAX_IN - conn->in_len;
+        ssize_t n = recv(conn->fd, conn->in + conn->in_len, space, 0);
+        if (n > 0) {
+            conn->in_len += n;
+            if ((size_t)n < space) break; // drained, most likely
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        eof = true; // closed by the peer, or failed
+        break;
+    }
+    if (eof) conn->eof = true;
+    if (!conn->closing) conn_process(w, conn);
+    conn_flush(w, conn);
+}
+
+static void accept_all(HttpWorker* w) {
+    for (;;) {
+        int fd = accept(w->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return; // EAGAIN: drained, or another worker took it
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        HttpConn* conn = calloc(1, sizeof(HttpConn));
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) conn_close(w, conn);
+    }
+}
+
+static void worker_run(HttpWorker* w) {
+    w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    // Exclusive: when workers share the socket, a new connection wakes one
+    // of them, not all.
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->listen_fd, &ev);
+    struct epoll_event events[HTTP_EVENTS];
+    for (;;) {
+        int n = epoll_wait(w->epoll_fd, events, HTTP_EVENTS, -1);
+        for (int i = 0; i < n; i++) {
+            HttpConn* conn = events[i].data.ptr;
+            if (conn == NULL) {
+                accept_all(w);
+            } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                conn_readable(w, conn);
+            } else if (events[i].events & EPOLLOUT) {
+                conn_flush(w, conn);
+            }
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    HttpSpawn* spawn = arg;
+    HttpWorker w = { .listen_fd = spawn->listen_fd, .handler = spawn->handler, .state = spawn->init(spawn->arg) };
+    free(spawn);
+    worker_run(&w);
+    return NULL;
+}
+
+int http_listen(int port, const HttpListen* options) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -errno;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if ((options->reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) ||
+        (options->nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) ||
+        (options->defer_accept > 0 &&
+         setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options->defer_accept, sizeof(options->defer_accept)) < 0) ||
+        (options->fastopen > 0 &&
+         setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &options->fastopen, sizeof(options->fastopen)) < 0) ||
+        bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(fd, options->backlog > 0 ? options->backlog : SOMAXCONN) < 0) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    return fd;
+}
+
+int http_serve(int port, int workers, const HttpListen* options, HttpHandler handler, void* self, HttpWorkerInit init,
+               void* arg, HttpReady ready) {
+    // sendfile has no MSG_NOSIGNAL; a peer that goes away mid-file has to
+    // end its connection, not the process.
+    signal(SIGPIPE, SIG_IGN);
+    // Accepted connections inherit TCP_NODELAY from the listener.
+    HttpListen listen = *options;
+    listen.nodelay = true;
+    // Every listener is opened before any worker starts, so that a port
+    // already taken fails the call rather than a worker.
+    int count = listen.reuseport ? workers : 1;
+    int* fds = malloc(sizeof(int) * count);
+    for (int i = 0; i < count; i++) {
+        fds[i] = http_listen(port, &listen);
+        if (fds[i] < 0) {
+            int err = -fds[i];
+            while (i-- > 0) close(fds[i]);
+            free(fds);
+            return err;
+        }
+    }
+    if (ready != NULL) ready(self);
+    for (int i = 1; i < workers; i++) {
+        HttpSpawn* spawn = malloc(sizeof(HttpSpawn));
+        *spawn = (HttpSpawn){ fds[i % count], handler, init, arg };
+        pthread_t thread;
+        pthread_create(&thread, NULL, worker_main, spawn);
+        pthread_detach(thread);
+    }
+    HttpWorker w = { .listen_fd = fds[0], .handler = handler, .state = self };
+    free(fds);
+    worker_run(&w);
+    return 0;
+}
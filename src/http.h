@@ -0,0 +1,159 @@
+#ifndef OPO_HTTP_H
+#define OPO_HTTP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// HTTP/1.1 server engine behind httpServe(). Worker threads each run an epoll
+// loop over their own connections, sharing one listening socket. Requests
+// are parsed as their bytes arrive, pipelined requests are answered in order
+// with one write, and connections are kept alive unless the client says
+// otherwise. Only the handler, called once per request on the worker's
+// thread, is left to the embedder.
+
+#define HTTP_MAX_HEADERS 64
+
+typedef struct {
+    const char* chars;
+    size_t length;
+} HttpSlice;
+
+// Slices point into the buffer the request was parsed from and are valid
+// only while it is. A chunked body has been decoded in place.
+typedef struct {
+    HttpSlice method;
+    HttpSlice path;
+    HttpSlice headers; // the raw header lines, for http_parse_headers
+    HttpSlice header_names[HTTP_MAX_HEADERS];
+    HttpSlice header_values[HTTP_MAX_HEADERS];
+    int header_count;
+    HttpSlice body;
+    bool keep_alive;
+    bool http10;       // HTTP/1.0, where keep-alive has to be said
+} HttpRequest;
+
+// Where parsing of a request that has not fully arrived stopped. Zeroed
+// before the first call and again after each complete request.
+typedef struct {
+    size_t scanned;   // bytes searched for the end of the head
+    size_t head_len;  // set once the head is complete
+    size_t read;      // chunked: bytes of framing and data consumed
+    size_t body_len;  // chunked: bytes decoded so far
+    uint64_t chunk_left;
+    int chunk_state;
+} HttpParser;
+
+// Parses the request at the start of data, resuming from p. Returns the
+// number of bytes it spans once it is complete, 0 while more are needed, or
+// a negative HTTP status to answer with before closing. Chunked bodies are
+// decoded in place, so data has to be writable.
+int64_t http_parse(HttpParser* p, char* data, size_t length, HttpRequest* req);
+
+// Decodes as much of a chunked body as has arrived, from data + p->read,
+// moving the data of each chunk down to follow the previous one from
+// data + p->head_len. Returns the length of the message once the last
+// chunk and trailer are in, 0 while more are needed, or -status.
+int64_t http_parse_chunks(HttpParser* p, char* data, size_t length);
+
+// Whether s is the lowercase token `lower`, ignoring case.
+bool http_slice_is(HttpSlice s, const char* lower);
+
+// Splits header lines as found in HttpRequest.headers. Returns how many
+// were stored, at most max, or -1 when a line is malformed.
+int http_parse_headers(const char* chars, size_t length, HttpSlice* names, HttpSlice* values, int max);
+
+// A response queue is written with one writev. Most bytes are copied into
+// data, but large bodies can be queued in place through http_out_attach,
+// and files through http_out_file; segments then record what to send in
+// order.
+typedef struct {
+    const char* chars; // NULL for a range of data, which may still move
+    size_t offset;     // where that range starts in data, or in file
+    size_t length;
+    int file;          // a file to sendfile from, or -1
+    void (*release)(void* ref);
+    void* ref;
+} HttpSegment;
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    HttpSegment* segments;
+    int segment_count;
+    int segment_capacity;
+    size_t sealed; // bytes of data already covered by segments
+    size_t total;  // bytes queued, data and attached
+} HttpOut;
+
+void http_out_append(HttpOut* out, const char* chars, size_t length);
+// Queues bytes the caller owns without copying them. release(ref) is called
+// once they have been sent or dropped.
+void http_out_attach(HttpOut* out, const char* chars, size_t length, void (*release)(void* ref), void* ref);
+// Drops everything queued.
+void http_out_reset(HttpOut* out);
+
+// Writes "HTTP/1.1 <status> <reason>\r\n" to line, which has room for
+// HTTP_LINE_MAX bytes, and returns its length.
+#define HTTP_LINE_MAX 64
+size_t http_status_line(char* line, int status);
+// Writes "Content-Length: <length>\r\n\r\n" likewise.
+size_t http_length_line(char* line, size_t length);
+
+// A response is its status line, any headers, then http_out_end, which adds
+// Content-Length, Connection when the connection will end or is an
+// HTTP/1.0 one kept alive, and the blank line. The body follows, appended or
+// attached, only when it returns true: HEAD requests and 1xx, 204 and 304
+// responses end with the head.
+void http_out_status(HttpOut* out, int status);
+void http_out_header(HttpOut* out, const char* name, size_t name_len, const char* value, size_t value_len);
+bool http_out_end(HttpOut* out, const HttpRequest* req, int status, size_t body_len);
+
+// Open files, each with its header lines made once, for one worker. An
+// entry is checked against the file's inode, size and mtime at most once
+// a second, and reopened when they changed.
+typedef struct HttpFiles HttpFiles;
+
+HttpFiles* http_files_new(void);
+void http_files_free(HttpFiles* files);
+
+// Queues a response to req with the file at path as its body, sent with
+// sendfile: 200, or 304 when If-None-Match has the file's ETag, with
+// Content-Type, ETag and Last-Modified, then the caller's header lines.
+// A HEAD request gets the head alone. Returns false, having queued
+// nothing, when path is not a regular file that can be read.
+bool http_out_file(HttpOut* out, HttpFiles* files, const HttpRequest* req, const char* path, size_t path_len,
+                   const char* headers, size_t headers_len);
+
+// Appends the response to req to out.
+typedef void (*HttpHandler)(void* worker, const HttpRequest* req, HttpOut* out);
+// Makes the per-thread state passed to the handler on an extra worker.
+typedef void* (*HttpWorkerInit)(void* arg);
+
+// How a listening socket is set up; zero is the default for each.
+typedef struct {
+    int backlog;      // listen() queue, SOMAXCONN when 0
+    bool reuseport;   // SO_REUSEPORT: sockets on the same port share its connections
+    bool nodelay;     // TCP_NODELAY, which accepted connections inherit
+    int defer_accept; // TCP_DEFER_ACCEPT: seconds a connection may wait for data before accept sees it
+    int fastopen;     // TCP_FASTOPEN: pending fast-open requests allowed
+} HttpListen;
+
+// Opens a nonblocking, close-on-exec TCP socket listening on port. Returns
+// it, or -errno.
+int http_listen(int port, const HttpListen* options);
+
+// Called with the calling thread's worker state once every listening
+// socket is open, before any connection is taken.
+typedef void (*HttpReady)(void* self);
+
+// Serves port until the process ends, on `workers` threads: the calling
+// thread, with worker state `self`, and workers - 1 new ones. The workers
+// share one listening socket, or with options->reuseport each has its own
+// and the kernel spreads new connections over them. Returns an errno value
+// when the port cannot be listened on. ready may be NULL.
+int http_serve(int port, int workers, const HttpListen* options, HttpHandler handler, void* self, HttpWorkerInit init,
+               void* arg, HttpReady ready);
+
+#endif
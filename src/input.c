@@ -0,0 +1,141 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "input.h"
+
+#define INPUT_BLOCK (64 * 1024)
+
+static InputReader stdin_reader = { .fd = STDIN_FILENO };
+static pthread_mutex_t stdin_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+InputReader* input_stdin(void) { return &stdin_reader; }
+void input_lock(void) { pthread_mutex_lock(&stdin_mutex); }
+void input_unlock(void) { pthread_mutex_unlock(&stdin_mutex); }
+
+void input_init(InputReader* r, int fd) {
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+}
+
+void input_free(InputReader* r) {
+    if (r->mapped) munmap(r->data, r->length);
+    else free(r->data);
+    r->data = NULL;
+    r->length = r->pos = r->capacity = 0;
+}
+
+// Maps a regular file from the current offset on, so its bytes are handed
+// out without ever being copied into the buffer.
+static void input_start(InputReader* r) {
+    r->started = true;
+    struct stat st;
+    if (fstat(r->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) return;
+    off_t offset = lseek(r->fd, 0, SEEK_CUR);
+    if (offset < 0 || offset >= st.st_size) return;
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+    if (map == MAP_FAILED) return;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    r->data = map;
+    r->length = st.st_size;
+    r->pos = offset;
+    r->mapped = true;
+    r->eof = true;
+}
+
+// Reads another block after the bytes already held, first dropping the ones
+// handed out. Positions relative to r->pos survive; absolute ones do not.
+static bool input_fill(InputReader* r) {
+    if (r->eof) return false;
+    if (r->pos > 0) {
+        memmove(r->data, r->data + r->pos, r->length - r->pos);
+        r->length -= r->pos;
+        r->pos = 0;
+    }
+    if (r->capacity - r->length < INPUT_BLOCK) {
+        r->capacity = r->capacity < INPUT_BLOCK ? INPUT_BLOCK * 2 : r->capacity * 2;
+        r->data = realloc(r->data, r->capacity);
+    }
+    ssize_t n;
+    do {
+        n = read(r->fd, r->data + r->length, r->capacity - r->length);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        if (n < 0) r->error = errno;
+        r->eof = true;
+        return false;
+    }
+    r->length += n;
+    return true;
+}
+
+bool input_is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+bool input_line(InputReader* r, InputSpan* out) {
+    if (!r->started) input_start(r);
+    size_t scanned = 0;
+    for (;;) {
+        const char* start = r->data + r->pos;
+        size_t avail = r->length - r->pos - scanned;
+        const char* nl = avail > 0 ? memchr(start + scanned, '\n', avail) : NULL;
+        if (nl != NULL) {
+            out->chars = start;
+            out->length = nl - start;
+            r->pos += out->length + 1;
+            return true;
+        }
+        scanned = r->length - r->pos;
+        if (!input_fill(r)) break;
+    }
+    if (r->pos == r->length) return false;
+    *out = input_rest(r);
+    return true;
+}
+
+bool input_token(InputReader* r, InputSpan* out) {
+    if (!r->started) input_start(r);
+    for (;;) {
+        while (r->pos < r->length && input_is_space(r->data[r->pos])) r->pos++;
+        if (r->pos < r->length) break;
+        if (!input_fill(r)) return false;
+    }
+    size_t scanned = 0;
+    for (;;) {
+        const char* start = r->data + r->pos;
+        size_t avail = r->length - r->pos;
+        while (scanned < avail && !input_is_space(start[scanned])) scanned++;
+        if (scanned < avail || !input_fill(r)) {
+            out->chars = r->data + r->pos;
+            out->length = scanned;
+            r->pos += scanned;
+            return true;
+        }
+    }
+}
+
+InputSpan input_chunk(InputReader* r, size_t max) {
+    if (!r->started) input_start(r);
+    while (r->length - r->pos < max && input_fill(r)) {}
+    size_t held = r->length - r->pos;
+    InputSpan chunk = { r->data + r->pos, held < max ? held : max };
+    r->pos += chunk.length;
+    return chunk;
+}
+
+InputSpan input_rest(InputReader* r) {
+    if (!r->started) input_start(r);
+    while (input_fill(r)) {}
+    InputSpan rest = { r->data + r->pos, r->length - r->pos };
+    r->pos = r->length;
+    return rest;
+}
+
+bool input_at_end(InputReader* r) {
+    if (!r->started) input_start(r);
+    return r->pos == r->length && !input_fill(r);
+}
@@ -0,0 +1,56 @@
+#ifndef OPO_INPUT_H
+#define OPO_INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Buffered readers over file descriptors, behind stdin's readLine() and the
+// bulk scanners and behind fileReader handles. A regular file is mapped
+// whole; anything else is read in large blocks into one reusable buffer.
+// Spans point into the reader and stay valid only until its next call.
+
+typedef struct {
+    const char* chars;
+    size_t length;
+} InputSpan;
+
+typedef struct {
+    int fd;
+    char* data;
+    size_t length; // bytes held, read or not
+    size_t pos;    // first byte not handed out yet
+    size_t capacity;
+    int error;     // errno of a failed read, or 0
+    bool mapped;
+    bool eof;
+    bool started;
+} InputReader;
+
+void input_init(InputReader* r, int fd);
+// Releases the buffer or mapping; the descriptor is left to the caller.
+void input_free(InputReader* r);
+
+// The next line without its '\n'. False at end of input.
+bool input_line(InputReader* r, InputSpan* out);
+
+// The next run of non-whitespace bytes. False when only whitespace is left.
+bool input_token(InputReader* r, InputSpan* out);
+
+// The bytes input_token splits on.
+bool input_is_space(char c);
+
+// Up to max bytes, fewer only at end of input.
+InputSpan input_chunk(InputReader* r, size_t max);
+
+// Everything not read yet, which is then consumed.
+InputSpan input_rest(InputReader* r);
+
+// True when no bytes are left, reading ahead if needed to find out.
+bool input_at_end(InputReader* r);
+
+// The process-wide stdin reader. Callers hold input_lock() while using it.
+InputReader* input_stdin(void);
+void input_lock(void);
+void input_unlock(void);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "compiler.h"
 #include "vm.h"
 
@@ -56,7 +57,7 @@ void run_repl(const char* stdlib_dir) {
         if (chunk != NULL) {
             VM vm;
             char* dummy_argv[] = {"opo"};
-            vm_init(&vm, chunk->code, chunk->strings, chunk->strings_count, 1, dummy_argv);
+            vm_init(&vm, chunk->code, chunk->strings, chunk->string_lengths, chunk->strings_count, 1, dummy_argv);
             vm_run(&vm);
             // We don't free chunk immediately because VM might have references? 
             // No, Opo VM copies code and strings references are handled by retain/release?
@@ -79,10 +80,21 @@ int main(int argc, char* argv[]) {
         snprintf(stdlib_dir, sizeof(stdlib_dir), "%s/lib", exe_path);
     }
 
+    // Output is buffered when it goes to a file or pipe, or with --buffered.
+    // --uring moves goroutine I/O from epoll to io_uring where available.
+    bool buffered = !isatty(STDOUT_FILENO);
+    while (argc > 1 && (strcmp(argv[1], "--buffered") == 0 || strcmp(argv[1], "--uring") == 0)) {
+        if (strcmp(argv[1], "--buffered") == 0) buffered = true;
+        else netpoll_enable_uring();
+        for (int i = 1; i < argc; i++) argv[i] = argv[i + 1];
+        argc--;
+    }
+
     if (argc < 2) {
         run_repl(stdlib_dir);
         return 0;
     }
+    vm_set_buffered_output(buffered);
 
     char* source = read_file(argv[1]);
     
@@ -102,7 +114,7 @@ int main(int argc, char* argv[]) {
     }
 
     VM vm;
-    vm_init(&vm, chunk->code, chunk->strings, chunk->strings_count, argc, argv);
+    vm_init(&vm, chunk->code, chunk->strings, chunk->string_lengths, chunk->strings_count, argc, argv);
     vm_run(&vm);
 
     // In Go-style concurrency, when main returns, the program exits.
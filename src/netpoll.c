@@ -0,0 +1,637 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "netpoll.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define NETPOLL_URING 1
+#endif
+#endif
+
+#define NETPOLL_BATCH 128
+
+static NetpollReady on_ready;
+static pthread_once_t netpoll_once = PTHREAD_ONCE_INIT;
+static bool uring_allowed = false;
+static bool uring_on = false;
+static int epoll_fd = -1;
+
+// The poll() bits for an op's epoll events.
+static short poll_events(uint32_t events) {
+    return (short)(((events & EPOLLIN) ? POLLIN : 0) | ((events & EPOLLOUT) ? POLLOUT : 0));
+}
+
+// ---- epoll ----
+
+// Waiters on one fd, readers and writers apart. The fd has a single
+// registration, armed for what all of them want, and an event wakes every
+// waiter it concerns; those that find nothing to do park again. Guarded by
+// epoll_lock.
+typedef struct {
+    NetpollOp* readers;
+    NetpollOp* writers;
+} EpollWaiters;
+
+static pthread_mutex_t epoll_lock = PTHREAD_MUTEX_INITIALIZER;
+static EpollWaiters* epoll_waiters = NULL;
+static int epoll_capacity = 0;
+
+static EpollWaiters* epoll_entry(int fd) {
+    if (fd >= epoll_capacity) {
+        int capacity = epoll_capacity < 64 ? 64 : epoll_capacity;
+        while (capacity <= fd) capacity *= 2;
+        epoll_waiters = realloc(epoll_waiters, sizeof(EpollWaiters) * capacity);
+        memset(epoll_waiters + epoll_capacity, 0, sizeof(EpollWaiters) * (capacity - epoll_capacity));
+        epoll_capacity = capacity;
+    }
+    return &epoll_waiters[fd];
+}
+
+// Appends op, or a whole list, to the end of list.
+static void waiters_append(NetpollOp** list, NetpollOp* op) {
+    while (*list != NULL) list = &(*list)->next;
+    *list = op;
+}
+
+static void waiters_remove(NetpollOp** list, NetpollOp* op) {
+    while (*list != NULL && *list != op) list = &(*list)->next;
+    if (*list != NULL) *list = op->next;
+}
+
+// Wakes every waiter of list. Lock not held: a woken waiter may submit
+// again at once, so next is read first.
+static void waiters_wake(NetpollOp* list) {
+    while (list != NULL) {
+        NetpollOp* next = list->next;
+        on_ready(list->waiter);
+        list = next;
+    }
+}
+
+// A one-shot registration stays in the set, disarmed, after it fires, so
+// rearming is normally a MOD. Closing the socket drops it from the set, and
+// only a submit may ADD it again: the number may be a new fd by then. Lock
+// held.
+static bool epoll_arm(int fd, EpollWaiters* w, bool may_add) {
+    struct epoll_event ev;
+    ev.events = (w->readers != NULL ? EPOLLIN : 0) | (w->writers != NULL ? EPOLLOUT : 0);
+    if (ev.events == 0) return true;
+    ev.events |= EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0) return true;
+    return may_add && errno == ENOENT && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+static void* epoll_loop(void* arg) {
+    (void)arg;
+    struct epoll_event events[NETPOLL_BATCH];
+    for (;;) {
+        int n = epoll_wait(epoll_fd, events, NETPOLL_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return NULL;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            uint32_t fired = events[i].events;
+            NetpollOp* ready = NULL;
+            pthread_mutex_lock(&epoll_lock);
+            EpollWaiters* w = epoll_entry(fd);
+            if (fired & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                ready = w->readers;
+                w->readers = NULL;
+            }
+            if (fired & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                waiters_append(&ready, w->writers);
+                w->writers = NULL;
+            }
+            epoll_arm(fd, w, false);
+            pthread_mutex_unlock(&epoll_lock);
+            waiters_wake(ready);
+        }
+    }
+}
+
+// Takes every waiter off fd's lists. Lock held.
+static NetpollOp* waiters_take(EpollWaiters* w) {
+    NetpollOp* waiting = w->readers;
+    waiters_append(&waiting, w->writers);
+    w->readers = NULL;
+    w->writers = NULL;
+    return waiting;
+}
+
+static bool epoll_submit(NetpollOp* op) {
+    if (epoll_fd < 0 || op->op != NETPOLL_POLL) return false;
+    NetpollOp* stale = NULL;
+    pthread_mutex_lock(&epoll_lock);
+    EpollWaiters* w = epoll_entry(op->fd);
+    NetpollOp** list = (op->events & EPOLLOUT) ? &w->writers : &w->readers;
+    op->next = NULL;
+    waiters_append(list, op);
+    bool armed = epoll_arm(op->fd, w, false);
+    if (!armed && errno == ENOENT) {
+        // Not in the set: a new fd under a number closed without
+        // netpoll_close. Whoever still waits there waits on the old one.
+        waiters_remove(list, op);
+        stale = waiters_take(w);
+        op->next = NULL;
+        *list = op;
+        armed = epoll_arm(op->fd, w, true);
+    }
+    if (!armed) waiters_remove(list, op);
+    pthread_mutex_unlock(&epoll_lock);
+    waiters_wake(stale);
+    return armed;
+}
+
+// Closes fd with the lock held, so that nothing arms it in between, and
+// returns its waiters for the caller to wake.
+static NetpollOp* epoll_close(int fd) {
+    if (epoll_fd < 0) {
+        close(fd);
+        return NULL;
+    }
+    pthread_mutex_lock(&epoll_lock);
+    NetpollOp* waiting = fd < epoll_capacity ? waiters_take(&epoll_waiters[fd]) : NULL;
+    close(fd);
+    pthread_mutex_unlock(&epoll_lock);
+    return waiting;
+}
+
+// ---- io_uring ----
+
+#ifdef NETPOLL_URING
+
+#define RING_ENTRIES 4096
+#define ACCEPTOR_TAG 1 // low bit of user_data: an Acceptor, not a NetpollOp
+
+typedef struct {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned unsubmitted;
+    pthread_mutex_t lock; // guards the submission queue and the acceptors
+} Ring;
+
+// Multishot accept state for one listening socket. Connections the kernel
+// accepts while no goroutine waits in tcpAccept queue up here.
+typedef struct Acceptor {
+    int fd;
+    bool armed;
+    bool closing;
+    NetpollOp* waiting; // tcpAccept calls parked on it, oldest first
+    int* queue;
+    int head;
+    int count;
+    int capacity;
+    struct Acceptor* next;
+} Acceptor;
+
+static Ring ring = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static Acceptor* acceptors = NULL;
+static bool multishot_accept = true;
+
+static int uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static bool uring_probe(void) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    bool ok = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    int needed[] = { IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_ACCEPT, IORING_OP_RECV,
+                     IORING_OP_SEND, IORING_OP_READ, IORING_OP_WRITE };
+    for (size_t i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+// The next free submission entry, cleared, or NULL when the queue is full.
+// Lock held; ring_commit() publishes it.
+static struct io_uring_sqe* ring_sqe(void) {
+    unsigned tail = *ring.sq_tail;
+    if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.sq_entries) return NULL;
+    unsigned index = tail & ring.sq_mask;
+    struct io_uring_sqe* sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[index] = index;
+    return sqe;
+}
+
+static void ring_commit(void) {
+    __atomic_store_n(ring.sq_tail, *ring.sq_tail + 1, __ATOMIC_RELEASE);
+    ring.unsubmitted++;
+}
+
+// Submits everything queued so far in one call. Lock held.
+static void ring_flush(void) {
+    while (ring.unsubmitted > 0) {
+        int n = uring_enter(ring.unsubmitted, 0, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return; // left queued; the next flush retries
+        ring.unsubmitted -= (unsigned)n;
+    }
+}
+
+// Queues op. Lock held.
+static bool ring_push(NetpollOp* op) {
+    struct io_uring_sqe* sqe = ring_sqe();
+    if (sqe == NULL) return false;
+    sqe->fd = op->fd;
+    sqe->addr = (uint64_t)(uintptr_t)op->buf;
+    sqe->len = (uint32_t)(op->len > 0x7ffff000 ? 0x7ffff000 : op->len);
+    switch (op->op) {
+        case NETPOLL_POLL:
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->addr = 0;
+            sqe->len = 0;
+            sqe->poll32_events = poll_events(op->events);
+            break;
+        case NETPOLL_RECV: sqe->opcode = IORING_OP_RECV; break;
+        case NETPOLL_SEND: sqe->opcode = IORING_OP_SEND; break;
+        case NETPOLL_READ: sqe->opcode = IORING_OP_READ; sqe->off = (uint64_t)op->offset; break;
+        case NETPOLL_WRITE: sqe->opcode = IORING_OP_WRITE; sqe->off = (uint64_t)op->offset; break;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    ring_commit();
+    return true;
+}
+
+static bool uring_init(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring.fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (ring.fd < 0) return false;
+    // Without NODROP a burst of completions could be lost.
+    if (!(p.features & IORING_FEAT_NODROP) || !uring_probe()) {
+        close(ring.fd);
+        return false;
+    }
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && cq_size > sq_size) sq_size = cq_size;
+    char* sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    char* cq = single ? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    void* sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(ring.fd);
+        return false;
+    }
+    ring.sq_head = (unsigned*)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring.sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    ring.sq_entries = p.sq_entries;
+    ring.sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring.sqes = sqes;
+    ring.cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring.cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+static bool acceptor_arm(Acceptor* acceptor) {
+    struct io_uring_sqe* sqe = ring_sqe();
+    if (sqe == NULL) return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = acceptor->fd;
+    sqe->accept_flags = SOCK_NONBLOCK;
+#ifdef IORING_ACCEPT_MULTISHOT
+    if (multishot_accept) sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+#endif
+    sqe->user_data = (uint64_t)(uintptr_t)acceptor | ACCEPTOR_TAG;
+    ring_commit();
+    acceptor->armed = true;
+    return true;
+}
+
+static void acceptor_free(Acceptor* acceptor) {
+    for (int i = 0; i < acceptor->count; i++) {
+        close(acceptor->queue[(acceptor->head + i) % acceptor->capacity]);
+    }
+    free(acceptor->queue);
+    free(acceptor);
+}
+
+static void acceptor_push(Acceptor* acceptor, int fd) {
+    if (acceptor->count == acceptor->capacity) {
+        int capacity = acceptor->capacity < 8 ? 8 : acceptor->capacity * 2;
+        int* queue = malloc(sizeof(int) * capacity);
+        for (int i = 0; i < acceptor->count; i++) {
+            queue[i] = acceptor->queue[(acceptor->head + i) % acceptor->capacity];
+        }
+        free(acceptor->queue);
+        acceptor->queue = queue;
+        acceptor->head = 0;
+        acceptor->capacity = capacity;
+    }
+    acceptor->queue[(acceptor->head + acceptor->count) % acceptor->capacity] = fd;
+    acceptor->count++;
+}
+
+static int acceptor_pop(Acceptor* acceptor) {
+    if (acceptor->count == 0) return -1;
+    int fd = acceptor->queue[acceptor->head];
+    acceptor->head = (acceptor->head + 1) % acceptor->capacity;
+    acceptor->count--;
+    return fd;
+}
+
+static Acceptor* acceptor_find(int fd) {
+    for (Acceptor* acceptor = acceptors; acceptor != NULL; acceptor = acceptor->next) {
+        if (acceptor->fd == fd) return acceptor;
+    }
+    return NULL;
+}
+
+// Lock held. Returns the op whose waiter is now ready, if any.
+static NetpollOp* acceptor_complete(Acceptor* acceptor, int res, unsigned flags) {
+    NetpollOp* done = NULL;
+    bool more = false;
+#ifdef IORING_CQE_F_MORE
+    more = flags & IORING_CQE_F_MORE;
+#else
+    (void)flags;
+#endif
+    if (res >= 0) {
+        if (acceptor->closing) close(res);
+        else if (acceptor->waiting != NULL) done = acceptor->waiting;
+        else acceptor_push(acceptor, res);
+    } else if (res == -EINVAL && multishot_accept && !more && !acceptor->closing) {
+        multishot_accept = false; // older kernel: rearm one accept at a time
+    } else if (res == -ECANCELED && !acceptor->closing) {
+        // The thread that armed it exited; rearmed below if still wanted.
+    } else if (acceptor->waiting != NULL) {
+        done = acceptor->waiting;
+    }
+    if (done != NULL) {
+        done->result = res;
+        acceptor->waiting = done->next;
+    }
+    if (!more) {
+        acceptor->armed = false;
+        if (acceptor->closing) acceptor_free(acceptor);
+        else if (acceptor->waiting != NULL) acceptor_arm(acceptor);
+    }
+    return done;
+}
+
+// The poller only reaps: threads submit their own operations, so a parked
+// goroutine costs one io_uring_enter, and whatever other threads queued
+// meanwhile goes to the kernel with it. The kernel cancels a request when
+// the thread that submitted it exits, as idle pool threads do; the poller
+// submits such requests again itself, and it lives as long as the process.
+static void* uring_loop(void* arg) {
+    (void)arg;
+    void* ready[NETPOLL_BATCH];
+    for (;;) {
+        if (uring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EBUSY) return NULL;
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        int count = 0;
+        bool requeued = false;
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &ring.cqes[head & ring.cq_mask];
+            head++;
+            NetpollOp* done = NULL;
+            if (cqe->user_data & ACCEPTOR_TAG) {
+                pthread_mutex_lock(&ring.lock);
+                done = acceptor_complete((Acceptor*)(uintptr_t)(cqe->user_data & ~(uint64_t)ACCEPTOR_TAG), cqe->res, cqe->flags);
+                requeued = requeued || ring.unsubmitted > 0;
+                pthread_mutex_unlock(&ring.lock);
+            } else if (cqe->user_data != 0) {
+                done = (NetpollOp*)(uintptr_t)cqe->user_data;
+                done->result = cqe->res;
+                if (cqe->res == -ECANCELED) {
+                    pthread_mutex_lock(&ring.lock);
+                    if (ring_push(done)) {
+                        done = NULL;
+                        requeued = true;
+                    }
+                    pthread_mutex_unlock(&ring.lock);
+                }
+            }
+            if (done != NULL) ready[count++] = done->waiter;
+            if (count == NETPOLL_BATCH || head == tail) {
+                __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+                if (requeued) {
+                    pthread_mutex_lock(&ring.lock);
+                    ring_flush();
+                    pthread_mutex_unlock(&ring.lock);
+                    requeued = false;
+                }
+                for (int i = 0; i < count; i++) on_ready(ready[i]);
+                count = 0;
+                tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+            }
+        }
+    }
+}
+
+static bool uring_accept(NetpollOp* op) {
+    Acceptor* acceptor = acceptor_find(op->fd);
+    if (acceptor == NULL) {
+        acceptor = calloc(1, sizeof(Acceptor));
+        acceptor->fd = op->fd;
+        acceptor->next = acceptors;
+        acceptors = acceptor;
+    }
+    int fd = acceptor_pop(acceptor);
+    if (fd >= 0) {
+        op->result = fd;
+        pthread_mutex_unlock(&ring.lock);
+        on_ready(op->waiter);
+        return true;
+    }
+    op->next = NULL;
+    waiters_append(&acceptor->waiting, op);
+    if (!acceptor->armed && !acceptor_arm(acceptor)) {
+        waiters_remove(&acceptor->waiting, op);
+        pthread_mutex_unlock(&ring.lock);
+        return false;
+    }
+    ring_flush();
+    pthread_mutex_unlock(&ring.lock);
+    return true;
+}
+
+static bool uring_submit(NetpollOp* op) {
+    pthread_mutex_lock(&ring.lock);
+    if (op->op == NETPOLL_ACCEPT) return uring_accept(op);
+    bool queued = ring_push(op);
+    if (queued) ring_flush();
+    pthread_mutex_unlock(&ring.lock);
+    return queued;
+}
+
+static bool sync_cancel(uint64_t key) {
+#ifdef IORING_ASYNC_CANCEL_FD
+    struct io_uring_sync_cancel_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = key;
+    reg.timeout.tv_sec = -1;
+    reg.timeout.tv_nsec = -1;
+    return syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_SYNC_CANCEL, &reg, 1) == 0;
+#else
+    (void)key;
+    return false;
+#endif
+}
+
+// Drops fd's acceptor, if it has one, and returns the accepts still waiting
+// on it, failed with -ECANCELED.
+static NetpollOp* uring_forget(int fd) {
+    pthread_mutex_lock(&ring.lock);
+    Acceptor** link = &acceptors;
+    while (*link != NULL && (*link)->fd != fd) link = &(*link)->next;
+    Acceptor* acceptor = *link;
+    if (acceptor == NULL) {
+        pthread_mutex_unlock(&ring.lock);
+        return NULL;
+    }
+    *link = acceptor->next;
+    NetpollOp* waiting = acceptor->waiting;
+    acceptor->waiting = NULL;
+    uint64_t key = (uint64_t)(uintptr_t)acceptor | ACCEPTOR_TAG;
+    bool armed = acceptor->armed;
+    if (armed) {
+        acceptor->closing = true;
+        for (int queued; (queued = acceptor_pop(acceptor)) >= 0;) close(queued);
+    } else {
+        acceptor_free(acceptor);
+    }
+    pthread_mutex_unlock(&ring.lock);
+    // Cancelled before tcpClose returns where the kernel can (6.0+), so the
+    // port is free again at once. Otherwise, or if the accept has not been
+    // submitted yet, the poller cancels it.
+    if (armed && !sync_cancel(key)) {
+        pthread_mutex_lock(&ring.lock);
+        struct io_uring_sqe* sqe = ring_sqe();
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = key;
+            ring_commit();
+            ring_flush();
+        }
+        pthread_mutex_unlock(&ring.lock);
+    }
+    for (NetpollOp* op = waiting; op != NULL; op = op->next) op->result = -ECANCELED;
+    return waiting;
+}
+
+#endif
+
+// ---- common ----
+
+static void netpoll_init(void) {
+    pthread_t thread;
+#ifdef NETPOLL_URING
+    if (uring_allowed && uring_init()) {
+        uring_on = true;
+        pthread_create(&thread, NULL, uring_loop, NULL);
+        pthread_detach(thread);
+        return;
+    }
+#endif
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) return;
+    pthread_create(&thread, NULL, epoll_loop, NULL);
+    pthread_detach(thread);
+}
+
+void netpoll_start(NetpollReady ready) {
+    on_ready = ready;
+    pthread_once(&netpoll_once, netpoll_init);
+}
+
+void netpoll_enable_uring(void) {
+    uring_allowed = true;
+}
+
+bool netpoll_uring(void) {
+    pthread_once(&netpoll_once, netpoll_init);
+    return uring_on;
+}
+
+bool netpoll_submit(NetpollOp* op, void* waiter) {
+    op->waiter = waiter;
+#ifdef NETPOLL_URING
+    if (uring_on) return uring_submit(op);
+#endif
+    return epoll_submit(op);
+}
+
+void netpoll_run(NetpollOp* op) {
+    for (;;) {
+        ssize_t n = 0;
+        switch (op->op) {
+            case NETPOLL_POLL: n = 0; break;
+            case NETPOLL_ACCEPT:
+                n = accept(op->fd, NULL, NULL);
+                if (n >= 0) fcntl((int)n, F_SETFL, fcntl((int)n, F_GETFL) | O_NONBLOCK);
+                break;
+            case NETPOLL_RECV: n = recv(op->fd, op->buf, op->len, 0); break;
+            case NETPOLL_SEND: n = send(op->fd, op->buf, op->len, 0); break;
+            case NETPOLL_READ: n = pread(op->fd, op->buf, op->len, op->offset); break;
+            case NETPOLL_WRITE: n = pwrite(op->fd, op->buf, op->len, op->offset); break;
+        }
+        if (op->op != NETPOLL_POLL && n < 0 && errno == EINTR) continue;
+        if (op->op == NETPOLL_POLL || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+            struct pollfd p = { op->fd, poll_events(op->events), 0 };
+            poll(&p, 1, -1);
+            if (op->op == NETPOLL_POLL) return;
+            continue;
+        }
+        op->result = n < 0 ? -errno : n;
+        return;
+    }
+}
+
+int netpoll_accepted(int listen_fd) {
+    int fd = -1;
+#ifdef NETPOLL_URING
+    if (!uring_on) return -1;
+    pthread_mutex_lock(&ring.lock);
+    Acceptor* acceptor = acceptor_find(listen_fd);
+    if (acceptor != NULL) fd = acceptor_pop(acceptor);
+    pthread_mutex_unlock(&ring.lock);
+#else
+    (void)listen_fd;
+#endif
+    return fd;
+}
+
+// A multishot accept keeps the socket open in the kernel, so it is cancelled
+// first; the acceptor goes once the kernel confirms. Waiters are woken only
+// once fd is closed.
+void netpoll_close(int fd) {
+    NetpollOp* waiting = NULL;
+#ifdef NETPOLL_URING
+    if (uring_on) waiting = uring_forget(fd);
+#endif
+    waiters_append(&waiting, epoll_close(fd));
+    waiters_wake(waiting);
+}
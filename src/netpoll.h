@@ -0,0 +1,68 @@
+#ifndef OPO_NETPOLL_H
+#define OPO_NETPOLL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One background thread waits for the I/O goroutines are parked on, and hands
+// each waiter back through the ready callback once it can make progress.
+//
+// The backend is epoll, or io_uring when enabled and the kernel allows it.
+// With epoll only NETPOLL_POLL is available: the waiter learns its fd is
+// ready and retries the syscall itself. With io_uring the kernel performs the
+// operation and the waiter finds its outcome in op->result. Submissions made
+// while others are pending go to the kernel together, and accepts on a
+// listening socket stay armed (multishot) between calls.
+
+typedef void (*NetpollReady)(void* waiter);
+
+enum {
+    NETPOLL_POLL,   // wait for events on fd
+    NETPOLL_ACCEPT, // accept on the listening socket fd
+    NETPOLL_RECV,   // recv up to len bytes into buf
+    NETPOLL_SEND,   // send len bytes from buf
+    NETPOLL_READ,   // pread len bytes into buf at offset
+    NETPOLL_WRITE   // pwrite len bytes from buf at offset
+};
+
+typedef struct NetpollOp {
+    int op;
+    int fd;
+    uint32_t events; // NETPOLL_POLL: EPOLLIN or EPOLLOUT
+    void* buf;
+    uint64_t len;
+    int64_t offset;
+    int64_t result;  // bytes moved, the accepted fd, or -errno
+    void* waiter;
+    struct NetpollOp* next; // the poller's, while op waits
+} NetpollOp;
+
+// Starts the poller on first use; later calls do nothing.
+void netpoll_start(NetpollReady ready);
+
+// Lets the poller use io_uring if the kernel has it. Only has an effect
+// before it starts.
+void netpoll_enable_uring(void);
+
+// Whether operations other than NETPOLL_POLL can be submitted.
+bool netpoll_uring(void);
+
+// Hands op to the poller, which reports waiter once it completes. op has to
+// stay put until then. False when it cannot be submitted, and the caller has
+// to block for it instead. Several waiters may wait on one fd, readers and
+// writers alike.
+bool netpoll_submit(NetpollOp* op, void* waiter);
+
+// Performs op on the calling thread instead, blocking until it is done.
+void netpoll_run(NetpollOp* op);
+
+// A connection multishot accept already took off the listening socket, or -1.
+int netpoll_accepted(int listen_fd);
+
+// Closes fd and drops what the poller holds for it. Waiters still parked
+// on it are woken once it is closed, so that their retry fails with EBADF
+// instead of parking again.
+void netpoll_close(int fd);
+
+#endif
@@ -0,0 +1,437 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "numconv.h"
+
+// ---- integers ----
+
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Writes two digits per division, filling a scratch buffer from the end.
+static int fmt_u64(char* out, uint64_t value) {
+    char tmp[20];
+    int pos = 20;
+    while (value >= 100) {
+        unsigned r = (unsigned)(value % 100);
+        value /= 100;
+        pos -= 2;
+        memcpy(tmp + pos, digit_pairs + r * 2, 2);
+    }
+    if (value >= 10) {
+        pos -= 2;
+        memcpy(tmp + pos, digit_pairs + value * 2, 2);
+    } else {
+        tmp[--pos] = (char)('0' + value);
+    }
+    memcpy(out, tmp + pos, 20 - pos);
+    return 20 - pos;
+}
+
+int fmt_int(char* out, int64_t value) {
+    if (value < 0) {
+        out[0] = '-';
+        return 1 + fmt_u64(out + 1, 0 - (uint64_t)value);
+    }
+    return fmt_u64(out, (uint64_t)value);
+}
+
+// ---- floats: Grisu2 ----
+//
+// Florian Loitsch's Grisu2 scales the value and its rounding boundaries by a
+// cached power of ten so that digit generation runs on 64-bit integers. The
+// digits always read back as the input and are the shortest such digits in
+// all but a tiny fraction of cases.
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+#define DP_SIGNIFICAND_BITS 52
+#define DP_HIDDEN_BIT ((uint64_t)1 << DP_SIGNIFICAND_BITS)
+#define DP_SIGNIFICAND_MASK (DP_HIDDEN_BIT - 1)
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_BITS)
+
+// Normalized significands and binary exponents of 10^k for k = -348, -340,
+// ..., 340, rounded to nearest.
+static const DiyFp cached_powers[] = {
+    {0xfa8fd5a0081c0288ull, -1220}, // 1e-348
+    {0xbaaee17fa23ebf76ull, -1193}, // 1e-340
+    {0x8b16fb203055ac76ull, -1166}, // 1e-332
+    {0xcf42894a5dce35eaull, -1140}, // 1e-324
+    {0x9a6bb0aa55653b2dull, -1113}, // 1e-316
+    {0xe61acf033d1a45dfull, -1087}, // 1e-308
+    {0xab70fe17c79ac6caull, -1060}, // 1e-300
+    {0xff77b1fcbebcdc4full, -1034}, // 1e-292
+    {0xbe5691ef416bd60cull, -1007}, // 1e-284
+    {0x8dd01fad907ffc3cull, -980}, // 1e-276
+    {0xd3515c2831559a83ull, -954}, // 1e-268
+    {0x9d71ac8fada6c9b5ull, -927}, // 1e-260
+    {0xea9c227723ee8bcbull, -901}, // 1e-252
+    {0xaecc49914078536dull, -874}, // 1e-244
+    {0x823c12795db6ce57ull, -847}, // 1e-236
+    {0xc21094364dfb5637ull, -821}, // 1e-228
+    {0x9096ea6f3848984full, -794}, // 1e-220
+    {0xd77485cb25823ac7ull, -768}, // 1e-212
+    {0xa086cfcd97bf97f4ull, -741}, // 1e-204
+    {0xef340a98172aace5ull, -715}, // 1e-196
+    {0xb23867fb2a35b28eull, -688}, // 1e-188
+    {0x84c8d4dfd2c63f3bull, -661}, // 1e-180
+    {0xc5dd44271ad3cdbaull, -635}, // 1e-172
+    {0x936b9fcebb25c996ull, -608}, // 1e-164
+    {0xdbac6c247d62a584ull, -582}, // 1e-156
+    {0xa3ab66580d5fdaf6ull, -555}, // 1e-148
+    {0xf3e2f893dec3f126ull, -529}, // 1e-140
+    {0xb5b5ada8aaff80b8ull, -502}, // 1e-132
+    {0x87625f056c7c4a8bull, -475}, // 1e-124
+    {0xc9bcff6034c13053ull, -449}, // 1e-116
+    {0x964e858c91ba2655ull, -422}, // 1e-108
+    {0xdff9772470297ebdull, -396}, // 1e-100
+    {0xa6dfbd9fb8e5b88full, -369}, // 1e-92
+    {0xf8a95fcf88747d94ull, -343}, // 1e-84
+    {0xb94470938fa89bcfull, -316}, // 1e-76
+    {0x8a08f0f8bf0f156bull, -289}, // 1e-68
+    {0xcdb02555653131b6ull, -263}, // 1e-60
+    {0x993fe2c6d07b7facull, -236}, // 1e-52
+    {0xe45c10c42a2b3b06ull, -210}, // 1e-44
+    {0xaa242499697392d3ull, -183}, // 1e-36
+    {0xfd87b5f28300ca0eull, -157}, // 1e-28
+    {0xbce5086492111aebull, -130}, // 1e-20
+    {0x8cbccc096f5088ccull, -103}, // 1e-12
+    {0xd1b71758e219652cull, -77}, // 1e-4
+    {0x9c40000000000000ull, -50}, // 1e4
+    {0xe8d4a51000000000ull, -24}, // 1e12
+    {0xad78ebc5ac620000ull, 3}, // 1e20
+    {0x813f3978f8940984ull, 30}, // 1e28
+    {0xc097ce7bc90715b3ull, 56}, // 1e36
+    {0x8f7e32ce7bea5c70ull, 83}, // 1e44
+    {0xd5d238a4abe98068ull, 109}, // 1e52
+    {0x9f4f2726179a2245ull, 136}, // 1e60
+    {0xed63a231d4c4fb27ull, 162}, // 1e68
+    {0xb0de65388cc8ada8ull, 189}, // 1e76
+    {0x83c7088e1aab65dbull, 216}, // 1e84
+    {0xc45d1df942711d9aull, 242}, // 1e92
+    {0x924d692ca61be758ull, 269}, // 1e100
+    {0xda01ee641a708deaull, 295}, // 1e108
+    {0xa26da3999aef774aull, 322}, // 1e116
+    {0xf209787bb47d6b85ull, 348}, // 1e124
+    {0xb454e4a179dd1877ull, 375}, // 1e132
+    {0x865b86925b9bc5c2ull, 402}, // 1e140
+    {0xc83553c5c8965d3dull, 428}, // 1e148
+    {0x952ab45cfa97a0b3ull, 455}, // 1e156
+    {0xde469fbd99a05fe3ull, 481}, // 1e164
+    {0xa59bc234db398c25ull, 508}, // 1e172
+    {0xf6c69a72a3989f5cull, 534}, // 1e180
+    {0xb7dcbf5354e9beceull, 561}, // 1e188
+    {0x88fcf317f22241e2ull, 588}, // 1e196
+    {0xcc20ce9bd35c78a5ull, 614}, // 1e204
+    {0x98165af37b2153dfull, 641}, // 1e212
+    {0xe2a0b5dc971f303aull, 667}, // 1e220
+    {0xa8d9d1535ce3b396ull, 694}, // 1e228
+    {0xfb9b7cd9a4a7443cull, 720}, // 1e236
+    {0xbb764c4ca7a44410ull, 747}, // 1e244
+    {0x8bab8eefb6409c1aull, 774}, // 1e252
+    {0xd01fef10a657842cull, 800}, // 1e260
+    {0x9b10a4e5e9913129ull, 827}, // 1e268
+    {0xe7109bfba19c0c9dull, 853}, // 1e276
+    {0xac2820d9623bf429ull, 880}, // 1e284
+    {0x80444b5e7aa7cf85ull, 907}, // 1e292
+    {0xbf21e44003acdd2dull, 933}, // 1e300
+    {0x8e679c2f5e44ff8full, 960}, // 1e308
+    {0xd433179d9c8cb841ull, 986}, // 1e316
+    {0x9e19db92b4e31ba9ull, 1013}, // 1e324
+    {0xeb96bf6ebadf77d9ull, 1039}, // 1e332
+    {0xaf87023b9bf0ee6bull, 1066}, // 1e340
+};
+
+static DiyFp diyfp_from_double(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    int biased_e = (int)((bits >> DP_SIGNIFICAND_BITS) & 0x7FF);
+    uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+    if (biased_e != 0) return (DiyFp){significand + DP_HIDDEN_BIT, biased_e - DP_EXPONENT_BIAS};
+    return (DiyFp){significand, 1 - DP_EXPONENT_BIAS};
+}
+
+static DiyFp diyfp_normalize(DiyFp x) {
+    int shift = __builtin_clzll(x.f);
+    return (DiyFp){x.f << shift, x.e - shift};
+}
+
+// Rounded upper 64 bits of the 128-bit product.
+static DiyFp diyfp_mul(DiyFp a, DiyFp b) {
+    unsigned __int128 p = (unsigned __int128)a.f * b.f;
+    uint64_t h = (uint64_t)(p >> 64);
+    if ((uint64_t)p & ((uint64_t)1 << 63)) h++;
+    return (DiyFp){h, a.e + b.e + 64};
+}
+
+// The midpoints between v and its neighbouring doubles, with a shared exponent.
+static void normalized_boundaries(DiyFp v, DiyFp* minus, DiyFp* plus) {
+    DiyFp pl = diyfp_normalize((DiyFp){(v.f << 1) + 1, v.e - 1});
+    DiyFp mi = v.f == DP_HIDDEN_BIT ? (DiyFp){(v.f << 2) - 1, v.e - 2}
+                                    : (DiyFp){(v.f << 1) - 1, v.e - 1};
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *minus = mi;
+    *plus = pl;
+}
+
+// A cached power c = 10^-k such that c * 2^e lands in [2^-60, 2^-32].
+static DiyFp cached_power(int e, int* k) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0) ik++;
+    int index = (ik >> 3) + 1;
+    *k = -(-348 + index * 8);
+    return cached_powers[index];
+}
+
+// Up to 10^19: the fractional loop scales wp_w by 10^-kappa, and a
+// 17-digit output takes kappa well past -9.
+static const uint64_t pow10_u64[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+    100000000ull, 1000000000ull, 10000000000ull, 100000000000ull,
+    1000000000000ull, 10000000000000ull, 100000000000000ull,
+    1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+    1000000000000000000ull, 10000000000000000000ull
+};
+
+static int count_digits_u32(uint32_t n) {
+    int d = 1;
+    while (d < 10 && n >= pow10_u64[d]) d++;
+    return d;
+}
+
+// Moves the last digit toward w while it stays inside the safe interval.
+static void grisu_round(char* buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static void digit_gen(DiyFp w, DiyFp mp, uint64_t delta, char* buf, int* len, int* k) {
+    DiyFp one = {(uint64_t)1 << -mp.e, mp.e};
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = count_digits_u32(p1);
+    *len = 0;
+    while (kappa > 0) {
+        uint32_t div = (uint32_t)pow10_u64[kappa - 1];
+        uint32_t d = p1 / div;
+        p1 %= div;
+        if (d || *len) buf[(*len)++] = (char)('0' + d);
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            grisu_round(buf, *len, delta, rest, pow10_u64[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || *len) buf[(*len)++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            grisu_round(buf, *len, delta, p2, one.f, -kappa < 20 ? wp_w * pow10_u64[-kappa] : 0);
+            return;
+        }
+    }
+}
+
+// Digits of a positive finite value; the value is digits * 10^k.
+static int grisu2(double value, char* buf, int* k) {
+    DiyFp v = diyfp_from_double(value);
+    DiyFp w_m, w_p;
+    normalized_boundaries(v, &w_m, &w_p);
+    DiyFp c_mk = cached_power(w_p.e, k);
+    DiyFp w = diyfp_mul(diyfp_normalize(v), c_mk);
+    DiyFp wp = diyfp_mul(w_p, c_mk);
+    DiyFp wm = diyfp_mul(w_m, c_mk);
+    wm.f++;
+    wp.f--;
+    int len;
+    digit_gen(w, wp, wp.f - wm.f, buf, &len, k);
+    return len;
+}
+
+static int write_exponent(char* out, int exp) {
+    int n = 0;
+    out[n++] = 'e';
+    out[n++] = exp < 0 ? '-' : '+';
+    if (exp < 0) exp = -exp;
+    if (exp < 10) out[n++] = '0';
+    return n + fmt_u64(out + n, (uint64_t)exp);
+}
+
+// Lays out digits * 10^k in fixed notation when the leading digit's exponent
+// is in [-4, 21), like %g with a wider upper limit, and in exponent form
+// otherwise.
+static int prettify(char* out, const char* digits, int len, int k) {
+    int kk = len + k; // value is in [10^(kk-1), 10^kk)
+    if (k >= 0 && kk <= 21) {
+        memcpy(out, digits, len);
+        memset(out + len, '0', k);
+        return kk;
+    }
+    if (kk > 0 && kk <= 21) {
+        memcpy(out, digits, kk);
+        out[kk] = '.';
+        memcpy(out + kk + 1, digits + kk, len - kk);
+        return len + 1;
+    }
+    if (kk > -4 && kk <= 0) {
+        int zeros = -kk;
+        out[0] = '0';
+        out[1] = '.';
+        memset(out + 2, '0', zeros);
+        memcpy(out + 2 + zeros, digits, len);
+        return 2 + zeros + len;
+    }
+    int n = 0;
+    out[n++] = digits[0];
+    if (len > 1) {
+        out[n++] = '.';
+        memcpy(out + n, digits + 1, len - 1);
+        n += len - 1;
+    }
+    return n + write_exponent(out + n, kk - 1);
+}
+
+int fmt_flt(char* out, double value) {
+    if (isnan(value)) {
+        memcpy(out, "nan", 3);
+        return 3;
+    }
+    int n = 0;
+    if (signbit(value)) {
+        out[n++] = '-';
+        value = -value;
+    }
+    if (isinf(value)) {
+        memcpy(out + n, "inf", 3);
+        return n + 3;
+    }
+    if (value == 0) {
+        out[n++] = '0';
+        return n;
+    }
+    // Whole numbers below 2^53 are exact as integers.
+    if (value < 9007199254740992.0 && value == (double)(uint64_t)value) {
+        return n + fmt_u64(out + n, (uint64_t)value);
+    }
+    char digits[20];
+    int k;
+    int len = grisu2(value, digits, &k);
+    return n + prettify(out + n, digits, len, k);
+}
+
+// ---- parsing ----
+
+static bool parse_int_digits(const char* chars, int64_t i, int64_t length, bool negative, int64_t* out) {
+    if (i == length) return false;
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    uint64_t acc = 0;
+    for (; i < length; i++) {
+        unsigned d = (unsigned)(chars[i] - '0');
+        if (d > 9) return false;
+        if (acc > (limit - d) / 10) return false;
+        acc = acc * 10 + d;
+    }
+    *out = negative ? (int64_t)(0 - acc) : (int64_t)acc;
+    return true;
+}
+
+bool parse_int(const char* chars, int64_t length, int64_t* out) {
+    int64_t i = 0;
+    while (i < length && isspace((unsigned char)chars[i])) i++;
+    bool negative = false;
+    if (i < length && (chars[i] == '+' || chars[i] == '-')) {
+        negative = chars[i] == '-';
+        i++;
+    }
+    return parse_int_digits(chars, i, length, negative, out);
+}
+
+// Anything the fast path does not cover exactly goes through strtod.
+static bool parse_flt_slow(const char* chars, int64_t length, double* out) {
+    char small[64];
+    char* buf = length < (int)sizeof(small) ? small : malloc(length + 1);
+    memcpy(buf, chars, length);
+    buf[length] = '\0';
+    char* end;
+    double value = strtod(buf, &end);
+    bool ok = length > 0 && end == buf + length;
+    if (buf != small) free(buf);
+    if (ok) *out = value;
+    return ok;
+}
+
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Clinger's fast path: a mantissa below 2^53 and a power of ten up to 10^22
+// are both exact doubles, so one multiply or divide rounds correctly.
+bool parse_flt(const char* chars, int64_t length, double* out) {
+    int64_t i = 0;
+    while (i < length && isspace((unsigned char)chars[i])) i++;
+    bool negative = false;
+    if (i < length && (chars[i] == '+' || chars[i] == '-')) {
+        negative = chars[i] == '-';
+        i++;
+    }
+    uint64_t mantissa = 0;
+    int64_t exp10 = 0;
+    bool any_digits = false;
+    for (; i < length && isdigit((unsigned char)chars[i]); i++) {
+        if (mantissa > 100000000000000000ull) return parse_flt_slow(chars, length, out);
+        mantissa = mantissa * 10 + (uint64_t)(chars[i] - '0');
+        any_digits = true;
+    }
+    if (i < length && chars[i] == '.') {
+        for (i++; i < length && isdigit((unsigned char)chars[i]); i++) {
+            if (mantissa > 100000000000000000ull) return parse_flt_slow(chars, length, out);
+            mantissa = mantissa * 10 + (uint64_t)(chars[i] - '0');
+            exp10--;
+            any_digits = true;
+        }
+    }
+    if (!any_digits) return parse_flt_slow(chars, length, out);
+    if (i < length && (chars[i] == 'e' || chars[i] == 'E')) {
+        i++;
+        bool exp_negative = false;
+        if (i < length && (chars[i] == '+' || chars[i] == '-')) {
+            exp_negative = chars[i] == '-';
+            i++;
+        }
+        if (i == length || !isdigit((unsigned char)chars[i])) return parse_flt_slow(chars, length, out);
+        int e = 0;
+        for (; i < length && isdigit((unsigned char)chars[i]); i++) {
+            if (e < 10000) e = e * 10 + (chars[i] - '0');
+        }
+        exp10 += exp_negative ? -e : e;
+    }
+    if (i != length || mantissa > ((uint64_t)1 << 53) || exp10 < -22 || exp10 > 22) {
+        return parse_flt_slow(chars, length, out);
+    }
+    double value = (double)mantissa;
+    value = exp10 < 0 ? value / exact_pow10[-exp10] : value * exact_pow10[exp10];
+    *out = negative ? -value : value;
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef OPO_NUMCONV_H
+#define OPO_NUMCONV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Number <-> text conversions used by str(), int(), flt(), JSON and string
+// builders. Formatting writes into a caller buffer of at least NUM_BUF_SIZE
+// bytes, returns the length and does not NUL-terminate.
+
+#define NUM_BUF_SIZE 32
+
+int fmt_int(char* out, int64_t value);
+
+// Digits that read back as the same double; the shortest such digits except
+// in rare cases (Grisu2). Integral values print without a fraction ("5"),
+// and very large or small magnitudes switch to exponent form ("1e+21",
+// "1.5e-07"), as %g does.
+int fmt_flt(char* out, double value);
+
+// Parse the whole of chars[0..length) as a base-10 integer or a decimal
+// float. Leading whitespace and a sign are accepted; anything left over, or
+// an integer that does not fit in 64 bits, fails.
+bool parse_int(const char* chars, int64_t length, int64_t* out);
+bool parse_flt(const char* chars, int64_t length, double* out);
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "router.h"
+
+typedef struct {
+    char* method;
+    size_t method_len;
+    int id;
+} RouteTarget;
+
+typedef struct RouteNode {
+    char* prefix;          // static text on the edge into this node
+    size_t prefix_len;
+    char* indices;         // first byte of each static child's prefix
+    struct RouteNode** children;
+    int child_count;
+    struct RouteNode* param;    // `:name` child, matching up to the next '/'
+    struct RouteNode* wildcard; // `*name` child, matching the rest
+    int name;                   // parameter name of a param or wildcard node
+    RouteTarget* targets;       // routes that end here, by method
+    int target_count;
+} RouteNode;
+
+struct Router {
+    RouteNode root;
+    char** names;
+    size_t* name_lens;
+    int name_count;
+};
+
+static RouteNode* node_new(const char* prefix, size_t length) {
+    RouteNode* node = calloc(1, sizeof(RouteNode));
+    node->prefix = malloc(length + 1);
+    memcpy(node->prefix, prefix, length);
+    node->prefix_len = length;
+    node->name = -1;
+    return node;
+}
+
+static void node_free(RouteNode* node, bool self) {
+    for (int i = 0; i < node->child_count; i++) node_free(node->children[i], true);
+    if (node->param != NULL) node_free(node->param, true);
+    if (node->wildcard != NULL) node_free(node->wildcard, true);
+    for (int i = 0; i < node->target_count; i++) free(node->targets[i].method);
+    free(node->targets);
+    free(node->children);
+    free(node->indices);
+    free(node->prefix);
+    if (self) free(node);
+}
+
+static void add_child(RouteNode* node, RouteNode* child) {
+    node->children = realloc(node->children, sizeof(RouteNode*) * (node->child_count + 1));
+    node->indices = realloc(node->indices, node->child_count + 1);
+    node->children[node->child_count] = child;
+    node->indices[node->child_count] = child->prefix[0];
+    node->child_count++;
+}
+
+// Walks or extends the tree along static text, splitting an edge where the
+// text leaves it. Returns the node the text ends at.
+static RouteNode* insert_static(RouteNode* node, const char* text, size_t length) {
+    while (length > 0) {
+        int i = 0;
+        while (i < node->child_count && node->indices[i] != text[0]) i++;
+        if (i == node->child_count) {
+            RouteNode* child = node_new(text, length);
+            add_child(node, child);
+            return child;
+        }
+        RouteNode* child = node->children[i];
+        size_t common = 1;
+        while (common < child->prefix_len && common < length && child->prefix[common] == text[common]) common++;
+        if (common < child->prefix_len) {
+            RouteNode* mid = node_new(child->prefix, common);
+            child->prefix_len -= common;
+            memmove(child->prefix, child->prefix + common, child->prefix_len);
+            node->children[i] = mid;
+            add_child(mid, child);
+            child = mid;
+        }
+        node = child;
+        text += common;
+        length -= common;
+    }
+    return node;
+}
+
+static int name_index(Router* router, const char* name, size_t length) {
+    for (int i = 0; i < router->name_count; i++) {
+        if (router->name_lens[i] == length && memcmp(router->names[i], name, length) == 0) return i;
+    }
+    router->names = realloc(router->names, sizeof(char*) * (router->name_count + 1));
+    router->name_lens = realloc(router->name_lens, sizeof(size_t) * (router->name_count + 1));
+    router->names[router->name_count] = malloc(length + 1);
+    memcpy(router->names[router->name_count], name, length);
+    router->names[router->name_count][length] = '\0';
+    router->name_lens[router->name_count] = length;
+    return router->name_count++;
+}
+
+Router* router_new(void) {
+    Router* router = calloc(1, sizeof(Router));
+    router->root.name = -1;
+    return router;
+}
+
+void router_free(Router* router) {
+    node_free(&router->root, false);
+    for (int i = 0; i < router->name_count; i++) free(router->names[i]);
+    free(router->names);
+    free(router->name_lens);
+    free(router);
+}
+
+const char* router_add(Router* router, const char* method, size_t method_len,
+                       const char* pattern, size_t pattern_len, int id) {
+    RouteNode* node = &router->root;
+    int params = 0;
+    size_t i = 0;
+    while (i < pattern_len) {
+        size_t j = i;
+        while (j < pattern_len && pattern[j] != ':' && pattern[j] != '*') j++;
+        node = insert_static(node, pattern + i, j - i);
+        if (j == pattern_len) break;
+
+        if (j > 0 && pattern[j - 1] != '/') return "a parameter has to start a path segment";
+        size_t end = j + 1;
+        while (end < pattern_len && pattern[end] != '/') end++;
+        if (end == j + 1) return "a parameter needs a name";
+        if (++params > ROUTER_MAX_PARAMS) return "too many parameters";
+        int name = name_index(router, pattern + j + 1, end - j - 1);
+        RouteNode** slot = &node->param;
+        if (pattern[j] == '*') {
+            if (end != pattern_len) return "a wildcard has to end the pattern";
+            slot = &node->wildcard;
+        }
+        if (*slot == NULL) {
+            *slot = node_new("", 0);
+            (*slot)->name = name;
+        } else if ((*slot)->name != name) {
+            return "a different parameter name is already used at this place";
+        }
+        node = *slot;
+        i = end;
+    }
+
+    for (int t = 0; t < node->target_count; t++) {
+        RouteTarget* target = &node->targets[t];
+        if (target->method_len == method_len && memcmp(target->method, method, method_len) == 0) {
+            return "the route is already registered for this method";
+        }
+    }
+    node->targets = realloc(node->targets, sizeof(RouteTarget) * (node->target_count + 1));
+    RouteTarget* target = &node->targets[node->target_count++];
+    target->method = malloc(method_len + 1);
+    memcpy(target->method, method, method_len);
+    target->method_len = method_len;
+    target->id = id;
+    return NULL;
+}
+
+// What one match is looking for, and what it found on the way.
+typedef struct {
+    const char* method;
+    size_t method_len;
+    const char* path;
+    size_t length;
+    RouteCapture* captures;
+    int count;
+    bool no_method; // some route matched the path, but not the method
+} RouteSearch;
+
+// The id node has for the method, a "*" route's, or -1.
+static int node_target(const RouteNode* node, RouteSearch* search) {
+    const RouteTarget* any = NULL;
+    for (int i = 0; i < node->target_count; i++) {
+        const RouteTarget* target = &node->targets[i];
+        if (target->method_len == search->method_len && memcmp(target->method, search->method, search->method_len) == 0) {
+            return target->id;
+        }
+        if (target->method_len == 1 && target->method[0] == '*') any = target;
+    }
+    if (any != NULL) return any->id;
+    if (node->target_count > 0) search->no_method = true;
+    return -1;
+}
+
+// The id of the route path[pos..] leads to from node, or -1. Static
+// children are tried before the parameter, and the parameter before the
+// wildcard; a branch that matches the path but not the method is passed
+// over like one that does not match at all.
+static int match_node(const RouteNode* node, size_t pos, RouteSearch* search) {
+    const char* path = search->path;
+    size_t length = search->length;
+    if (pos == length) {
+        int id = node_target(node, search);
+        if (id >= 0) return id;
+    }
+    if (pos < length) {
+        for (int i = 0; i < node->child_count; i++) {
+            if (node->indices[i] != path[pos]) continue;
+            const RouteNode* child = node->children[i];
+            if (length - pos >= child->prefix_len && memcmp(path + pos, child->prefix, child->prefix_len) == 0) {
+                int id = match_node(child, pos + child->prefix_len, search);
+                if (id >= 0) return id;
+            }
+            break;
+        }
+        if (node->param != NULL) {
+            const char* slash = memchr(path + pos, '/', length - pos);
+            size_t end = slash != NULL ? (size_t)(slash - path) : length;
+            if (end > pos) {
+                int saved = search->count;
+                search->captures[search->count++] = (RouteCapture){ node->param->name, pos, end - pos };
+                int id = match_node(node->param, end, search);
+                if (id >= 0) return id;
+                search->count = saved;
+            }
+        }
+    }
+    if (node->wildcard != NULL) {
+        int id = node_target(node->wildcard, search);
+        if (id >= 0) {
+            search->captures[search->count++] = (RouteCapture){ node->wildcard->name, pos, length - pos };
+            return id;
+        }
+    }
+    return -1;
+}
+
+int router_match(const Router* router, const char* method, size_t method_len,
+                 const char* path, size_t path_len, RouteCapture* captures, int* count) {
+    RouteSearch search = { method, method_len, path, path_len, captures, 0, false };
+    int id = match_node(&router->root, 0, &search);
+    *count = search.count;
+    if (id >= 0) return id;
+    return search.no_method ? ROUTE_NO_METHOD : ROUTE_NOT_FOUND;
+}
+
+int router_param_count(const Router* router) {
+    return router->name_count;
+}
+
+const char* router_param_name(const Router* router, int param, size_t* length) {
+    *length = router->name_lens[param];
+    return router->names[param];
+}
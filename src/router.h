@@ -0,0 +1,47 @@
+#ifndef OPO_ROUTER_H
+#define OPO_ROUTER_H
+
+#include <stddef.h>
+
+// Radix tree of URL patterns. A pattern is made of static text, `:name`
+// segments that match up to the next '/', and a final `*name` that matches
+// the rest of the path. Each pattern keeps an id per method, or for "*",
+// any method. Static text wins over a parameter, and a parameter over a
+// wildcard, backtracking when a branch leads nowhere or has no route for
+// the method.
+//
+// Adding routes is not thread-safe; matching is read-only, so any number of
+// threads can match once the routes are in place.
+
+#define ROUTER_MAX_PARAMS 16
+
+typedef struct Router Router;
+
+typedef struct {
+    int param;    // index of the parameter's name, see router_param_name
+    size_t start; // where its value lies in the matched path
+    size_t length;
+} RouteCapture;
+
+// No route matches the path, or one does but not for the method.
+#define ROUTE_NOT_FOUND -1
+#define ROUTE_NO_METHOD -2
+
+Router* router_new(void);
+void router_free(Router* router);
+
+// Adds pattern for method with id >= 0. Returns NULL, or why it cannot be
+// added.
+const char* router_add(Router* router, const char* method, size_t method_len,
+                       const char* pattern, size_t pattern_len, int id);
+
+// Matches path and returns the route's id or one of the ROUTE_ codes.
+// Captured parameters are stored in captures and counted in *count.
+int router_match(const Router* router, const char* method, size_t method_len,
+                 const char* path, size_t path_len, RouteCapture* captures, int* count);
+
+// Parameter names, in the order they were first used by router_add.
+int router_param_count(const Router* router);
+const char* router_param_name(const Router* router, int param, size_t* length);
+
+#endif
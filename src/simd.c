@@ -0,0 +1,585 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include "simd.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define OPO_SIMD_X86 1
+#endif
+
+// A Value is a 4-byte type tag, 4 bytes of padding and an 8-byte payload, so
+// two adjacent Values fill one SSE register and the payloads sit in the upper
+// 64-bit halves. The kernels below unpack those halves and never look at tags.
+_Static_assert(sizeof(Value) == 16 && offsetof(Value, as) == 8,
+               "SIMD kernels assume 16-byte values with the payload in the upper half");
+
+// First match of needle (n >= 2 bytes) in hay at or after from. Also finishes
+// the tails the vector search loops leave behind.
+static int64_t find_scalar(const char* hay, int64_t hay_len, const char* needle, int64_t n, int64_t from) {
+    for (int64_t i = from; i + n <= hay_len; i++) {
+        const char* p = memchr(hay + i, needle[0], (size_t)(hay_len - n + 1 - i));
+        if (p == NULL) return -1;
+        i = p - hay;
+        if (memcmp(p + 1, needle + 1, (size_t)(n - 1)) == 0) return i;
+    }
+    return -1;
+}
+
+#ifdef OPO_SIMD_X86
+
+static bool has_avx2(void) {
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return cached == 1;
+}
+
+// Payloads of v[0..3] as [p0 p2 | p1 p3]. The order does not matter for
+// reductions, and searches rescan the block in order once a lane matches.
+__attribute__((target("avx2")))
+static inline __m256i load4_avx2(const Value* v) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*)v);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(v + 2));
+    return _mm256_unpackhi_epi64(lo, hi);
+}
+
+// Payloads of v[0..1] as [p0 p1].
+static inline __m128i load2_sse2(const Value* v) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)v);
+    __m128i hi = _mm_loadu_si128((const __m128i*)(v + 1));
+    return _mm_unpackhi_epi64(lo, hi);
+}
+
+// SSE2 has no 64-bit compare; two equal 32-bit halves make an equal lane.
+static inline __m128i cmpeq_epi64_sse2(__m128i a, __m128i b) {
+    __m128i eq32 = _mm_cmpeq_epi32(a, b);
+    return _mm_and_si128(eq32, _mm_shuffle_epi32(eq32, 0xB1));
+}
+
+// Low 64 bits of a 64x64 multiply built from 32x32->64 multiplies.
+__attribute__((target("avx2")))
+static inline __m256i mullo_epi64_avx2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)),
+                                     _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+static inline __m128i mullo_epi64_sse2(__m128i a, __m128i b) {
+    __m128i lo = _mm_mul_epu32(a, b);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(a, _mm_srli_epi64(b, 32)),
+                                  _mm_mul_epu32(_mm_srli_epi64(a, 32), b));
+    return _mm_add_epi64(lo, _mm_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static int64_t hsum_epi64_avx2(__m256i v) {
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static int64_t hsum_epi64_sse2(__m128i v) {
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, v);
+    return lanes[0] + lanes[1];
+}
+
+__attribute__((target("avx2")))
+static double hsum_pd_avx2(__m256d v) {
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+/* ---- sum ---- */
+
+__attribute__((target("avx2")))
+static int64_t sum_int_avx2(const Value* v, int n) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_epi64(acc0, load4_avx2(v + i));
+        acc1 = _mm256_add_epi64(acc1, load4_avx2(v + i + 4));
+    }
+    for (; i + 4 <= n; i += 4) acc0 = _mm256_add_epi64(acc0, load4_avx2(v + i));
+    int64_t sum = hsum_epi64_avx2(_mm256_add_epi64(acc0, acc1));
+    for (; i < n; i++) sum += v[i].as.i_val;
+    return sum;
+}
+
+static int64_t sum_int_sse2(const Value* v, int n) {
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) acc = _mm_add_epi64(acc, load2_sse2(v + i));
+    int64_t sum = hsum_epi64_sse2(acc);
+    for (; i < n; i++) sum += v[i].as.i_val;
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static double sum_flt_avx2(const Value* v, int n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_castsi256_pd(load4_avx2(v + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_castsi256_pd(load4_avx2(v + i + 4)));
+    }
+    for (; i + 4 <= n; i += 4) acc0 = _mm256_add_pd(acc0, _mm256_castsi256_pd(load4_avx2(v + i)));
+    double sum = hsum_pd_avx2(_mm256_add_pd(acc0, acc1));
+    for (; i < n; i++) sum += v[i].as.f_val;
+    return sum;
+}
+
+static double sum_flt_sse2(const Value* v, int n) {
+    __m128d acc = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) acc = _mm_add_pd(acc, _mm_castsi128_pd(load2_sse2(v + i)));
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; i++) sum += v[i].as.f_val;
+    return sum;
+}
+
+/* ---- min / max ---- */
+
+__attribute__((target("avx2")))
+static int64_t minmax_int_avx2(const Value* v, int n, bool want_max) {
+    __m256i best = _mm256_set1_epi64x(v[0].as.i_val);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = load4_avx2(v + i);
+        __m256i take = want_max ? _mm256_cmpgt_epi64(x, best) : _mm256_cmpgt_epi64(best, x);
+        best = _mm256_blendv_epi8(best, x, take);
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, best);
+    int64_t m = lanes[0];
+    for (int l = 1; l < 4; l++) {
+        if (want_max ? lanes[l] > m : lanes[l] < m) m = lanes[l];
+    }
+    for (; i < n; i++) {
+        if (want_max ? v[i].as.i_val > m : v[i].as.i_val < m) m = v[i].as.i_val;
+    }
+    return m;
+}
+
+static int64_t minmax_int_scalar(const Value* v, int n, bool want_max) {
+    int64_t m = v[0].as.i_val;
+    for (int i = 1; i < n; i++) {
+        if (want_max ? v[i].as.i_val > m : v[i].as.i_val < m) m = v[i].as.i_val;
+    }
+    return m;
+}
+
+// The float min/max kernels return NaN if any item is NaN, whichever path
+// runs: maxpd and minpd alone would keep or drop it depending on its lane.
+__attribute__((target("avx2")))
+static double minmax_flt_avx2(const Value* v, int n, bool want_max) {
+    __m256d best = _mm256_set1_pd(v[0].as.f_val);
+    __m256d nan = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_castsi256_pd(load4_avx2(v + i));
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+        best = want_max ? _mm256_max_pd(x, best) : _mm256_min_pd(x, best);
+    }
+    if (_mm256_movemask_pd(nan) != 0) return NAN;
+    double lanes[4];
+    _mm256_storeu_pd(lanes, best);
+    double m = lanes[0];
+    for (int l = 1; l < 4; l++) {
+        if (want_max ? lanes[l] > m : lanes[l] < m) m = lanes[l];
+    }
+    for (; i < n; i++) {
+        if (isnan(v[i].as.f_val)) return NAN;
+        if (want_max ? v[i].as.f_val > m : v[i].as.f_val < m) m = v[i].as.f_val;
+    }
+    return m;
+}
+
+static double minmax_flt_sse2(const Value* v, int n, bool want_max) {
+    __m128d best = _mm_set1_pd(v[0].as.f_val);
+    __m128d nan = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_castsi128_pd(load2_sse2(v + i));
+        nan = _mm_or_pd(nan, _mm_cmpunord_pd(x, x));
+        best = want_max ? _mm_max_pd(x, best) : _mm_min_pd(x, best);
+    }
+    if (_mm_movemask_pd(nan) != 0) return NAN;
+    double lanes[2];
+    _mm_storeu_pd(lanes, best);
+    double m = (want_max ? lanes[1] > lanes[0] : lanes[1] < lanes[0]) ? lanes[1] : lanes[0];
+    for (; i < n; i++) {
+        if (isnan(v[i].as.f_val)) return NAN;
+        if (want_max ? v[i].as.f_val > m : v[i].as.f_val < m) m = v[i].as.f_val;
+    }
+    return m;
+}
+
+/* ---- index / count ---- */
+
+__attribute__((target("avx2")))
+static int index_int_avx2(const Value* v, int n, int64_t needle) {
+    __m256i key = _mm256_set1_epi64x(needle);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i eq = _mm256_cmpeq_epi64(load4_avx2(v + i), key);
+        if (_mm256_movemask_epi8(eq) != 0) break;
+    }
+    for (; i < n; i++) {
+        if (v[i].as.i_val == needle) return i;
+    }
+    return -1;
+}
+
+static int index_int_sse2(const Value* v, int n, int64_t needle) {
+    __m128i key = _mm_set1_epi64x(needle);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i eq = cmpeq_epi64_sse2(load2_sse2(v + i), key);
+        if (_mm_movemask_epi8(eq) != 0) break;
+    }
+    for (; i < n; i++) {
+        if (v[i].as.i_val == needle) return i;
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static int index_flt_avx2(const Value* v, int n, double needle) {
+    __m256d key = _mm256_set1_pd(needle);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d eq = _mm256_cmp_pd(_mm256_castsi256_pd(load4_avx2(v + i)), key, _CMP_EQ_OQ);
+        if (_mm256_movemask_pd(eq) != 0) break;
+    }
+    for (; i < n; i++) {
+        if (v[i].as.f_val == needle) return i;
+    }
+    return -1;
+}
+
+static int index_flt_sse2(const Value* v, int n, double needle) {
+    __m128d key = _mm_set1_pd(needle);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d eq = _mm_cmpeq_pd(_mm_castsi128_pd(load2_sse2(v + i)), key);
+        if (_mm_movemask_pd(eq) != 0) break;
+    }
+    for (; i < n; i++) {
+        if (v[i].as.f_val == needle) return i;
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static int count_int_avx2(const Value* v, int n, int64_t needle) {
+    __m256i key = _mm256_set1_epi64x(needle);
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm256_sub_epi64(acc, _mm256_cmpeq_epi64(load4_avx2(v + i), key));
+    }
+    int count = (int)hsum_epi64_avx2(acc);
+    for (; i < n; i++) count += v[i].as.i_val == needle;
+    return count;
+}
+
+static int count_int_sse2(const Value* v, int n, int64_t needle) {
+    __m128i key = _mm_set1_epi64x(needle);
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        acc = _mm_sub_epi64(acc, cmpeq_epi64_sse2(load2_sse2(v + i), key));
+    }
+    int count = (int)hsum_epi64_sse2(acc);
+    for (; i < n; i++) count += v[i].as.i_val == needle;
+    return count;
+}
+
+__attribute__((target("avx2")))
+static int count_flt_avx2(const Value* v, int n, double needle) {
+    __m256d key = _mm256_set1_pd(needle);
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d eq = _mm256_cmp_pd(_mm256_castsi256_pd(load4_avx2(v + i)), key, _CMP_EQ_OQ);
+        acc = _mm256_sub_epi64(acc, _mm256_castpd_si256(eq));
+    }
+    int count = (int)hsum_epi64_avx2(acc);
+    for (; i < n; i++) count += v[i].as.f_val == needle;
+    return count;
+}
+
+static int count_flt_sse2(const Value* v, int n, double needle) {
+    __m128d key = _mm_set1_pd(needle);
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d eq = _mm_cmpeq_pd(_mm_castsi128_pd(load2_sse2(v + i)), key);
+        acc = _mm_sub_epi64(acc, _mm_castpd_si128(eq));
+    }
+    int count = (int)hsum_epi64_sse2(acc);
+    for (; i < n; i++) count += v[i].as.f_val == needle;
+    return count;
+}
+
+/* ---- dot ---- */
+
+__attribute__((target("avx2")))
+static int64_t dot_int_avx2(const Value* a, const Value* b, int n) {
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm256_add_epi64(acc, mullo_epi64_avx2(load4_avx2(a + i), load4_avx2(b + i)));
+    }
+    int64_t dot = hsum_epi64_avx2(acc);
+    for (; i < n; i++) dot += a[i].as.i_val * b[i].as.i_val;
+    return dot;
+}
+
+static int64_t dot_int_sse2(const Value* a, const Value* b, int n) {
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        acc = _mm_add_epi64(acc, mullo_epi64_sse2(load2_sse2(a + i), load2_sse2(b + i)));
+    }
+    int64_t dot = hsum_epi64_sse2(acc);
+    for (; i < n; i++) dot += a[i].as.i_val * b[i].as.i_val;
+    return dot;
+}
+
+__attribute__((target("avx2")))
+static double dot_flt_avx2(const Value* a, const Value* b, int n) {
+    __m256d acc = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_castsi256_pd(load4_avx2(a + i));
+        __m256d y = _mm256_castsi256_pd(load4_avx2(b + i));
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(x, y));
+    }
+    double dot = hsum_pd_avx2(acc);
+    for (; i < n; i++) dot += a[i].as.f_val * b[i].as.f_val;
+    return dot;
+}
+
+static double dot_flt_sse2(const Value* a, const Value* b, int n) {
+    __m128d acc = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_castsi128_pd(load2_sse2(a + i));
+        __m128d y = _mm_castsi128_pd(load2_sse2(b + i));
+        acc = _mm_add_pd(acc, _mm_mul_pd(x, y));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double dot = lanes[0] + lanes[1];
+    for (; i < n; i++) dot += a[i].as.f_val * b[i].as.f_val;
+    return dot;
+}
+
+/* ---- substring search ---- */
+
+// Compare a block of candidate start positions against the needle's first
+// byte and the block shifted by n - 1 against its last byte; only positions
+// where both match get a full memcmp. This skips most of the haystack a
+// vector at a time even when the first byte alone is common.
+__attribute__((target("avx2")))
+static int64_t find_avx2(const char* hay, int64_t hay_len, const char* needle, int64_t n) {
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[n - 1]);
+    int64_t i = 0;
+    for (; i + n - 1 + 32 <= hay_len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(hay + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(hay + i + n - 1));
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(eq);
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, (size_t)(n - 2)) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(hay, hay_len, needle, n, i);
+}
+
+static int64_t find_sse2(const char* hay, int64_t hay_len, const char* needle, int64_t n) {
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[n - 1]);
+    int64_t i = 0;
+    for (; i + n - 1 + 16 <= hay_len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(hay + i + n - 1));
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last));
+        unsigned mask = (unsigned)_mm_movemask_epi8(eq);
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, (size_t)(n - 2)) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(hay, hay_len, needle, n, i);
+}
+
+#define SIMD_DISPATCH(avx2_call, sse2_call) \
+    return has_avx2() ? avx2_call : sse2_call
+
+#else
+
+/* Portable fallbacks for targets without x86 vector units. */
+
+static int64_t minmax_int_scalar(const Value* v, int n, bool want_max) {
+    int64_t m = v[0].as.i_val;
+    for (int i = 1; i < n; i++) {
+        if (want_max ? v[i].as.i_val > m : v[i].as.i_val < m) m = v[i].as.i_val;
+    }
+    return m;
+}
+
+static double minmax_flt_scalar(const Value* v, int n, bool want_max) {
+    double m = v[0].as.f_val;
+    for (int i = 0; i < n; i++) {
+        if (isnan(v[i].as.f_val)) return NAN;
+        if (want_max ? v[i].as.f_val > m : v[i].as.f_val < m) m = v[i].as.f_val;
+    }
+    return m;
+}
+
+#endif
+
+int64_t simd_sum_int(const Value* items, int count) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(sum_int_avx2(items, count), sum_int_sse2(items, count));
+#else
+    int64_t sum = 0;
+    for (int i = 0; i < count; i++) sum += items[i].as.i_val;
+    return sum;
+#endif
+}
+
+double simd_sum_flt(const Value* items, int count) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(sum_flt_avx2(items, count), sum_flt_sse2(items, count));
+#else
+    double sum = 0;
+    for (int i = 0; i < count; i++) sum += items[i].as.f_val;
+    return sum;
+#endif
+}
+
+int64_t simd_min_int(const Value* items, int count) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(minmax_int_avx2(items, count, false), minmax_int_scalar(items, count, false));
+#else
+    return minmax_int_scalar(items, count, false);
+#endif
+}
+
+int64_t simd_max_int(const Value* items, int count) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(minmax_int_avx2(items, count, true), minmax_int_scalar(items, count, true));
+#else
+    return minmax_int_scalar(items, count, true);
+#endif
+}
+
+double simd_min_flt(const Value* items, int count) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(minmax_flt_avx2(items, count, false), minmax_flt_sse2(items, count, false));
+#else
+    return minmax_flt_scalar(items, count, false);
+#endif
+}
+
+double simd_max_flt(const Value* items, int count) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(minmax_flt_avx2(items, count, true), minmax_flt_sse2(items, count, true));
+#else
+    return minmax_flt_scalar(items, count, true);
+#endif
+}
+
+int simd_index_int(const Value* items, int count, int64_t needle) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(index_int_avx2(items, count, needle), index_int_sse2(items, count, needle));
+#else
+    for (int i = 0; i < count; i++) {
+        if (items[i].as.i_val == needle) return i;
+    }
+    return -1;
+#endif
+}
+
+int simd_index_flt(const Value* items, int count, double needle) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(index_flt_avx2(items, count, needle), index_flt_sse2(items, count, needle));
+#else
+    for (int i = 0; i < count; i++) {
+        if (items[i].as.f_val == needle) return i;
+    }
+    return -1;
+#endif
+}
+
+int simd_count_int(const Value* items, int count, int64_t needle) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(count_int_avx2(items, count, needle), count_int_sse2(items, count, needle));
+#else
+    int n = 0;
+    for (int i = 0; i < count; i++) n += items[i].as.i_val == needle;
+    return n;
+#endif
+}
+
+int simd_count_flt(const Value* items, int count, double needle) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(count_flt_avx2(items, count, needle), count_flt_sse2(items, count, needle));
+#else
+    int n = 0;
+    for (int i = 0; i < count; i++) n += items[i].as.f_val == needle;
+    return n;
+#endif
+}
+
+int64_t simd_dot_int(const Value* a, const Value* b, int count) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(dot_int_avx2(a, b, count), dot_int_sse2(a, b, count));
+#else
+    int64_t dot = 0;
+    for (int i = 0; i < count; i++) dot += a[i].as.i_val * b[i].as.i_val;
+    return dot;
+#endif
+}
+
+double simd_dot_flt(const Value* a, const Value* b, int count) {
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(dot_flt_avx2(a, b, count), dot_flt_sse2(a, b, count));
+#else
+    double dot = 0;
+    for (int i = 0; i < count; i++) dot += a[i].as.f_val * b[i].as.f_val;
+    return dot;
+#endif
+}
+
+int64_t simd_find_bytes(const char* hay, int64_t hay_len, const char* needle, int64_t needle_len) {
+    if (needle_len == 0) return 0;
+    if (needle_len > hay_len) return -1;
+    if (needle_len == 1) {
+        const char* p = memchr(hay, needle[0], (size_t)hay_len);
+        return p == NULL ? -1 : p - hay;
+    }
+#ifdef OPO_SIMD_X86
+    SIMD_DISPATCH(find_avx2(hay, hay_len, needle, needle_len), find_sse2(hay, hay_len, needle, needle_len));
+#else
+    return find_scalar(hay, hay_len, needle, needle_len, 0);
+#endif
+}
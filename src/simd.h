@@ -0,0 +1,28 @@
+#ifndef OPO_SIMD_H
+#define OPO_SIMD_H
+
+#include <stdint.h>
+#include "common.h"
+
+// Vectorized kernels over the payloads of Value arrays. Every kernel picks an
+// AVX2 or SSE2 implementation at runtime and falls back to plain C elsewhere.
+// Callers guarantee the elements all hold the payload kind the kernel reads.
+
+int64_t simd_sum_int(const Value* items, int count);
+double simd_sum_flt(const Value* items, int count);
+int64_t simd_min_int(const Value* items, int count);
+int64_t simd_max_int(const Value* items, int count);
+double simd_min_flt(const Value* items, int count);
+double simd_max_flt(const Value* items, int count);
+int simd_index_int(const Value* items, int count, int64_t needle);
+int simd_index_flt(const Value* items, int count, double needle);
+int simd_count_int(const Value* items, int count, int64_t needle);
+int simd_count_flt(const Value* items, int count, double needle);
+int64_t simd_dot_int(const Value* a, const Value* b, int count);
+double simd_dot_flt(const Value* a, const Value* b, int count);
+
+// Byte offset of the first occurrence of needle in hay, or -1. An empty
+// needle matches at 0.
+int64_t simd_find_bytes(const char* hay, int64_t hay_len, const char* needle, int64_t needle_len);
+
+#endif
@@ -0,0 +1,395 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sort.h"
+
+#define RADIX_MIN 64
+#define INSERTION_THRESHOLD 24
+#define NINTHER_THRESHOLD 128
+#define PARTIAL_INSERTION_LIMIT 8
+
+// ---- LSD radix sort on 64-bit keys ----
+
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Sorts keys[0..count) using tmp as scratch, in `passes` passes over
+// RADIX_BITS-bit digits starting from the least significant one.
+static void radix_sort_u64(uint64_t* keys, uint64_t* tmp, int count, int passes) {
+    size_t (*counts)[RADIX_BUCKETS] = calloc(passes, sizeof(*counts));
+    for (int i = 0; i < count; i++) {
+        uint64_t k = keys[i];
+        for (int p = 0; p < passes; p++) {
+            counts[p][k & (RADIX_BUCKETS - 1)]++;
+            k >>= RADIX_BITS;
+        }
+    }
+
+    uint64_t* src = keys;
+    uint64_t* dst = tmp;
+    for (int p = 0; p < passes; p++) {
+        size_t* c = counts[p];
+        int shift = p * RADIX_BITS;
+        // Every key shares this digit, so the pass would not move anything.
+        if (c[(src[0] >> shift) & (RADIX_BUCKETS - 1)] == (size_t)count) continue;
+        size_t offset = 0;
+        for (int d = 0; d < RADIX_BUCKETS; d++) {
+            size_t n = c[d];
+            c[d] = offset;
+            offset += n;
+        }
+        for (int i = 0; i < count; i++) {
+            uint64_t k = src[i];
+            dst[c[(k >> shift) & (RADIX_BUCKETS - 1)]++] = k;
+        }
+        uint64_t* t = src; src = dst; dst = t;
+    }
+    if (src != keys) memcpy(keys, src, sizeof(uint64_t) * count);
+    free(counts);
+}
+
+static void insertion_sort_u64(uint64_t* keys, int count) {
+    for (int i = 1; i < count; i++) {
+        uint64_t k = keys[i];
+        int j = i;
+        while (j > 0 && keys[j - 1] > k) { keys[j] = keys[j - 1]; j--; }
+        keys[j] = k;
+    }
+}
+
+// Sorts keys that were already rebased on their minimum, so the radix passes
+// only cover the digits the actual value range needs.
+static void sort_rebased(uint64_t* keys, int count, uint64_t range) {
+    if (count < RADIX_MIN) {
+        insertion_sort_u64(keys, count);
+        return;
+    }
+    int passes = 0;
+    for (; range != 0; range >>= RADIX_BITS) passes++;
+    if (passes == 0) return;
+    uint64_t* tmp = malloc(sizeof(uint64_t) * count);
+    radix_sort_u64(keys, tmp, count, passes);
+    free(tmp);
+}
+
+void sort_ints(Value* items, int count) {
+    if (count < 2) return;
+    int64_t lo = items[0].as.i_val, hi = lo;
+    for (int i = 1; i < count; i++) {
+        int64_t v = items[i].as.i_val;
+        if (v < lo) lo = v;
+        if (v > hi) hi = v;
+    }
+    uint64_t* keys = malloc(sizeof(uint64_t) * count);
+    for (int i = 0; i < count; i++) keys[i] = (uint64_t)items[i].as.i_val - (uint64_t)lo;
+    sort_rebased(keys, count, (uint64_t)hi - (uint64_t)lo);
+    for (int i = 0; i < count; i++) items[i].as.i_val = (int64_t)(keys[i] + (uint64_t)lo);
+    free(keys);
+}
+
+// IEEE doubles order like sign-magnitude integers: flip every bit of
+// negatives and only the sign bit of positives.
+static inline uint64_t flt_key(double f) {
+    uint64_t u;
+    memcpy(&u, &f, sizeof(u));
+    return (u >> 63) ? ~u : u ^ (1ULL << 63);
+}
+
+static inline double flt_from_key(uint64_t k) {
+    uint64_t u = (k >> 63) ? k ^ (1ULL << 63) : ~k;
+    double f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+void sort_flts(Value* items, int count) {
+    if (count < 2) return;
+    uint64_t* keys = malloc(sizeof(uint64_t) * count);
+    uint64_t lo = UINT64_MAX, hi = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t k = flt_key(items[i].as.f_val);
+        keys[i] = k;
+        if (k < lo) lo = k;
+        if (k > hi) hi = k;
+    }
+    for (int i = 0; i < count; i++) keys[i] -= lo;
+    sort_rebased(keys, count, hi - lo);
+    for (int i = 0; i < count; i++) items[i].as.f_val = flt_from_key(keys[i] + lo);
+    free(keys);
+}
+
+// ---- pattern-defeating quicksort ----
+
+// Items carry an optional precomputed key next to the value so typed sorts
+// can settle most comparisons without touching the heap.
+typedef struct {
+    uint64_t key;
+    Value value;
+} SortItem;
+
+typedef bool (*ItemLess)(void* ctx, const SortItem* a, const SortItem* b);
+
+typedef struct {
+    SortItem* a;
+    ItemLess less;
+    void* ctx;
+} Sorter;
+
+static inline bool lt(const Sorter* s, const SortItem* x, const SortItem* y) {
+    return s->less(s->ctx, x, y);
+}
+
+static inline void swap_items(Sorter* s, int i, int j) {
+    SortItem t = s->a[i];
+    s->a[i] = s->a[j];
+    s->a[j] = t;
+}
+
+static inline void sort2(Sorter* s, int i, int j) {
+    if (lt(s, &s->a[j], &s->a[i])) swap_items(s, i, j);
+}
+
+static inline void sort3(Sorter* s, int i, int j, int k) {
+    sort2(s, i, j);
+    sort2(s, j, k);
+    sort2(s, i, j);
+}
+
+static void insertion_sort(Sorter* s, int begin, int end) {
+    SortItem* a = s->a;
+    for (int i = begin + 1; i < end; i++) {
+        SortItem tmp = a[i];
+        int j = i;
+        while (j > begin && lt(s, &tmp, &a[j - 1])) { a[j] = a[j - 1]; j--; }
+        a[j] = tmp;
+    }
+}
+
+// Insertion sort that gives up after PARTIAL_INSERTION_LIMIT moves. Returns
+// true if the range ended up sorted.
+static bool partial_insertion_sort(Sorter* s, int begin, int end) {
+    SortItem* a = s->a;
+    int moves = 0;
+    for (int i = begin + 1; i < end; i++) {
+        if (moves > PARTIAL_INSERTION_LIMIT) return false;
+        SortItem tmp = a[i];
+        int j = i;
+        while (j > begin && lt(s, &tmp, &a[j - 1])) { a[j] = a[j - 1]; j--; }
+        a[j] = tmp;
+        moves += i - j;
+    }
+    return true;
+}
+
+static void sift_down(Sorter* s, int begin, int root, int size) {
+    SortItem* a = s->a;
+    while (true) {
+        int child = 2 * root + 1;
+        if (child >= size) return;
+        if (child + 1 < size && lt(s, &a[begin + child], &a[begin + child + 1])) child++;
+        if (!lt(s, &a[begin + root], &a[begin + child])) return;
+        swap_items(s, begin + root, begin + child);
+        root = child;
+    }
+}
+
+static void heap_sort(Sorter* s, int begin, int end) {
+    int size = end - begin;
+    for (int i = size / 2 - 1; i >= 0; i--) sift_down(s, begin, i, size);
+    for (int i = size - 1; i > 0; i--) {
+        swap_items(s, begin, begin + i);
+        sift_down(s, begin, 0, i);
+    }
+}
+
+// Partitions [begin, end) around a[begin] into < pivot and >= pivot. The
+// scans are bounds-checked so an inconsistent comparator cannot run off the
+// range. Sets *already when no element had to move.
+static int partition_right(Sorter* s, int begin, int end, bool* already) {
+    SortItem* a = s->a;
+    SortItem pivot = a[begin];
+    int first = begin;
+    int last = end;
+
+    while (++first < end && lt(s, &a[first], &pivot));
+    if (first - 1 == begin) {
+        while (first < last && !lt(s, &a[--last], &pivot));
+    } else {
+        while (last > first && !lt(s, &a[--last], &pivot));
+    }
+
+    *already = first >= last;
+    while (first < last) {
+        swap_items(s, first, last);
+        while (++first < end && lt(s, &a[first], &pivot));
+        while (last > first && !lt(s, &a[--last], &pivot));
+    }
+
+    int pivot_pos = first - 1;
+    a[begin] = a[pivot_pos];
+    a[pivot_pos] = pivot;
+    return pivot_pos;
+}
+
+// Partitions [begin, end) into <= pivot and > pivot. Used when the pivot
+// equals the element before the range, which puts runs of equal elements in
+// place in one step.
+static int partition_left(Sorter* s, int begin, int end) {
+    SortItem* a = s->a;
+    SortItem pivot = a[begin];
+    int first = begin;
+    int last = end;
+
+    while (--last > begin && lt(s, &pivot, &a[last]));
+    if (last + 1 == end) {
+        while (first < last && !lt(s, &pivot, &a[++first]));
+    } else {
+        while (first < last && !lt(s, &pivot, &a[++first]));
+    }
+
+    while (first < last) {
+        swap_items(s, first, last);
+        while (--last > begin && lt(s, &pivot, &a[last]));
+        while (first < last && !lt(s, &pivot, &a[++first]));
+    }
+
+    a[begin] = a[last];
+    a[last] = pivot;
+    return last;
+}
+
+static void pdq_loop(Sorter* s, int begin, int end, int bad_allowed, bool leftmost) {
+    while (true) {
+        int size = end - begin;
+        if (size < INSERTION_THRESHOLD) {
+            insertion_sort(s, begin, end);
+            return;
+        }
+
+        int s2 = size / 2;
+        if (size > NINTHER_THRESHOLD) {
+            sort3(s, begin, begin + s2, end - 1);
+            sort3(s, begin + 1, begin + s2 - 1, end - 2);
+            sort3(s, begin + 2, begin + s2 + 1, end - 3);
+            sort3(s, begin + s2 - 1, begin + s2, begin + s2 + 1);
+            swap_items(s, begin, begin + s2);
+        } else {
+            sort3(s, begin + s2, begin, end - 1);
+        }
+
+        if (!leftmost && !lt(s, &s->a[begin - 1], &s->a[begin])) {
+            begin = partition_left(s, begin, end) + 1;
+            continue;
+        }
+
+        bool already;
+        int pivot_pos = partition_right(s, begin, end, &already);
+        int l_size = pivot_pos - begin;
+        int r_size = end - (pivot_pos + 1);
+
+        if (l_size < size / 8 || r_size < size / 8) {
+            if (--bad_allowed == 0) {
+                heap_sort(s, begin, end);
+                return;
+            }
+            // Shuffle a few elements to break the pattern that produced a
+            // lopsided partition.
+            if (l_size >= INSERTION_THRESHOLD) {
+                swap_items(s, begin, begin + l_size / 4);
+                swap_items(s, pivot_pos - 1, pivot_pos - l_size / 4);
+                if (l_size > NINTHER_THRESHOLD) {
+                    swap_items(s, begin + 1, begin + (l_size / 4 + 1));
+                    swap_items(s, begin + 2, begin + (l_size / 4 + 2));
+                    swap_items(s, pivot_pos - 2, pivot_pos - (l_size / 4 + 1));
+                    swap_items(s, pivot_pos - 3, pivot_pos - (l_size / 4 + 2));
+                }
+            }
+            if (r_size >= INSERTION_THRESHOLD) {
+                swap_items(s, pivot_pos + 1, pivot_pos + (1 + r_size / 4));
+                swap_items(s, end - 1, end - r_size / 4);
+                if (r_size > NINTHER_THRESHOLD) {
+                    swap_items(s, pivot_pos + 2, pivot_pos + (2 + r_size / 4));
+                    swap_items(s, pivot_pos + 3, pivot_pos + (3 + r_size / 4));
+                    swap_items(s, end - 2, end - (1 + r_size / 4));
+                    swap_items(s, end - 3, end - (2 + r_size / 4));
+                }
+            }
+        } else if (already && partial_insertion_sort(s, begin, pivot_pos) &&
+                   partial_insertion_sort(s, pivot_pos + 1, end)) {
+            return;
+        }
+
+        pdq_loop(s, begin, pivot_pos, bad_allowed, leftmost);
+        begin = pivot_pos + 1;
+        leftmost = false;
+    }
+}
+
+static void pdqsort(SortItem* items, int count, ItemLess less, void* ctx) {
+    if (count < 2) return;
+    int log2 = 0;
+    for (int n = count; n > 1; n >>= 1) log2++;
+    Sorter s = {items, less, ctx};
+    pdq_loop(&s, 0, count, log2, true);
+}
+
+// ---- strings ----
+
+// The first 8 bytes as a big-endian integer, zero padded, so most string
+// comparisons are decided by one integer compare.
+static uint64_t str_prefix(const ObjString* str) {
+    uint64_t key = 0;
+    int n = str->length < 8 ? str->length : 8;
+    for (int i = 0; i < n; i++) key |= (uint64_t)(unsigned char)str->chars[i] << (56 - 8 * i);
+    return key;
+}
+
+static bool str_less(void* ctx, const SortItem* a, const SortItem* b) {
+    (void)ctx;
+    if (a->key != b->key) return a->key < b->key;
+    const ObjString* x = (const ObjString*)a->value.as.obj;
+    const ObjString* y = (const ObjString*)b->value.as.obj;
+    int n = x->length < y->length ? x->length : y->length;
+    if (n > 8) {
+        int c = memcmp(x->chars + 8, y->chars + 8, n - 8);
+        if (c != 0) return c < 0;
+    }
+    return x->length < y->length;
+}
+
+void sort_strs(Value* items, int count) {
+    if (count < 2) return;
+    SortItem* tmp = malloc(sizeof(SortItem) * count);
+    for (int i = 0; i < count; i++) {
+        tmp[i].key = str_prefix((const ObjString*)items[i].as.obj);
+        tmp[i].value = items[i];
+    }
+    pdqsort(tmp, count, str_less, NULL);
+    for (int i = 0; i < count; i++) items[i] = tmp[i].value;
+    free(tmp);
+}
+
+// ---- callback comparator ----
+
+typedef struct {
+    SortLess less;
+    void* ctx;
+} ValueLess;
+
+static bool value_less(void* ctx, const SortItem* a, const SortItem* b) {
+    ValueLess* vl = (ValueLess*)ctx;
+    return vl->less(vl->ctx, &a->value, &b->value);
+}
+
+void sort_values(Value* items, int count, SortLess less, void* ctx) {
+    if (count < 2) return;
+    SortItem* tmp = malloc(sizeof(SortItem) * count);
+    for (int i = 0; i < count; i++) {
+        tmp[i].key = 0;
+        tmp[i].value = items[i];
+    }
+    ValueLess vl = {less, ctx};
+    pdqsort(tmp, count, value_less, &vl);
+    for (int i = 0; i < count; i++) items[i] = tmp[i].value;
+    free(tmp);
+}
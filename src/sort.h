@@ -0,0 +1,17 @@
+#ifndef OPO_SORT_H
+#define OPO_SORT_H
+
+#include <stdbool.h>
+#include "common.h"
+
+// In-place sorts over Value arrays. The typed sorts require every element to
+// hold the named kind; sort_values orders arbitrary values with a callback.
+
+typedef bool (*SortLess)(void* ctx, const Value* a, const Value* b);
+
+void sort_ints(Value* items, int count);
+void sort_flts(Value* items, int count);
+void sort_strs(Value* items, int count);
+void sort_values(Value* items, int count, SortLess less, void* ctx);
+
+#endif
@@ -13,13 +13,26 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <signal.h>
 #include <dlfcn.h>
 #include <ffi.h>
 #include "vm.h"
+#include "simd.h"
+#include "sort.h"
+#include "numconv.h"
+#include "input.h"
+#include "http.h"
+#include "client.h"
 
 void retain(Value val) {
     int kind = TYPE_KIND(val.type);
-    if ((kind == VAL_OBJ || kind == VAL_MAP || kind == VAL_ENUM || kind == VAL_CHAN ||
+    if ((kind == VAL_OBJ || kind == VAL_MAP || kind == VAL_ENUM || kind == VAL_CHAN || kind == VAL_HANDLE ||
          (kind >= VAL_FUNC && kind <= VAL_FUNC_VOID)) && val.as.obj != NULL) {
         atomic_fetch_add(&val.as.obj->ref_count, 1);
     }
@@ -27,21 +40,75 @@ void retain(Value val) {
 
 void release(Value val);
 static void runtime_error(VM* vm, const char* format, ...);
+static int writer_close(struct ObjFileWriter* writer);
+static Value vm_call_value(VM* vm, Value callable, int arg_count, Value* args);
+static char* type_to_string(Type t, char* buf);
+
+// Orders an owner retiring a buffer against its last view, possibly on
+// another thread, going away and freeing what was retired.
+static pthread_mutex_t retire_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_buffers(ArrayBuffer* buf) {
+    while (buf != NULL) {
+        ArrayBuffer* next = buf->next;
+        for (int i = 0; i < buf->count; i++) release(buf->items[i]);
+        free(buf->items);
+        free(buf);
+        buf = next;
+    }
+}
+
+// Drops a view's claim on its owner. The items pointer is left dangling and
+// must be replaced or discarded by the caller.
+static void array_detach_view(ObjArray* view) {
+    ObjArray* owner = view->owner;
+    view->owner = NULL;
+    if (atomic_fetch_sub(&owner->view_count, 1) == 1) {
+        // The owner may have made a new view since; its buffers stay then.
+        ArrayBuffer* retired = NULL;
+        pthread_mutex_lock(&retire_lock);
+        if (owner->view_count == 0) {
+            retired = owner->retired;
+            owner->retired = NULL;
+        }
+        pthread_mutex_unlock(&retire_lock);
+        free_buffers(retired);
+    }
+    release((Value){VAL_OBJ, {.obj = (HeapObject*)owner}});
+}
+
+// Whether chars, read from a view, point into its owner rather than at
+// the copy string_cstr gave the view.
+static bool string_in_owner(ObjString* view, const char* chars) {
+    ObjString* owner = view->owner;
+    return (uintptr_t)chars >= (uintptr_t)owner->chars &&
+           (uintptr_t)chars <= (uintptr_t)(owner->chars + owner->length);
+}
 
 static void free_object(HeapObject* obj) {
     switch (obj->type) {
         case OBJ_STRING: {
             ObjString* string = (ObjString*)obj;
-            free(string->chars);
+            if (string->owner != NULL) {
+                if (!string_in_owner(string, string->chars)) free(string->chars);
+                release((Value){VAL_OBJ, {.obj = (HeapObject*)string->owner}});
+            } else if (string->mapped) munmap(string->chars, string->length);
+            else if (string->chars != string->inline_chars) free(string->chars);
             free(string);
             break;
         }
         case OBJ_ARRAY: {
             ObjArray* array = (ObjArray*)obj;
+            if (array->owner != NULL) {
+                array_detach_view(array);
+                free(array);
+                break;
+            }
             for (int i = 0; i < array->count; i++) {
                 release(array->items[i]);
             }
             free(array->items);
+            free_buffers(array->retired); // no views are left to use them
             free(array);
             break;
         }
@@ -68,6 +135,7 @@ static void free_object(HeapObject* obj) {
                     release(map->entries[i].value);
                 }
             }
+            if (map->pending != NULL) release((Value){VAL_OBJ, {.obj = (HeapObject*)map->pending}});
             free(map->entries);
             free(map);
             break;
@@ -103,12 +171,45 @@ static void free_object(HeapObject* obj) {
             free(closure);
             break;
         }
+        case OBJ_STRBUF: {
+            ObjStrBuf* buf = (ObjStrBuf*)obj;
+            free(buf->sb.data);
+            free(buf);
+            break;
+        }
+        case OBJ_FILEREADER: {
+            ObjFileReader* reader = (ObjFileReader*)obj;
+            input_free(&reader->in);
+            if (reader->in.fd >= 0) close(reader->in.fd);
+            free(reader);
+            break;
+        }
+        case OBJ_FILEWRITER: {
+            ObjFileWriter* writer = (ObjFileWriter*)obj;
+            writer_close(writer);
+            pthread_mutex_destroy(&writer->lock);
+            free(writer);
+            break;
+        }
+        case OBJ_ROUTER: {
+            ObjRouter* router = (ObjRouter*)obj;
+            router_free(router->router);
+            free(router->keys);
+            free(router);
+            break;
+        }
+        case OBJ_NETBUF: {
+            ObjNetBuf* buf = (ObjNetBuf*)obj;
+            release((Value){VAL_OBJ, {.obj = (HeapObject*)buf->data}});
+            free(buf);
+            break;
+        }
     }
 }
 
 void release(Value val) {
     int kind = TYPE_KIND(val.type);
-    if ((kind == VAL_OBJ || kind == VAL_MAP || kind == VAL_ENUM || kind == VAL_CHAN ||
+    if ((kind == VAL_OBJ || kind == VAL_MAP || kind == VAL_ENUM || kind == VAL_CHAN || kind == VAL_HANDLE ||
          (kind >= VAL_FUNC && kind <= VAL_FUNC_VOID)) && val.as.obj != NULL) {
         if (atomic_fetch_sub(&val.as.obj->ref_count, 1) == 1) {
             free_object(val.as.obj);
@@ -127,20 +228,200 @@ static ObjClosure* allocate_closure(VM* vm, int64_t addr, Type fn_type, int capt
     return closure;
 }
 
-ObjString* allocate_string(VM* vm, const char* chars, int length) {
+ObjString* allocate_string(VM* vm, const char* chars, int64_t length) {
     (void)vm;
-    ObjString* string = malloc(sizeof(ObjString));
+    ObjString* string;
+    if (length <= STRING_INLINE_MAX) {
+        // Always reserve the full inline area; malloc rounds the block up to
+        // about that size anyway, and it leaves room for in-place appends.
+        string = malloc(sizeof(ObjString) + STRING_INLINE_MAX + 1);
+        string->chars = string->inline_chars;
+        string->capacity = STRING_INLINE_MAX;
+    } else {
+        string = malloc(sizeof(ObjString));
+        string->chars = malloc(length + 1);
+        string->capacity = length;
+    }
     string->obj.type = OBJ_STRING;
     string->obj.ref_count = 0;
-    string->chars = malloc(length + 1);
     if (chars != NULL) {
         memcpy(string->chars, chars, length);
     }
     string->chars[length] = '\0';
     string->length = length;
+    string->owner = NULL;
+    string->hash = 0;
+    string->interned = false;
+    string->mapped = false;
+    return string;
+}
+
+static uint32_t hash_bytes(const char* chars, int64_t length) {
+    uint32_t hash = 2166136261u;
+    for (int64_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+// Interned strings live in a process-wide set split into shards, each with
+// its own lock, so goroutines interning different strings rarely contend.
+// Entries are never removed; only bounded sets (literals and fixed keys the
+// runtime produces) should be interned, never arbitrary input.
+#define INTERN_SHARDS 64
+
+typedef struct {
+    pthread_mutex_t lock;
+    ObjString** slots;
+    int count;
+    int capacity;
+} InternShard;
+
+static InternShard intern_shards[INTERN_SHARDS];
+static ObjString* byte_strings[256];
+static pthread_once_t string_tables_once = PTHREAD_ONCE_INIT;
+
+static ObjString* make_interned(const char* chars, int64_t length, uint32_t hash) {
+    ObjString* s = allocate_string(NULL, chars, length);
+    s->obj.ref_count = 1; // held by the table, never released
+    s->hash = hash;
+    s->interned = true;
+    return s;
+}
+
+static void init_string_tables(void) {
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        pthread_mutex_init(&intern_shards[i].lock, NULL);
+    }
+    for (int i = 0; i < 256; i++) {
+        char c = (char)i;
+        byte_strings[i] = make_interned(&c, 1, hash_bytes(&c, 1));
+    }
+}
+
+// Shared, immortal one-byte strings, so character access does not allocate.
+// Callers must not write to the result.
+static ObjString* byte_string(uint8_t c) {
+    pthread_once(&string_tables_once, init_string_tables);
+    return byte_strings[c];
+}
+
+static void intern_shard_grow(InternShard* shard) {
+    int capacity = shard->capacity < 16 ? 16 : shard->capacity * 2;
+    ObjString** slots = calloc(capacity, sizeof(ObjString*));
+    for (int i = 0; i < shard->capacity; i++) {
+        ObjString* s = shard->slots[i];
+        if (s == NULL) continue;
+        int index = (s->hash >> 6) & (capacity - 1);
+        while (slots[index] != NULL) index = (index + 1) & (capacity - 1);
+        slots[index] = s;
+    }
+    free(shard->slots);
+    shard->slots = slots;
+    shard->capacity = capacity;
+}
+
+// The unique interned string with these chars. The low hash bits pick the
+// shard and the rest pick the slot within it.
+ObjString* intern_string(const char* chars, int64_t length) {
+    if (length == 1) return byte_string((uint8_t)chars[0]);
+    pthread_once(&string_tables_once, init_string_tables);
+    uint32_t hash = hash_bytes(chars, length);
+    InternShard* shard = &intern_shards[hash % INTERN_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    if (shard->count + 1 > shard->capacity * 0.7) intern_shard_grow(shard);
+    int index = (hash >> 6) & (shard->capacity - 1);
+    ObjString* s;
+    while ((s = shard->slots[index]) != NULL) {
+        if (s->hash == hash && s->length == length && memcmp(s->chars, chars, length) == 0) {
+            pthread_mutex_unlock(&shard->lock);
+            return s;
+        }
+        index = (index + 1) & (shard->capacity - 1);
+    }
+    s = make_interned(chars, length, hash);
+    shard->slots[index] = s;
+    shard->count++;
+    pthread_mutex_unlock(&shard->lock);
+    return s;
+}
+
+// Wraps a malloc'd buffer of `capacity + 1` bytes holding `length` chars in
+// a string without copying it.
+static ObjString* take_string(VM* vm, char* chars, int64_t length, int64_t capacity) {
+    (void)vm;
+    ObjString* string = malloc(sizeof(ObjString));
+    string->obj.type = OBJ_STRING;
+    string->obj.ref_count = 0;
+    string->chars = chars;
+    string->chars[length] = '\0';
+    string->length = length;
+    string->capacity = capacity;
+    string->owner = NULL;
+    string->hash = 0;
+    string->interned = false;
+    string->mapped = false;
+    return string;
+}
+
+ObjString* allocate_string_view(VM* vm, ObjString* parent, int64_t start, int64_t length) {
+    // Short pieces are cheaper to copy inline than to pin the parent for.
+    if (length == 1) return byte_string((uint8_t)parent->chars[start]);
+    if (length <= STRING_INLINE_MAX) return allocate_string(vm, parent->chars + start, length);
+    char* chars = __atomic_load_n(&parent->chars, __ATOMIC_ACQUIRE);
+    ObjString* owner = parent->owner != NULL && string_in_owner(parent, chars) ? parent->owner : parent;
+    ObjString* string = malloc(sizeof(ObjString));
+    string->obj.type = OBJ_STRING;
+    string->obj.ref_count = 0;
+    string->chars = chars + start;
+    string->length = length;
+    string->capacity = length;
+    string->owner = owner;
+    string->hash = 0;
+    string->interned = false;
+    string->mapped = false;
+    retain((Value){VAL_OBJ, {.obj = (HeapObject*)owner}});
     return string;
 }
 
+// The view may be reachable from several threads, so its copy is published
+// with a compare-and-swap, and the owner stays pinned until the view is
+// freed: another thread may still be reading the chars it had before.
+const char* string_cstr(ObjString* string) {
+    char* chars = __atomic_load_n(&string->chars, __ATOMIC_ACQUIRE);
+    if (string->owner == NULL || !string_in_owner(string, chars)) return chars;
+    char* copy = malloc(string->length + 1);
+    memcpy(copy, chars, string->length);
+    copy[string->length] = '\0';
+    if (!__atomic_compare_exchange_n(&string->chars, &chars, copy, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(copy); // another thread's copy won; chars now holds it
+        return chars;
+    }
+    return copy;
+}
+
+// Appends to a string that owns its buffer, growing it geometrically. Only
+// valid when nothing else can observe the string.
+static void string_append_in_place(ObjString* string, const char* chars, int64_t length) {
+    int64_t needed = string->length + length;
+    if (needed > string->capacity) {
+        int64_t capacity = string->capacity < 16 ? 16 : string->capacity * 2;
+        if (capacity < needed) capacity = needed;
+        if (string->chars == string->inline_chars) {
+            char* chars = malloc(capacity + 1);
+            memcpy(chars, string->chars, string->length);
+            string->chars = chars;
+        } else {
+            string->chars = realloc(string->chars, capacity + 1);
+        }
+        string->capacity = capacity;
+    }
+    memcpy(string->chars + string->length, chars, length);
+    string->length = needed;
+    string->chars[needed] = '\0';
+}
+
 ObjArray* allocate_array(VM* vm) {
     (void)vm;
     ObjArray* array = malloc(sizeof(ObjArray));
@@ -149,9 +430,63 @@ ObjArray* allocate_array(VM* vm) {
     array->items = NULL;
     array->count = 0;
     array->capacity = 0;
+    array->owner = NULL;
+    array->view_count = 0;
+    array->items_shared = false;
+    array->retired = NULL;
     return array;
 }
 
+// A view of array[lo..hi) that shares the parent's items. Views of views
+// point at the original owner.
+static ObjArray* allocate_array_view(VM* vm, ObjArray* parent, int lo, int hi) {
+    ObjArray* view = allocate_array(vm);
+    ObjArray* owner = parent->owner != NULL ? parent->owner : parent;
+    retain((Value){VAL_OBJ, {.obj = (HeapObject*)owner}});
+    atomic_fetch_add(&owner->view_count, 1);
+    owner->items_shared = true;
+    view->owner = owner;
+    view->items = parent->items + lo;
+    view->count = hi - lo;
+    return view;
+}
+
+// Gives the array a buffer of its own before it is mutated. A view copies
+// its range out of the owner; an owner whose buffer is shared with live
+// views retires that buffer to them and continues on a copy.
+static void array_make_unique(ObjArray* array) {
+    if (array->owner == NULL && (!array->items_shared || array->view_count == 0)) {
+        array->items_shared = false;
+        return;
+    }
+    int count = array->count;
+    int capacity = count > array->capacity ? count : array->capacity;
+    Value* items = malloc(sizeof(Value) * (capacity > 0 ? capacity : 1));
+    for (int i = 0; i < count; i++) {
+        items[i] = array->items[i];
+        retain(items[i]);
+    }
+    if (array->owner != NULL) {
+        array_detach_view(array);
+    } else {
+        ArrayBuffer* buf = malloc(sizeof(ArrayBuffer));
+        buf->items = array->items;
+        buf->count = count;
+        buf->next = NULL;
+        pthread_mutex_lock(&retire_lock);
+        if (array->view_count > 0) {
+            buf->next = array->retired;
+            array->retired = buf;
+            buf = NULL;
+        }
+        pthread_mutex_unlock(&retire_lock);
+        free_buffers(buf); // the last view went away meanwhile
+        array->items_shared = false;
+    }
+    array->items = items;
+    array->capacity = capacity;
+}
+
 ObjMap* allocate_map(VM* vm) {
     (void)vm;
     ObjMap* map = malloc(sizeof(ObjMap));
@@ -160,6 +495,7 @@ ObjMap* allocate_map(VM* vm) {
     map->capacity = 8;
     map->count = 0;
     map->entries = calloc(map->capacity, sizeof(MapEntry));
+    map->pending = NULL;
     return map;
 }
 
@@ -186,16 +522,9 @@ ObjChan* allocate_chan(VM* vm, int capacity) {
 static uint32_t hash_value(VM* vm, Value v) {
     switch (TYPE_KIND(v.type)) {
         case VAL_INT: return (uint32_t)v.as.i_val;
-        case VAL_STR: {
+        case VAL_STR:
             if (vm == NULL) return 0;
-            const char* s = vm->strings[v.as.s_idx];
-            uint32_t hash = 2166136261u;
-            while (*s) {
-                hash ^= (uint8_t)*s++;
-                hash *= 16777619;
-            }
-            return hash;
-        }
+            return hash_bytes(vm->strings[v.as.s_idx], vm->string_lengths[v.as.s_idx]);
         case VAL_FLT: {
             union { double d; uint32_t u[2]; } conv;
             conv.d = v.as.f_val;
@@ -205,12 +534,7 @@ static uint32_t hash_value(VM* vm, Value v) {
         case VAL_OBJ:
             if (v.as.obj != NULL && v.as.obj->type == OBJ_STRING) {
                 ObjString* s = (ObjString*)v.as.obj;
-                uint32_t hash = 2166136261u;
-                for (int i = 0; i < s->length; i++) {
-                    hash ^= (uint8_t)s->chars[i];
-                    hash *= 16777619;
-                }
-                return hash;
+                return s->interned ? s->hash : hash_bytes(s->chars, s->length);
             }
             return (uint32_t)(uintptr_t)v.as.obj;
         default: return 0;
@@ -252,15 +576,34 @@ static Value wrap_err(VM* vm, const char* msg, Type inner_type) {
 static const char* get_string_ptr(VM* vm, Value v) {
     if (TYPE_KIND(v.type) == VAL_STR && vm != NULL) return vm->strings[v.as.s_idx];
     if (TYPE_KIND(v.type) == VAL_OBJ && v.as.obj != NULL && v.as.obj->type == OBJ_STRING) 
+        return string_cstr((ObjString*)v.as.obj);
+    return NULL;
+}
+
+// Chars and length of a string value without forcing views into C strings.
+static const char* get_string_chars(VM* vm, Value v, int64_t* length) {
+    if (TYPE_KIND(v.type) == VAL_STR && vm != NULL) {
+        *length = vm->string_lengths[v.as.s_idx];
+        return vm->strings[v.as.s_idx];
+    }
+    if (TYPE_KIND(v.type) == VAL_OBJ && v.as.obj != NULL && v.as.obj->type == OBJ_STRING) {
+        *length = ((ObjString*)v.as.obj)->length;
         return ((ObjString*)v.as.obj)->chars;
+    }
+    *length = 0;
     return NULL;
 }
 
 static bool values_equal(VM* vm, Value a, Value b) {
     if (is_string(a) && is_string(b)) {
-        const char* sa = get_string_ptr(vm, a);
-        const char* sb = get_string_ptr(vm, b);
-        if (sa != NULL && sb != NULL) return strcmp(sa, sb) == 0;
+        if (TYPE_KIND(a.type) == VAL_OBJ && TYPE_KIND(b.type) == VAL_OBJ) {
+            if (a.as.obj == b.as.obj) return true;
+            if (((ObjString*)a.as.obj)->interned && ((ObjString*)b.as.obj)->interned) return false;
+        }
+        int64_t la, lb;
+        const char* sa = get_string_chars(vm, a, &la);
+        const char* sb = get_string_chars(vm, b, &lb);
+        if (sa != NULL && sb != NULL) return la == lb && memcmp(sa, sb, la) == 0;
         return false;
     }
     if (TYPE_KIND(a.type) != TYPE_KIND(b.type)) return false;
@@ -274,7 +617,10 @@ static bool values_equal(VM* vm, Value a, Value b) {
     }
 }
 
+static void map_fill(VM* vm, ObjMap* map);
+
 static void map_set(VM* vm, ObjMap* map, Value key, Value value) {
+    if (map->pending != NULL) map_fill(vm, map);
     if (map->capacity == 0) {
         map->capacity = 8;
         map->entries = calloc(map->capacity, sizeof(MapEntry));
@@ -317,6 +663,7 @@ static void map_set(VM* vm, ObjMap* map, Value key, Value value) {
 
 static Value map_get(VM* vm, ObjMap* map, Value key) {
     if (map == NULL) return (Value){VAL_VOID, {0}};
+    if (map->pending != NULL) map_fill(vm, map);
     if (map->capacity == 0) return (Value){VAL_VOID, {0}};
     uint32_t hash = hash_value(vm, key);
     int index = hash % map->capacity;
@@ -329,16 +676,43 @@ static Value map_get(VM* vm, ObjMap* map, Value key) {
     return (Value){VAL_VOID, {0}};
 }
 
+// Turns the header lines of a map built by httpParse or httpServe into its
+// entries, as views of the lines.
+static void map_fill(VM* vm, ObjMap* map) {
+    ObjString* lines = map->pending;
+    map->pending = NULL;
+    HttpSlice names[HTTP_MAX_HEADERS];
+    HttpSlice values[HTTP_MAX_HEADERS];
+    int count = http_parse_headers(lines->chars, lines->length, names, values, HTTP_MAX_HEADERS);
+    for (int i = 0; i < count; i++) {
+        ObjString* name = allocate_string_view(vm, lines, names[i].chars - lines->chars, names[i].length);
+        ObjString* value = allocate_string_view(vm, lines, values[i].chars - lines->chars, values[i].length);
+        map_set(vm, map, (Value){VAL_OBJ, {.obj = (HeapObject*)name}}, (Value){VAL_OBJ, {.obj = (HeapObject*)value}});
+    }
+    release((Value){VAL_OBJ, {.obj = (HeapObject*)lines}});
+}
+
 static Value native_len(VM* vm, int arg_count, Value* args) {
     if (arg_count != 1) return (Value){VAL_VOID, {0}};
     Value obj = args[0];
     if (TYPE_KIND(obj.type) == VAL_STR) {
-        return (Value){VAL_INT, {.i_val = (int64_t)strlen(vm->strings[obj.as.s_idx])}};
+        return (Value){VAL_INT, {.i_val = vm->string_lengths[obj.as.s_idx]}};
     }
     if (TYPE_KIND(obj.type) == VAL_OBJ || TYPE_KIND(obj.type) == VAL_MAP) {
         if (obj.as.obj->type == OBJ_STRING) return (Value){VAL_INT, {.i_val = ((ObjString*)obj.as.obj)->length}};
         if (obj.as.obj->type == OBJ_ARRAY) return (Value){VAL_INT, {.i_val = ((ObjArray*)obj.as.obj)->count}};
-        if (obj.as.obj->type == OBJ_MAP) return (Value){VAL_INT, {.i_val = ((ObjMap*)obj.as.obj)->count}};
+        if (obj.as.obj->type == OBJ_MAP) {
+            ObjMap* map = (ObjMap*)obj.as.obj;
+            if (map->pending != NULL) map_fill(vm, map);
+            return (Value){VAL_INT, {.i_val = map->count}};
+        }
+    }
+    if (TYPE_KIND(obj.type) == VAL_HANDLE && obj.as.obj->type == OBJ_STRBUF) {
+        return (Value){VAL_INT, {.i_val = ((ObjStrBuf*)obj.as.obj)->sb.length}};
+    }
+    if (TYPE_KIND(obj.type) == VAL_HANDLE && obj.as.obj->type == OBJ_NETBUF) {
+        ObjNetBuf* buf = (ObjNetBuf*)obj.as.obj;
+        return (Value){VAL_INT, {.i_val = buf->data->length - buf->start}};
     }
     return (Value){VAL_INT, {.i_val = 0}};
 }
@@ -350,6 +724,7 @@ static Value native_append(VM* vm, int arg_count, Value* args) {
     Value val = args[1];
     if (TYPE_KIND(obj.type) == VAL_OBJ && obj.as.obj->type == OBJ_ARRAY) {
         ObjArray* array = (ObjArray*)obj.as.obj;
+        array_make_unique(array);
         if (array->count >= array->capacity) {
             array->capacity = array->capacity < 8 ? 8 : array->capacity * 2;
             array->items = realloc(array->items, sizeof(Value) * array->capacity);
@@ -360,114 +735,277 @@ static Value native_append(VM* vm, int arg_count, Value* args) {
     return obj;
 }
 
-static Value native_str(VM* vm, int arg_count, Value* args) {
-    if (arg_count != 1) {
-        runtime_error(vm, "str() expects 1 argument, got %d", arg_count);
-        return (Value){VAL_VOID, {0}};
+static void sb_init(StringBuilder* sb) {
+    sb->capacity = 1024;
+    sb->data = malloc(sb->capacity);
+    sb->length = 0;
+    sb->data[0] = '\0';
+}
+
+static void sb_append(StringBuilder* sb, const char* str, int64_t len) {
+    if (sb->length + len + 1 >= sb->capacity) {
+        if (sb->capacity == 0) sb->capacity = 64;
+        while (sb->length + len + 1 >= sb->capacity) sb->capacity *= 2;
+        sb->data = realloc(sb->data, sb->capacity);
     }
-    Value val = args[0];
-    char buf[1024]; // Larger buffer for collections
-    if (TYPE_KIND(val.type) == VAL_INT) sprintf(buf, "%ld", val.as.i_val);
-    else if (TYPE_KIND(val.type) == VAL_FLT) sprintf(buf, "%g", val.as.f_val);
-    else if (TYPE_KIND(val.type) == VAL_BOOL) sprintf(buf, "%s", val.as.b_val ? "tru" : "fls");
-    else if (TYPE_KIND(val.type) == VAL_VOID) strcpy(buf, "void");
-    else if (TYPE_KIND(val.type) == VAL_STR) {
-        ObjString* s = allocate_string(vm, vm->strings[val.as.s_idx], (int)strlen(vm->strings[val.as.s_idx]));
-        return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
-    }
-    else if (TYPE_KIND(val.type) == VAL_OBJ && val.as.obj->type == OBJ_STRING) {
-        retain(val);
-        return val;
+    memcpy(sb->data + sb->length, str, len);
+    sb->length += len;
+    sb->data[sb->length] = '\0';
+}
+
+static void sb_append_cstr(StringBuilder* sb, const char* str) {
+    sb_append(sb, str, (int64_t)strlen(str));
+}
+
+// Appends the str() form of a value. Collections format straight into the
+// builder, so there is no limit on how large they can be.
+static void format_value(VM* vm, Value val, StringBuilder* sb) {
+    char buf[NUM_BUF_SIZE + 64];
+    int kind = TYPE_KIND(val.type);
+    if (kind == VAL_INT) sb_append(sb, buf, fmt_int(buf, val.as.i_val));
+    else if (kind == VAL_FLT) sb_append(sb, buf, fmt_flt(buf, val.as.f_val));
+    else if (kind == VAL_BOOL) sb_append_cstr(sb, val.as.b_val ? "tru" : "fls");
+    else if (kind == VAL_VOID) sb_append_cstr(sb, "void");
+    else if (is_string(val)) {
+        int64_t len;
+        const char* chars = get_string_chars(vm, val, &len);
+        sb_append(sb, chars, len);
     }
-    else if (TYPE_KIND(val.type) == VAL_OBJ && val.as.obj->type == OBJ_ARRAY) {
+    else if (kind == VAL_OBJ && val.as.obj->type == OBJ_ARRAY) {
         ObjArray* array = (ObjArray*)val.as.obj;
-        strcpy(buf, "[");
+        sb_append(sb, "[", 1);
         for (int i = 0; i < array->count; i++) {
-            Value s = native_str(vm, 1, &array->items[i]);
-            strcat(buf, ((ObjString*)s.as.obj)->chars);
-            if (i < array->count - 1) strcat(buf, ", ");
-            release(s);
+            if (i > 0) sb_append(sb, ", ", 2);
+            format_value(vm, array->items[i], sb);
         }
-        strcat(buf, "]");
+        sb_append(sb, "]", 1);
     }
-    else if ((TYPE_KIND(val.type) == VAL_OBJ || TYPE_KIND(val.type) == VAL_MAP) && val.as.obj->type == OBJ_MAP) {
+    else if ((kind == VAL_OBJ || kind == VAL_MAP) && val.as.obj->type == OBJ_MAP) {
         ObjMap* map = (ObjMap*)val.as.obj;
-        strcpy(buf, "{");
+        if (map->pending != NULL) map_fill(vm, map);
+        sb_append(sb, "{", 1);
         bool first = true;
         for (int i = 0; i < map->capacity; i++) {
             if (map->entries[i].is_used) {
-                if (!first) strcat(buf, ", ");
-                Value sk = native_str(vm, 1, &map->entries[i].key);
-                Value sv = native_str(vm, 1, &map->entries[i].value);
-                strcat(buf, ((ObjString*)sk.as.obj)->chars);
-                strcat(buf, " => ");
-                strcat(buf, ((ObjString*)sv.as.obj)->chars);
-                release(sk); release(sv);
+                if (!first) sb_append(sb, ", ", 2);
+                format_value(vm, map->entries[i].key, sb);
+                sb_append(sb, " => ", 4);
+                format_value(vm, map->entries[i].value, sb);
                 first = false;
             }
         }
-        strcat(buf, "}");
+        sb_append(sb, "}", 1);
+    }
+    else if (kind == VAL_ERR) {
+        sb_append_cstr(sb, "Error: ");
+        format_value(vm, (Value){VAL_OBJ, val.as}, sb);
     }
-    else if (TYPE_KIND(val.type) == VAL_ERR) {
-        Value inner = {VAL_OBJ, val.as};
-        Value s = native_str(vm, 1, &inner);
-        sprintf(buf, "Error: %s", ((ObjString*)s.as.obj)->chars);
-        release(s);
+    else if (kind == VAL_CHAN) {
+        sb_append(sb, buf, sprintf(buf, "<chan:%p>", (void*)val.as.obj));
     }
-    else if (TYPE_KIND(val.type) == VAL_CHAN) {
-        sprintf(buf, "<chan:%p>", val.as.obj);
+    else if (kind == VAL_HANDLE) {
+        char type_buf[64];
+        sb_append(sb, buf, sprintf(buf, "<%s:%p>", type_to_string(val.type, type_buf), (void*)val.as.obj));
     }
-    else if (TYPE_KIND(val.type) == VAL_ENUM) {
+    else if (kind == VAL_ENUM) {
         ObjEnum* en = (ObjEnum*)val.as.obj;
         if (TYPE_SUB(val.type) == OPTION_ENUM_ID) {
-            if (en->variant_index == 0) strcpy(buf, "none");
+            if (en->variant_index == 0) sb_append_cstr(sb, "none");
             else {
-                Value s = native_str(vm, 1, &en->payload);
-                sprintf(buf, "some(%s)", ((ObjString*)s.as.obj)->chars);
-                release(s);
+                sb_append_cstr(sb, "some(");
+                format_value(vm, en->payload, sb);
+                sb_append(sb, ")", 1);
             }
+        } else if (en->has_payload) {
+            sb_append_cstr(sb, "enum.variant(");
+            format_value(vm, en->payload, sb);
+            sb_append(sb, ")", 1);
         } else {
-            if (en->has_payload) {
-                Value s = native_str(vm, 1, &en->payload);
-                sprintf(buf, "enum.variant(%s)", ((ObjString*)s.as.obj)->chars);
-                release(s);
-            } else {
-                sprintf(buf, "enum.variant");
-            }
+            sb_append_cstr(sb, "enum.variant");
         }
     }
-    else sprintf(buf, "<obj>");
-    
-    ObjString* s = allocate_string(vm, buf, (int)strlen(buf));
+    else sb_append_cstr(sb, "<obj>");
+}
+
+static Value native_str(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 1) {
+        runtime_error(vm, "str() expects 1 argument, got %d", arg_count);
+        return (Value){VAL_VOID, {0}};
+    }
+    Value val = args[0];
+    if (TYPE_KIND(val.type) == VAL_OBJ && val.as.obj->type == OBJ_STRING) {
+        retain(val);
+        return val;
+    }
+    char buf[NUM_BUF_SIZE];
+    if (TYPE_KIND(val.type) == VAL_INT) {
+        return (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, buf, fmt_int(buf, val.as.i_val))}};
+    }
+    if (TYPE_KIND(val.type) == VAL_FLT) {
+        return (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, buf, fmt_flt(buf, val.as.f_val))}};
+    }
+    StringBuilder sb = {NULL, 0, 0};
+    format_value(vm, val, &sb);
+    ObjString* s = sb.data == NULL ? allocate_string(vm, "", 0) : take_string(vm, sb.data, sb.length, sb.capacity - 1);
     return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
 }
 
+// Sockets are nonblocking. When one would block in a goroutine, the
+// goroutine parks and the native runs again once the netpoller is through
+// with it. net_submit hands the whole operation over, when the backend can
+// take it, and the native picks up its outcome with net_done. net_block only
+// waits until fd is ready; off a goroutine it waits in poll() and returns
+// false for the native to retry at once. Both return true when parked, and
+// the native's result is then discarded.
+static bool net_submit(VM* vm, int op, int fd, void* buf, uint64_t len, int64_t offset) {
+    if (!vm->can_park || !netpoll_uring()) return false;
+    vm->io = (NetpollOp){ .op = op, .fd = fd, .buf = buf, .len = len, .offset = offset,
+                          .events = (op == NETPOLL_SEND || op == NETPOLL_WRITE) ? EPOLLOUT : EPOLLIN };
+    vm->parked = true;
+    return true;
+}
+
+static bool net_done(VM* vm, int64_t* result) {
+    if (!vm->io_done) return false;
+    vm->io_done = false;
+    *result = vm->io.result;
+    return true;
+}
+
+static bool net_block(VM* vm, int fd, uint32_t events) {
+    if (vm->can_park) {
+        vm->io = (NetpollOp){ .op = NETPOLL_POLL, .fd = fd, .events = events };
+        vm->parked = true;
+        return true;
+    }
+    struct pollfd p = { fd, (short)(((events & EPOLLIN) ? POLLIN : 0) | ((events & EPOLLOUT) ? POLLOUT : 0)), 0 };
+    poll(&p, 1, -1);
+    return false;
+}
+
+// Large files read or written in a goroutine go through the netpoller, which
+// frees the thread while the disk works.
+#define ASYNC_FILE_MIN (64 * 1024)
+
 static Value native_readFile(VM* vm, int arg_count, Value* args) {
     if (arg_count != 1 || !is_string(args[0])) return wrap_err(vm, "Invalid argument to readFile", VAL_STR);
-    const char* path = get_string_ptr(vm, args[0]);
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) return wrap_err(vm, strerror(errno), VAL_STR);
-    fseek(file, 0L, SEEK_END);
-    long size = ftell(file);
-    rewind(file);
-    char* buffer = malloc(size + 1);
-    size_t bytes = fread(buffer, 1, size, file);
-    (void)bytes;
-    buffer[size] = '\0';
-    fclose(file);
-    ObjString* s = allocate_string(vm, buffer, (int)size);
-    free(buffer);
+    int64_t done;
+    char* buffer;
+    int fd;
+    int64_t size, got;
+    if (net_done(vm, &done)) {
+        fd = vm->io.fd;
+        got = vm->io.offset;
+        size = got + (int64_t)vm->io.len;
+        buffer = (char*)vm->io.buf - got;
+        if (done < 0) {
+            close(fd);
+            free(buffer);
+            return wrap_err(vm, strerror((int)-done), VAL_STR);
+        }
+        got += done;
+        if (done > 0 && got < size && net_submit(vm, NETPOLL_READ, fd, buffer + got, size - got, got)) {
+            return (Value){VAL_VOID, {0}};
+        }
+    } else {
+        fd = open(get_string_ptr(vm, args[0]), O_RDONLY);
+        if (fd < 0) return wrap_err(vm, strerror(errno), VAL_STR);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            int err = errno;
+            close(fd);
+            return wrap_err(vm, strerror(err), VAL_STR);
+        }
+        size = st.st_size;
+        buffer = malloc(size + 1);
+        if (size >= ASYNC_FILE_MIN && net_submit(vm, NETPOLL_READ, fd, buffer, size, 0)) {
+            return (Value){VAL_VOID, {0}};
+        }
+        got = 0;
+        while (got < size) {
+            ssize_t n = read(fd, buffer + got, size - got);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += n;
+        }
+    }
+    close(fd);
+    ObjString* s = take_string(vm, buffer, got, size);
     return wrap_ok(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)s}}, VAL_STR);
 }
 
+// A read-only view of the whole file backed by a private mapping. Pages are
+// read on first touch and the mapping goes away with the last view of it.
+static Value native_mmapFile(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 1 || !is_string(args[0])) return wrap_err(vm, "Invalid argument to mmapFile", VAL_STR);
+    int fd = open(get_string_ptr(vm, args[0]), O_RDONLY);
+    if (fd < 0) return wrap_err(vm, strerror(errno), VAL_STR);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return wrap_err(vm, strerror(errno), VAL_STR);
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return wrap_ok(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "", 0)}}, VAL_STR);
+    }
+    char* chars = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int map_errno = errno;
+    close(fd);
+    if (chars == MAP_FAILED) return wrap_err(vm, strerror(map_errno), VAL_STR);
+
+    // The mapping itself is never handed out: a view of it is, so nothing
+    // expects it to be NUL-terminated or appends to it in place.
+    ObjString* mapping = malloc(sizeof(ObjString));
+    mapping->obj.type = OBJ_STRING;
+    mapping->obj.ref_count = 0;
+    mapping->chars = chars;
+    mapping->length = st.st_size;
+    mapping->capacity = st.st_size;
+    mapping->owner = NULL;
+    mapping->hash = 0;
+    mapping->interned = false;
+    mapping->mapped = true;
+    Value mapping_val = (Value){VAL_OBJ, {.obj = (HeapObject*)mapping}};
+    retain(mapping_val);
+    ObjString* view = allocate_string_view(vm, mapping, 0, st.st_size);
+    release(mapping_val);
+    return wrap_ok(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)view}}, VAL_STR);
+}
+
 static Value native_writeFile(VM* vm, int arg_count, Value* args) {
     if (arg_count != 2 || !is_string(args[0]) || !is_string(args[1])) return wrap_err(vm, "Invalid arguments to writeFile", VAL_BOOL);
-    const char* path = get_string_ptr(vm, args[0]);
-    const char* content = get_string_ptr(vm, args[1]);
-    FILE* file = fopen(path, "wb");
-    if (file == NULL) return wrap_err(vm, strerror(errno), VAL_BOOL);
-    fwrite(content, 1, strlen(content), file);
-    fclose(file);
+    int64_t len;
+    const char* content = get_string_chars(vm, args[1], &len);
+    int64_t done;
+    int fd;
+    int64_t written;
+    if (net_done(vm, &done)) {
+        fd = vm->io.fd;
+        if (done < 0) {
+            close(fd);
+            return wrap_err(vm, strerror((int)-done), VAL_BOOL);
+        }
+        written = vm->io.offset + done;
+    } else {
+        fd = open(get_string_ptr(vm, args[0]), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) return wrap_err(vm, strerror(errno), VAL_BOOL);
+        written = 0;
+    }
+    if (len - written >= ASYNC_FILE_MIN && net_submit(vm, NETPOLL_WRITE, fd, (void*)(content + written), len - written, written)) {
+        return (Value){VAL_VOID, {0}};
+    }
+    while (written < len) {
+        ssize_t n = write(fd, content + written, len - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            int err = errno;
+            close(fd);
+            return wrap_err(vm, strerror(err), VAL_BOOL);
+        }
+        written += n;
+    }
+    close(fd);
     return wrap_ok(vm, (Value){VAL_BOOL, {.b_val = true}}, VAL_BOOL);
 }
 
@@ -482,7 +1020,7 @@ static Value native_args(VM* vm, int arg_count, Value* args) {
         array->items[i] = (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
         retain(array->items[i]);
     }
-    return (Value){VAL_OBJ, {.obj = (HeapObject*)array}};
+    return (Value){MAKE_TYPE(VAL_OBJ, VAL_STR, 0), {.obj = (HeapObject*)array}};
 }
 
 static Value native_int(VM* vm, int arg_count, Value* args) {
@@ -493,10 +1031,10 @@ static Value native_int(VM* vm, int arg_count, Value* args) {
     if (TYPE_KIND(val.type) == VAL_INT) return wrap_ok(vm, val, VAL_INT);
     if (TYPE_KIND(val.type) == VAL_FLT) return wrap_ok(vm, (Value){VAL_INT, {.i_val = (int64_t)val.as.f_val}}, VAL_INT);
     if (is_string(val)) {
-        char* endptr;
-        const char* str = get_string_ptr(vm, val);
-        int64_t res = strtoll(str, &endptr, 10);
-        if (*str == '\0' || *endptr != '\0') {
+        int64_t len;
+        const char* chars = get_string_chars(vm, val, &len);
+        int64_t res;
+        if (!parse_int(chars, len, &res)) {
             return wrap_err(vm, "Invalid format for int()", VAL_INT);
         }
         return wrap_ok(vm, (Value){VAL_INT, {.i_val = res}}, VAL_INT);
@@ -512,10 +1050,10 @@ static Value native_flt(VM* vm, int arg_count, Value* args) {
     if (TYPE_KIND(val.type) == VAL_FLT) return wrap_ok(vm, val, VAL_FLT);
     if (TYPE_KIND(val.type) == VAL_INT) return wrap_ok(vm, (Value){VAL_FLT, {.f_val = (double)val.as.i_val}}, VAL_FLT);
     if (is_string(val)) {
-        char* endptr;
-        const char* str = get_string_ptr(vm, val);
-        double res = strtod(str, &endptr);
-        if (*str == '\0' || *endptr != '\0') {
+        int64_t len;
+        const char* chars = get_string_chars(vm, val, &len);
+        double res;
+        if (!parse_flt(chars, len, &res)) {
             return wrap_err(vm, "Invalid format for flt()", VAL_FLT);
         }
         return wrap_ok(vm, (Value){VAL_FLT, {.f_val = res}}, VAL_FLT);
@@ -523,36 +1061,74 @@ static Value native_flt(VM* vm, int arg_count, Value* args) {
     return wrap_err(vm, "Cannot convert type to flt", VAL_FLT);
 }
 
-static Value native_print(VM* vm, int arg_count, Value* args) {
-    for (int i = 0; i < arg_count; i++) {
-        Value s = native_str(vm, 1, &args[i]);
-        if ((s.type == VAL_OBJ || s.type == VAL_MAP) && s.as.obj->type == OBJ_STRING) {
-            printf("%s", ((ObjString*)s.as.obj)->chars);
-        }
-        release(s);
+// ---- program output ----
+//
+// Everything Opo code prints is formatted straight into one shared buffer.
+// Unbuffered, the buffer goes to stdout after every print. Buffered, it is
+// written when it fills, before anything else touches the terminal (stdin
+// reads, child processes, error messages) and at exit. One buffer behind a
+// lock keeps goroutines' lines whole and in order, and lets exit flush
+// output from every thread.
+
+#define OUTPUT_FLUSH_AT (64 * 1024)
+
+static StringBuilder output;
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool output_buffered = false;
+
+static void output_flush_locked(void) {
+    if (output.length > 0) {
+        fwrite(output.data, 1, output.length, stdout);
+        output.length = 0;
     }
+    fflush(stdout);
+}
+
+void vm_flush_output(void) {
+    pthread_mutex_lock(&output_lock);
+    output_flush_locked();
+    pthread_mutex_unlock(&output_lock);
+}
+
+void vm_set_buffered_output(bool buffered) {
+    if (buffered && !output_buffered) atexit(vm_flush_output);
+    output_buffered = buffered;
+}
+
+static void output_chars(const char* chars, size_t length) {
+    pthread_mutex_lock(&output_lock);
+    sb_append(&output, chars, length);
+    if (!output_buffered || output.length >= OUTPUT_FLUSH_AT) output_flush_locked();
+    pthread_mutex_unlock(&output_lock);
+}
+
+static void output_values(VM* vm, int count, Value* values, bool newline) {
+    pthread_mutex_lock(&output_lock);
+    for (int i = 0; i < count; i++) format_value(vm, values[i], &output);
+    if (newline) sb_append(&output, "\n", 1);
+    if (!output_buffered || output.length >= OUTPUT_FLUSH_AT) output_flush_locked();
+    pthread_mutex_unlock(&output_lock);
+}
+
+static Value native_print(VM* vm, int arg_count, Value* args) {
+    output_values(vm, arg_count, args, false);
     return (Value){VAL_VOID, {0}};
 }
 
 static Value native_println(VM* vm, int arg_count, Value* args) {
-    native_print(vm, arg_count, args);
-    printf("\n");
+    output_values(vm, arg_count, args, true);
     return (Value){VAL_VOID, {0}};
 }
 
 static Value native_readLine(VM* vm, int arg_count, Value* args) {
     (void)arg_count; (void)args;
-    char buf[1024];
-    if (fgets(buf, sizeof(buf), stdin)) {
-        size_t len = strlen(buf);
-        if (len > 0 && buf[len-1] == '\n') {
-            buf[len-1] = '\0';
-            len--;
-        }
-        ObjString* s = allocate_string(vm, buf, (int)len);
-        return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
-    }
-    return (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "", 0)}};
+    vm_flush_output();
+    input_lock();
+    InputSpan line;
+    ObjString* s = input_line(input_stdin(), &line) ? allocate_string(vm, line.chars, (int64_t)line.length)
+                                     : allocate_string(vm, "", 0);
+    input_unlock();
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
 }
 
 static Value native_exit(VM* vm, int arg_count, Value* args) {
@@ -570,6 +1146,7 @@ static Value native_clock(VM* vm, int arg_count, Value* args) {
 
 static Value native_system(VM* vm, int arg_count, Value* args) {
     if (arg_count != 1 || !is_string(args[0])) return wrap_err(vm, "Invalid argument to system", VAL_INT);
+    vm_flush_output();
     int res = system(get_string_ptr(vm, args[0]));
     if (res == -1) return wrap_err(vm, strerror(errno), VAL_INT);
     return wrap_ok(vm, (Value){VAL_INT, {.i_val = res}}, VAL_INT);
@@ -578,6 +1155,7 @@ static Value native_system(VM* vm, int arg_count, Value* args) {
 static Value native_keys(VM* vm, int arg_count, Value* args) {
     if (arg_count != 1 || (TYPE_KIND(args[0].type) != VAL_OBJ && TYPE_KIND(args[0].type) != VAL_MAP) || args[0].as.obj->type != OBJ_MAP) return (Value){VAL_VOID, {0}};
     ObjMap* map = (ObjMap*)args[0].as.obj;
+    if (map->pending != NULL) map_fill(vm, map);
     ObjArray* array = allocate_array(vm);
     array->items = malloc(sizeof(Value) * map->count);
     array->capacity = map->count;
@@ -596,6 +1174,7 @@ static Value native_delete(VM* vm, int arg_count, Value* args) {
     (void)vm;
     if (arg_count != 2 || (TYPE_KIND(args[0].type) != VAL_OBJ && TYPE_KIND(args[0].type) != VAL_MAP) || args[0].as.obj->type != OBJ_MAP) return (Value){VAL_VOID, {0}};
     ObjMap* map = (ObjMap*)args[0].as.obj;
+    if (map->pending != NULL) map_fill(vm, map);
     Value key = args[1];
     
     if (map->capacity == 0) return (Value){VAL_VOID, {0}};
@@ -649,9 +1228,8 @@ static Value native_ascii(VM* vm, int arg_count, Value* args) {
 
 static Value native_char(VM* vm, int arg_count, Value* args) {
     if (arg_count != 1 || TYPE_KIND(args[0].type) != VAL_INT) return (Value){VAL_VOID, {0}};
-    char c = (char)args[0].as.i_val;
-    ObjString* s = allocate_string(vm, &c, 1);
-    return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
+    (void)vm;
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)byte_string((uint8_t)args[0].as.i_val)}};
 }
 
 static char* type_to_string(Type t, char* buf) {
@@ -693,6 +1271,11 @@ static char* type_to_string(Type t, char* buf) {
             sprintf(buf, "chan<%s>", type_to_string(sub, sub_buf));
             break;
         }
+        case VAL_HANDLE:
+            strcpy(buf, sub == HANDLE_STRBUF ? "strbuf" : sub == HANDLE_FILEREADER ? "fileReader" :
+                        sub == HANDLE_FILEWRITER ? "fileWriter" : sub == HANDLE_ROUTER ? "router" :
+                        sub == HANDLE_NETBUF ? "netbuf" : "handle");
+            break;
         case VAL_ENUM: {
             if (sub == OPTION_ENUM_ID) {
                 char key_buf[64];
@@ -844,6 +1427,7 @@ static Value native_ffiCall(VM* vm, int arg_count, Value* args) {
         void* p;
     } result;
 
+    vm_flush_output();
     ffi_call(&cif, FFI_FN(func), &result, arg_values);
 
     switch (ret_type_str[0]) {
@@ -863,75 +1447,48 @@ static Value native_ffiCall(VM* vm, int arg_count, Value* args) {
 static Value native_json_stringify(VM* vm, int arg_count, Value* args);
 static Value native_json_parse(VM* vm, int arg_count, Value* args);
 
-typedef struct {
-    char* data;
-    int length;
-    int capacity;
-} StringBuilder;
-
-static void sb_init(StringBuilder* sb) {
-    sb->capacity = 1024;
-    sb->data = malloc(sb->capacity);
-    sb->length = 0;
-    sb->data[0] = '\0';
-}
-
-static void sb_append(StringBuilder* sb, const char* str) {
-    int len = (int)strlen(str);
-    if (sb->length + len + 1 >= sb->capacity) {
-        while (sb->length + len + 1 >= sb->capacity) sb->capacity *= 2;
-        sb->data = realloc(sb->data, sb->capacity);
-    }
-    memcpy(sb->data + sb->length, str, len);
-    sb->length += len;
-    sb->data[sb->length] = '\0';
-}
-
 static void stringify_inner(VM* vm, Value v, StringBuilder* sb) {
     int kind = TYPE_KIND(v.type);
     char buf[128];
     if (kind == VAL_INT) {
-        sprintf(buf, "%ld", v.as.i_val);
-        sb_append(sb, buf);
+        sb_append(sb, buf, fmt_int(buf, v.as.i_val));
     } else if (kind == VAL_FLT) {
-        sprintf(buf, "%g", v.as.f_val);
-        sb_append(sb, buf);
+        sb_append(sb, buf, fmt_flt(buf, v.as.f_val));
     } else if (kind == VAL_BOOL) {
-        sb_append(sb, v.as.b_val ? "true" : "false");
+        sb_append_cstr(sb, v.as.b_val ? "true" : "false");
     } else if (kind == VAL_VOID) {
-        sb_append(sb, "null");
-    } else if (kind == VAL_STR) {
-        sb_append(sb, "\"");
-        sb_append(sb, vm->strings[v.as.s_idx]);
-        sb_append(sb, "\"");
-    } else if (kind == VAL_OBJ && v.as.obj->type == OBJ_STRING) {
-        sb_append(sb, "\"");
-        sb_append(sb, ((ObjString*)v.as.obj)->chars);
-        sb_append(sb, "\"");
+        sb_append_cstr(sb, "null");
+    } else if (is_string(v)) {
+        int64_t len;
+        const char* chars = get_string_chars(vm, v, &len);
+        sb_append(sb, "\"", 1);
+        sb_append(sb, chars, len);
+        sb_append(sb, "\"", 1);
     } else if (kind == VAL_OBJ && v.as.obj->type == OBJ_ARRAY) {
         ObjArray* array = (ObjArray*)v.as.obj;
-        sb_append(sb, "[");
+        sb_append_cstr(sb, "[");
         for (int i = 0; i < array->count; i++) {
             stringify_inner(vm, array->items[i], sb);
-            if (i < array->count - 1) sb_append(sb, ",");
+            if (i < array->count - 1) sb_append_cstr(sb, ",");
         }
-        sb_append(sb, "]");
+        sb_append_cstr(sb, "]");
     } else if ((kind == VAL_OBJ || kind == VAL_MAP) && v.as.obj->type == OBJ_MAP) {
         ObjMap* map = (ObjMap*)v.as.obj;
-        sb_append(sb, "{");
+        if (map->pending != NULL) map_fill(vm, map);
+        sb_append_cstr(sb, "{");
         bool first = true;
         for (int i = 0; i < map->capacity; i++) {
             if (map->entries[i].is_used) {
-                if (!first) sb_append(sb, ",");
+                if (!first) sb_append_cstr(sb, ",");
                 stringify_inner(vm, map->entries[i].key, sb);
-                sb_append(sb, ":");
+                sb_append_cstr(sb, ":");
                 stringify_inner(vm, map->entries[i].value, sb);
                 first = false;
             }
         }
-        sb_append(sb, "}");
+        sb_append_cstr(sb, "}");
     } else {
-        sb_append(sb, "null");
+        sb_append_cstr(sb, "null");
     }
 }
 
@@ -941,8 +1498,7 @@ static Value native_json_stringify(VM* vm, int arg_count, Value* args) {
     StringBuilder sb;
     sb_init(&sb);
     stringify_inner(vm, val, &sb);
-    ObjString* s = allocate_string(vm, sb.data, sb.length);
-    free(sb.data);
+    ObjString* s = take_string(vm, sb.data, sb.length, sb.capacity - 1);
     return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
 }
 
@@ -956,16 +1512,27 @@ static Value parse_string(VM* vm, const char** pp) {
     (*pp)++; // skip "
     const char* start = *pp;
     while (**pp && **pp != '"') (*pp)++;
-    int len = (int)(*pp - start);
-    ObjString* s = allocate_string(vm, start, len);
+    ObjString* s = allocate_string(vm, start, *pp - start);
     if (**pp == '"') (*pp)++;
     return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
 }
 
+// Numbers without a fraction or exponent parse as exact integers; the rest
+// (and integers too large for 64 bits) go through the float parser.
 static Value parse_number(const char** pp) {
-    char* end;
-    double d = strtod(*pp, &end);
-    *pp = end;
+    const char* start = *pp;
+    const char* p = start;
+    bool is_int = true;
+    if (*p == '-' || *p == '+') p++;
+    for (; *p; p++) {
+        if (*p == '.' || *p == 'e' || *p == 'E') is_int = false;
+        else if (!isdigit((unsigned char)*p) && !((*p == '-' || *p == '+') && (p[-1] == 'e' || p[-1] == 'E'))) break;
+    }
+    *pp = p;
+    int64_t i;
+    if (is_int && parse_int(start, p - start, &i)) return (Value){VAL_INT, {.i_val = i}};
+    double d = 0;
+    parse_flt(start, p - start, &d);
     if (d == (double)(int64_t)d) return (Value){VAL_INT, {.i_val = (int64_t)d}};
     return (Value){VAL_FLT, {.f_val = d}};
 }
@@ -1056,30 +1623,48 @@ static Value native_tcpListen(VM* vm, int arg_count, Value* args) {
     if (arg_count != 1 || TYPE_KIND(args[0].type) != VAL_INT) {
         return wrap_err(vm, "tcpListen() expects 1 integer argument", VAL_INT);
     }
-    int port = (int)args[0].as.i_val;
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) return wrap_err(vm, strerror(errno), VAL_INT);
-
-    int opt = 1;
-    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    struct sockaddr_in serv_addr;
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    serv_addr.sin_port = htons(port);
+    HttpListen options = { .backlog = 64 };
+    int fd = http_listen((int)args[0].as.i_val, &options);
+    if (fd < 0) return wrap_err(vm, strerror(-fd), VAL_INT);
+    return wrap_ok(vm, (Value){VAL_INT, {.i_val = fd}}, VAL_INT);
+}
 
-    if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        close(sockfd);
-        return wrap_err(vm, strerror(errno), VAL_INT);
+// Reads a {str:int} of listening options into options, and "workers" into
+// *workers when it is not NULL. Returns NULL, or what is wrong with them.
+static const char* listen_options(VM* vm, Value map_value, HttpListen* options, int* workers, bool* announce) {
+    if (TYPE_KIND(map_value.type) != VAL_MAP) return "listen options have to be a {str:int}";
+    ObjMap* map = (ObjMap*)map_value.as.obj;
+    if (map->pending != NULL) map_fill(vm, map);
+    for (int i = 0; i < map->capacity; i++) {
+        if (!map->entries[i].is_used) continue;
+        Value key = map->entries[i].key;
+        Value value = map->entries[i].value;
+        if (!is_string(key) || TYPE_KIND(value.type) != VAL_INT) return "listen options have to be a {str:int}";
+        const char* name = get_string_ptr(vm, key);
+        int64_t n = value.as.i_val;
+        if (n < 0 || n > INT_MAX) return "listen options cannot be negative";
+        if (strcmp(name, "backlog") == 0) options->backlog = (int)n;
+        else if (strcmp(name, "reuseport") == 0) options->reuseport = n != 0;
+        else if (strcmp(name, "nodelay") == 0) options->nodelay = n != 0;
+        else if (strcmp(name, "defer_accept") == 0) options->defer_accept = (int)n;
+        else if (strcmp(name, "fastopen") == 0) options->fastopen = (int)n;
+        else if (strcmp(name, "workers") == 0 && workers != NULL) *workers = n > 0 ? (int)n : *workers;
+        else if (strcmp(name, "announce") == 0 && announce != NULL) *announce = n != 0;
+        else return "unknown listen option";
     }
+    return NULL;
+}
 
-    if (listen(sockfd, 64) < 0) {
-        close(sockfd);
-        return wrap_err(vm, strerror(errno), VAL_INT);
+static Value native_tcpListenWith(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 2 || TYPE_KIND(args[0].type) != VAL_INT) {
+        return wrap_err(vm, "tcpListenWith() expects a port and a {str:int} of options", VAL_INT);
     }
-
-    return wrap_ok(vm, (Value){VAL_INT, {.i_val = sockfd}}, VAL_INT);
+    HttpListen options = { .backlog = 64 };
+    const char* problem = listen_options(vm, args[1], &options, NULL, NULL);
+    if (problem != NULL) return wrap_err(vm, problem, VAL_INT);
+    int fd = http_listen((int)args[0].as.i_val, &options);
+    if (fd < 0) return wrap_err(vm, strerror(-fd), VAL_INT);
+    return wrap_ok(vm, (Value){VAL_INT, {.i_val = fd}}, VAL_INT);
 }
 
 static Value native_tcpAccept(VM* vm, int arg_count, Value* args) {
@@ -1087,10 +1672,23 @@ static Value native_tcpAccept(VM* vm, int arg_count, Value* args) {
         return wrap_err(vm, "tcpAccept() expects 1 integer argument", VAL_INT);
     }
     int listen_fd = (int)args[0].as.i_val;
-    struct sockaddr_in cli_addr;
-    socklen_t clilen = sizeof(cli_addr);
-    int newsockfd = accept(listen_fd, (struct sockaddr *)&cli_addr, &clilen);
-    if (newsockfd < 0) return wrap_err(vm, strerror(errno), VAL_INT);
+    int64_t done;
+    int newsockfd;
+    if (net_done(vm, &done)) {
+        if (done < 0) return wrap_err(vm, strerror((int)-done), VAL_INT);
+        newsockfd = (int)done;
+    } else if ((newsockfd = netpoll_accepted(listen_fd)) < 0) {
+        struct sockaddr_in cli_addr;
+        socklen_t clilen = sizeof(cli_addr);
+        while ((newsockfd = accept(listen_fd, (struct sockaddr *)&cli_addr, &clilen)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return wrap_err(vm, strerror(errno), VAL_INT);
+            if (net_submit(vm, NETPOLL_ACCEPT, listen_fd, NULL, 0, 0) || net_block(vm, listen_fd, EPOLLIN)) {
+                return (Value){VAL_VOID, {0}};
+            }
+        }
+        fcntl(newsockfd, F_SETFL, fcntl(newsockfd, F_GETFL) | O_NONBLOCK);
+    }
     return wrap_ok(vm, (Value){VAL_INT, {.i_val = newsockfd}}, VAL_INT);
 }
 
@@ -1100,148 +1698,683 @@ static Value native_tcpRecv(VM* vm, int arg_count, Value* args) {
     }
     int fd = (int)args[0].as.i_val;
     int max_len = (int)args[1].as.i_val;
-    char* buffer = malloc(max_len + 1);
-    ssize_t n = recv(fd, buffer, max_len, 0);
-    if (n < 0) {
-        free(buffer);
-        return wrap_err(vm, strerror(errno), VAL_STR);
+    int64_t done;
+    char* buffer;
+    ssize_t n;
+    if (net_done(vm, &done)) {
+        buffer = vm->io.buf;
+        if (done < 0) {
+            free(buffer);
+            return wrap_err(vm, strerror((int)-done), VAL_STR);
+        }
+        n = done;
+    } else {
+        buffer = malloc(max_len + 1);
+        while ((n = recv(fd, buffer, max_len, 0)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                free(buffer);
+                return wrap_err(vm, strerror(errno), VAL_STR);
+            }
+            // A submitted recv takes the buffer along.
+            if (net_submit(vm, NETPOLL_RECV, fd, buffer, max_len, 0)) return (Value){VAL_VOID, {0}};
+            if (net_block(vm, fd, EPOLLIN)) {
+                free(buffer);
+                return (Value){VAL_VOID, {0}};
+            }
+        }
     }
-    buffer[n] = '\0';
-    ObjString* s = allocate_string(vm, buffer, (int)n);
-    free(buffer);
+    // Keep small reads from pinning a large receive buffer.
+    if (n < max_len / 2) buffer = realloc(buffer, n + 1);
+    ObjString* s = take_string(vm, buffer, (int)n, n < max_len / 2 ? (int)n : max_len);
     return wrap_ok(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)s}}, VAL_STR);
 }
 
-static Value native_tcpSend(VM* vm, int arg_count, Value* args) {
-    if (arg_count != 2 || TYPE_KIND(args[0].type) != VAL_INT || !is_string(args[1])) {
-        return wrap_err(vm, "tcpSend() expects (fd: int, data: str)", VAL_INT);
+// ---- receive buffers ----
+
+static ObjNetBuf* netbuf_arg(VM* vm, int arg_count, Value* args, int index, int expected, const char* name) {
+    if (arg_count != expected || TYPE_KIND(args[index].type) != VAL_HANDLE || args[index].as.obj->type != OBJ_NETBUF) {
+        runtime_error(vm, "%s() expects a netbuf", name);
+        return NULL;
     }
-    int fd = (int)args[0].as.i_val;
-    const char* data = get_string_ptr(vm, args[1]);
-    int len = (TYPE_KIND(args[1].type) == VAL_OBJ) ? ((ObjString*)args[1].as.obj)->length : (int)strlen(data);
-    ssize_t n = send(fd, data, len, 0);
-    if (n < 0) return wrap_err(vm, strerror(errno), VAL_INT);
-    return wrap_ok(vm, (Value){VAL_INT, {.i_val = n}}, VAL_INT);
+    return (ObjNetBuf*)args[index].as.obj;
 }
 
-static Value native_httpParse(VM* vm, int arg_count, Value* args) {
-    if (arg_count != 1 || !is_string(args[0])) {
-        return wrap_err(vm, "httpParse() expects 1 string argument", VAL_MAP);
+static Value native_netbuf(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 1 || TYPE_KIND(args[0].type) != VAL_INT || args[0].as.i_val <= 0) {
+        runtime_error(vm, "netbuf() expects a capacity above 0");
+        return (Value){VAL_VOID, {0}};
     }
-    const char* raw = get_string_ptr(vm, args[0]);
-    int raw_len = (TYPE_KIND(args[0].type) == VAL_STR) ? (int)strlen(raw) : ((ObjString*)args[0].as.obj)->length;
+    int64_t capacity = args[0].as.i_val < 64 ? 64 : args[0].as.i_val;
+    ObjNetBuf* buf = malloc(sizeof(ObjNetBuf));
+    buf->obj.type = OBJ_NETBUF;
+    buf->obj.ref_count = 0;
+    buf->data = take_string(vm, malloc(capacity + 1), 0, capacity);
+    retain((Value){VAL_OBJ, {.obj = (HeapObject*)buf->data}});
+    buf->start = 0;
+    return (Value){MAKE_TYPE(VAL_HANDLE, HANDLE_NETBUF, 0), {.obj = (HeapObject*)buf}};
+}
 
-    ObjMap* map = allocate_map(vm);
-    
-    // Simple parsing
-    const char* end_of_first_line = strstr(raw, "\r\n");
-    if (!end_of_first_line) return wrap_err(vm, "Invalid HTTP request", VAL_MAP);
-
-    // Method
-    const char* first_space = strchr(raw, ' ');
-    if (first_space && first_space < end_of_first_line) {
-        ObjString* method = allocate_string(vm, raw, (int)(first_space - raw));
-        map_set(vm, map, (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "method", 6)}}, (Value){VAL_OBJ, {.obj = (HeapObject*)method}});
-        
-        // Path
-        const char* second_space = strchr(first_space + 1, ' ');
-        if (second_space && second_space < end_of_first_line) {
-            ObjString* path = allocate_string(vm, first_space + 1, (int)(second_space - (first_space + 1)));
-            map_set(vm, map, (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "path", 4)}}, (Value){VAL_OBJ, {.obj = (HeapObject*)path}});
-        }
-    }
-
-    // Headers and Body
-    const char* header_start = end_of_first_line + 2;
-    const char* body_start = strstr(header_start, "\r\n\r\n");
-    
-    ObjMap* headers_map = allocate_map(vm);
-    const char* current_line = header_start;
-    while (current_line < (body_start ? body_start : raw + raw_len)) {
-        const char* next_line = strstr(current_line, "\r\n");
-        if (!next_line || next_line == current_line) break;
-        
-        const char* colon = strchr(current_line, ':');
-        if (colon && colon < next_line) {
-            ObjString* key = allocate_string(vm, current_line, (int)(colon - current_line));
-            const char* val_start = colon + 1;
-            while (*val_start == ' ') val_start++;
-            ObjString* val = allocate_string(vm, val_start, (int)(next_line - val_start));
-            map_set(vm, headers_map, (Value){VAL_OBJ, {.obj = (HeapObject*)key}}, (Value){VAL_OBJ, {.obj = (HeapObject*)val}});
-        }
-        current_line = next_line + 2;
-    }
-    map_set(vm, map, (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "headers", 7)}}, (Value){VAL_MAP, {.obj = (HeapObject*)headers_map}});
-
-    if (body_start) {
-        int body_len = (int)(raw + raw_len - (body_start + 4));
-        ObjString* body = allocate_string(vm, body_start + 4, body_len);
-        map_set(vm, map, (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "body", 4)}}, (Value){VAL_OBJ, {.obj = (HeapObject*)body}});
+// Leaves at least a quarter of the capacity free after the unread bytes,
+// moving them to the front, or to a new string while views pin this one.
+// The capacity doubles when they fill more than half of it.
+static void netbuf_reserve(VM* vm, ObjNetBuf* buf) {
+    ObjString* data = buf->data;
+    int64_t unread = data->length - buf->start;
+    bool shared = atomic_load(&data->obj.ref_count) > 1;
+    if (unread == 0 && !shared) {
+        data->length = buf->start = 0;
+    }
+    if (data->capacity - data->length >= data->capacity / 4) return;
+    int64_t capacity = unread > data->capacity / 2 ? data->capacity * 2 : data->capacity;
+    if (shared) {
+        char* chars = malloc(capacity + 1);
+        memcpy(chars, data->chars + buf->start, unread);
+        buf->data = take_string(vm, chars, unread, capacity);
+        retain((Value){VAL_OBJ, {.obj = (HeapObject*)buf->data}});
+        release((Value){VAL_OBJ, {.obj = (HeapObject*)data}});
     } else {
-        map_set(vm, map, (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "body", 4)}}, (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "", 0)}});
+        memmove(data->chars, data->chars + buf->start, unread);
+        if (capacity != data->capacity) data->chars = realloc(data->chars, capacity + 1);
+        data->length = unread;
+        data->capacity = capacity;
     }
+    buf->start = 0;
+}
 
-    return wrap_ok(vm, (Value){VAL_MAP, {.obj = (HeapObject*)map}}, VAL_MAP);
+// Receives into the free space after buf's unread bytes, without an
+// allocation when there is room. Returns the number of bytes received, 0
+// once the peer has closed.
+static Value native_recvInto(VM* vm, int arg_count, Value* args) {
+    ObjNetBuf* buf = netbuf_arg(vm, arg_count, args, 1, 2, "recvInto");
+    if (buf == NULL) return (Value){VAL_VOID, {0}};
+    if (TYPE_KIND(args[0].type) != VAL_INT) return wrap_err(vm, "recvInto() expects (fd: int, buf: netbuf)", VAL_INT);
+    int fd = (int)args[0].as.i_val;
+    int64_t done;
+    ssize_t n;
+    // A submitted recv went to the free space as it was then, untouched since.
+    if (net_done(vm, &done)) {
+        if (done < 0) return wrap_err(vm, strerror((int)-done), VAL_INT);
+        n = done;
+    } else {
+        netbuf_reserve(vm, buf);
+        ObjString* data = buf->data;
+        char* space = data->chars + data->length;
+        size_t room = (size_t)(data->capacity - data->length);
+        while ((n = recv(fd, space, room, 0)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return wrap_err(vm, strerror(errno), VAL_INT);
+            if (net_submit(vm, NETPOLL_RECV, fd, space, room, 0) || net_block(vm, fd, EPOLLIN)) {
+                return (Value){VAL_VOID, {0}};
+            }
+        }
+    }
+    buf->data->length += n;
+    buf->data->chars[buf->data->length] = '\0';
+    return wrap_ok(vm, (Value){VAL_INT, {.i_val = n}}, VAL_INT);
 }
 
-static Value native_httpFormat(VM* vm, int arg_count, Value* args) {
-    if (arg_count != 1 || TYPE_KIND(args[0].type) != VAL_MAP) {
+// The unread bytes, as a view that leaves them unread.
+static Value native_netbufPeek(VM* vm, int arg_count, Value* args) {
+    ObjNetBuf* buf = netbuf_arg(vm, arg_count, args, 0, 1, "netbufPeek");
+    if (buf == NULL) return (Value){VAL_VOID, {0}};
+    int64_t unread = buf->data->length - buf->start;
+    if (unread == 0) return (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "", 0)}};
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string_view(vm, buf->data, buf->start, unread)}};
+}
+
+// The first n unread bytes, or as many as there are, as a view; they are
+// read from then on.
+static Value native_netbufTake(VM* vm, int arg_count, Value* args) {
+    ObjNetBuf* buf = netbuf_arg(vm, arg_count, args, 0, 2, "netbufTake");
+    if (buf == NULL) return (Value){VAL_VOID, {0}};
+    if (TYPE_KIND(args[1].type) != VAL_INT || args[1].as.i_val < 0) {
+        runtime_error(vm, "netbufTake() expects a non-negative length");
         return (Value){VAL_VOID, {0}};
     }
-    ObjMap* map = (ObjMap*)args[0].as.obj;
-    
-    int status = 200;
-    ObjString* s_status = allocate_string(vm, "status", 6);
-    Value v_status = map_get(vm, map, (Value){VAL_OBJ, {.obj = (HeapObject*)s_status}});
-    if (TYPE_KIND(v_status.type) == VAL_INT) status = (int)v_status.as.i_val;
-    free_object((HeapObject*)s_status);
-
-    ObjString* s_body_k = allocate_string(vm, "body", 4);
-    Value v_body = map_get(vm, map, (Value){VAL_OBJ, {.obj = (HeapObject*)s_body_k}});
-    const char* body = is_string(v_body) ? get_string_ptr(vm, v_body) : "";
-    int body_len = is_string(v_body) ? (TYPE_KIND(v_body.type) == VAL_STR ? (int)strlen(body) : ((ObjString*)v_body.as.obj)->length) : 0;
-    free_object((HeapObject*)s_body_k);
+    int64_t unread = buf->data->length - buf->start;
+    int64_t n = args[1].as.i_val < unread ? args[1].as.i_val : unread;
+    ObjString* taken = n == 0 ? allocate_string(vm, "", 0) : allocate_string_view(vm, buf->data, buf->start, n);
+    buf->start += n;
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)taken}};
+}
 
-    StringBuilder sb;
-    sb_init(&sb);
-    
-    char head[128];
-    const char* status_text = "OK";
-    if (status == 404) status_text = "Not Found";
-    else if (status == 500) status_text = "Internal Server Error";
-    else if (status == 400) status_text = "Bad Request";
-    
-    sprintf(head, "HTTP/1.1 %d %s\r\n", status, status_text);
-    sb_append(&sb, head);
-    
-    ObjString* s_headers_k = allocate_string(vm, "headers", 7);
-    Value v_headers = map_get(vm, map, (Value){VAL_OBJ, {.obj = (HeapObject*)s_headers_k}});
-    if (TYPE_KIND(v_headers.type) == VAL_MAP) {
-        ObjMap* h_map = (ObjMap*)v_headers.as.obj;
-        for (int i = 0; i < h_map->capacity; i++) {
-            if (h_map->entries[i].is_used) {
-                Value sk = native_str(vm, 1, &h_map->entries[i].key);
-                Value sv = native_str(vm, 1, &h_map->entries[i].value);
-                sb_append(&sb, ((ObjString*)sk.as.obj)->chars);
-                sb_append(&sb, ": ");
-                sb_append(&sb, ((ObjString*)sv.as.obj)->chars);
-                sb_append(&sb, "\r\n");
-                release(sk); release(sv);
-            }
-        }
-    }
-    free_object((HeapObject*)s_headers_k);
-    
-    char content_len[64];
-    sprintf(content_len, "Content-Length: %d\r\n\r\n", body_len);
-    sb_append(&sb, content_len);
-    
-    ObjString* res = allocate_string(vm, NULL, sb.length + body_len);
-    memcpy(res->chars, sb.data, sb.length);
-    memcpy(res->chars + sb.length, body, body_len);
-    
-    free(sb.data);
-    return (Value){VAL_OBJ, {.obj = (HeapObject*)res}};
+static Value native_tcpSend(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 2 || TYPE_KIND(args[0].type) != VAL_INT || !is_string(args[1])) {
+        return wrap_err(vm, "tcpSend() expects (fd: int, data: str)", VAL_INT);
+    }
+    int fd = (int)args[0].as.i_val;
+    int64_t len;
+    const char* data = get_string_chars(vm, args[1], &len);
+    // Sends everything; a parked send resumes where it stopped.
+    int64_t sent = vm->net_progress;
+    vm->net_progress = 0;
+    int64_t done;
+    if (net_done(vm, &done)) {
+        if (done < 0) return wrap_err(vm, strerror((int)-done), VAL_INT);
+        sent += done;
+    }
+    while (sent < len) {
+        ssize_t n = send(fd, data + sent, len - sent, 0);
+        if (n >= 0) {
+            sent += n;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return wrap_err(vm, strerror(errno), VAL_INT);
+        vm->net_progress = sent;
+        if (net_submit(vm, NETPOLL_SEND, fd, (void*)(data + sent), len - sent, 0) || net_block(vm, fd, EPOLLOUT)) {
+            return (Value){VAL_VOID, {0}};
+        }
+        vm->net_progress = 0;
+    }
+    return wrap_ok(vm, (Value){VAL_INT, {.i_val = sent}}, VAL_INT);
+}
+
+// sendfile has no MSG_NOSIGNAL. SIGPIPE is blocked on this thread around
+// the call, and one the call raised is taken while still pending, so a peer
+// that has hung up is an error result rather than the end of the process.
+// The check follows any return: a send that fails partway through still
+// reports the bytes it moved.
+static ssize_t sendfile_nosignal(int out_fd, int in_fd, off_t* pos, size_t count) {
+    sigset_t pipe_set, old, pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old);
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE);
+    ssize_t n = sendfile(out_fd, in_fd, pos, count);
+    int err = errno;
+    sigpending(&pending);
+    if (!was_pending && sigismember(&pending, SIGPIPE)) {
+        struct timespec none = {0, 0};
+        while (sigtimedwait(&pipe_set, NULL, &none) < 0 && errno == EINTR) {}
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    errno = err;
+    return n;
+}
+
+// Sends len bytes of the file at path from offset, or the rest of it when
+// len is negative, with sendfile: the bytes go from the page cache to the
+// socket without becoming a string. A parked send reopens the file and
+// resumes where it stopped.
+static Value native_tcpSendFile(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 4 || TYPE_KIND(args[0].type) != VAL_INT || !is_string(args[1]) ||
+        TYPE_KIND(args[2].type) != VAL_INT || TYPE_KIND(args[3].type) != VAL_INT || args[2].as.i_val < 0) {
+        return wrap_err(vm, "tcpSendFile() expects (fd: int, path: str, offset: int, len: int)", VAL_INT);
+    }
+    int fd = (int)args[0].as.i_val;
+    int64_t offset = args[2].as.i_val;
+    int64_t len = args[3].as.i_val;
+    int file = open(get_string_ptr(vm, args[1]), O_RDONLY | O_CLOEXEC);
+    if (file < 0) return wrap_err(vm, strerror(errno), VAL_INT);
+    struct stat st;
+    if (fstat(file, &st) != 0) {
+        int err = errno;
+        close(file);
+        return wrap_err(vm, strerror(err), VAL_INT);
+    }
+    if (offset > st.st_size) {
+        close(file);
+        return wrap_err(vm, "offset is past the end of the file", VAL_INT);
+    }
+    if (len < 0 || len > st.st_size - offset) len = st.st_size - offset;
+    int64_t sent = vm->net_progress;
+    vm->net_progress = 0;
+    while (sent < len) {
+        off_t pos = (off_t)(offset + sent);
+        ssize_t n = sendfile_nosignal(fd, file, &pos, (size_t)(len - sent));
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n == 0) break; // the file got shorter
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            int err = errno;
+            close(file);
+            return wrap_err(vm, strerror(err), VAL_INT);
+        }
+        vm->net_progress = sent;
+        if (net_block(vm, fd, EPOLLOUT)) {
+            close(file);
+            return (Value){VAL_VOID, {0}};
+        }
+        vm->net_progress = 0;
+    }
+    close(file);
+    return wrap_ok(vm, (Value){VAL_INT, {.i_val = sent}}, VAL_INT);
+}
+
+// Keys of the request and response maps, interned once per process.
+static struct {
+    Value method, path, headers, body, status, length, template, file, url, host, location;
+} http_keys;
+static pthread_once_t http_keys_once = PTHREAD_ONCE_INIT;
+
+static Value key_value(const char* chars) {
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)intern_string(chars, (int64_t)strlen(chars))}};
+}
+
+static void http_keys_init(void) {
+    http_keys.method = key_value("method");
+    http_keys.path = key_value("path");
+    http_keys.headers = key_value("headers");
+    http_keys.body = key_value("body");
+    http_keys.status = key_value("status");
+    http_keys.length = key_value("length");
+    http_keys.template = key_value("template");
+    http_keys.file = key_value("file");
+    http_keys.url = key_value("url");
+    http_keys.host = key_value("Host");
+    http_keys.location = key_value("Location");
+}
+
+static Value slice_view(VM* vm, ObjString* source, const char* base, HttpSlice s) {
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string_view(vm, source, s.chars - base, (int64_t)s.length)}};
+}
+
+// Builds the map Opo code sees for req, whose bytes starting at base have
+// been copied to source. Every field is a view of source, and the header
+// map keeps the raw lines until it is first used.
+static ObjMap* request_map(VM* vm, ObjString* source, const char* base, const HttpRequest* req) {
+    pthread_once(&http_keys_once, http_keys_init);
+    Value owner = (Value){VAL_OBJ, {.obj = (HeapObject*)source}};
+    retain(owner);
+    ObjMap* map = allocate_map(vm);
+    map_set(vm, map, http_keys.method, slice_view(vm, source, base, req->method));
+    map_set(vm, map, http_keys.path, slice_view(vm, source, base, req->path));
+    ObjMap* headers = allocate_map(vm);
+    if (req->headers.length > 0) {
+        headers->pending = (ObjString*)slice_view(vm, source, base, req->headers).as.obj;
+        retain((Value){VAL_OBJ, {.obj = (HeapObject*)headers->pending}});
+    }
+    map_set(vm, map, http_keys.headers, (Value){VAL_MAP, {.obj = (HeapObject*)headers}});
+    map_set(vm, map, http_keys.body, slice_view(vm, source, base, req->body));
+    release(owner);
+    return map;
+}
+
+static Value native_httpParse(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 1 || !is_string(args[0])) {
+        return wrap_err(vm, "httpParse() expects 1 string argument", VAL_MAP);
+    }
+    int64_t raw_len;
+    const char* raw = get_string_chars(vm, args[0], &raw_len);
+
+    // Parsed from a copy, as a chunked body is decoded in place.
+    ObjString* source = allocate_string(vm, raw, raw_len);
+    Value owner = (Value){VAL_OBJ, {.obj = (HeapObject*)source}};
+    retain(owner);
+    HttpParser parser = {0};
+    HttpRequest req;
+    int64_t used = http_parse(&parser, source->chars, (size_t)raw_len, &req);
+    if (used <= 0) {
+        release(owner);
+        return wrap_err(vm, used == 0 ? "Incomplete HTTP request" : "Invalid HTTP request", VAL_MAP);
+    }
+    ObjMap* map = request_map(vm, source, source->chars, &req);
+    map_set(vm, map, http_keys.length, (Value){VAL_INT, {.i_val = used}});
+    release(owner);
+    return wrap_ok(vm, (Value){VAL_MAP, {.obj = (HeapObject*)map}}, VAL_MAP);
+}
+
+// Appends "Name: value\r\n" for each entry of a header map.
+static void append_header_lines(VM* vm, Value headers, HttpOut* out) {
+    if (TYPE_KIND(headers.type) != VAL_MAP) return;
+    ObjMap* map = (ObjMap*)headers.as.obj;
+    if (map->pending != NULL) map_fill(vm, map);
+    for (int i = 0; i < map->capacity; i++) {
+        if (!map->entries[i].is_used) continue;
+        Value key = map->entries[i].key;
+        Value value = map->entries[i].value;
+        Value sk = is_string(key) ? key : native_str(vm, 1, &key);
+        Value sv = is_string(value) ? value : native_str(vm, 1, &value);
+        int64_t key_len, value_len;
+        const char* key_chars = get_string_chars(vm, sk, &key_len);
+        const char* value_chars = get_string_chars(vm, sv, &value_len);
+        http_out_header(out, key_chars, key_len, value_chars, value_len);
+        if (!is_string(key)) release(sk);
+        if (!is_string(value)) release(sv);
+    }
+}
+
+// Hands the bytes collected in out to a new string without copying them.
+static ObjString* take_out(VM* vm, HttpOut* out) {
+    http_out_append(out, "", 1);
+    return take_string(vm, out->data, out->length - 1, out->capacity - 1);
+}
+
+static Value native_httpFormat(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 1 || TYPE_KIND(args[0].type) != VAL_MAP) {
+        return (Value){VAL_VOID, {0}};
+    }
+    pthread_once(&http_keys_once, http_keys_init);
+    ObjMap* map = (ObjMap*)args[0].as.obj;
+    Value v_status = map_get(vm, map, http_keys.status);
+    Value v_body = map_get(vm, map, http_keys.body);
+    int64_t body_len = 0;
+    const char* body = is_string(v_body) ? get_string_chars(vm, v_body, &body_len) : "";
+
+    HttpOut out = {0};
+    http_out_status(&out, TYPE_KIND(v_status.type) == VAL_INT ? (int)v_status.as.i_val : 200);
+    append_header_lines(vm, map_get(vm, map, http_keys.headers), &out);
+    char line[HTTP_LINE_MAX];
+    http_out_append(&out, line, http_length_line(line, body_len));
+    http_out_append(&out, body, body_len);
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)take_out(vm, &out)}};
+}
+
+static Value native_httpTemplate(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 1 || TYPE_KIND(args[0].type) != VAL_MAP) {
+        runtime_error(vm, "httpTemplate() expects a header map");
+        return (Value){VAL_VOID, {0}};
+    }
+    HttpOut out = {0};
+    append_header_lines(vm, args[0], &out);
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)take_out(vm, &out)}};
+}
+
+// Sends every byte of iov with as few sendmsg calls as the socket allows. A
+// parked send resumes where it stopped, as tcpSend does.
+static Value send_iov(VM* vm, int fd, const struct iovec* iov, int count) {
+    int64_t total = 0;
+    for (int i = 0; i < count; i++) total += (int64_t)iov[i].iov_len;
+    int64_t sent = vm->net_progress;
+    vm->net_progress = 0;
+    while (sent < total) {
+        struct iovec window[64];
+        int used = 0;
+        int64_t skip = sent;
+        for (int i = 0; i < count && used < 64; i++) {
+            if (skip >= (int64_t)iov[i].iov_len) {
+                skip -= (int64_t)iov[i].iov_len;
+                continue;
+            }
+            window[used++] = (struct iovec){ (char*)iov[i].iov_base + skip, iov[i].iov_len - skip };
+            skip = 0;
+        }
+        struct msghdr msg = { .msg_iov = window, .msg_iovlen = used };
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n >= 0) {
+            sent += n;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return wrap_err(vm, strerror(errno), VAL_INT);
+        vm->net_progress = sent;
+        if (net_block(vm, fd, EPOLLOUT)) return (Value){VAL_VOID, {0}};
+        vm->net_progress = 0;
+    }
+    return wrap_ok(vm, (Value){VAL_INT, {.i_val = sent}}, VAL_INT);
+}
+
+static Value native_tcpSendv(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 2 || TYPE_KIND(args[0].type) != VAL_INT || TYPE_KIND(args[1].type) != VAL_OBJ ||
+        args[1].as.obj->type != OBJ_ARRAY) {
+        return wrap_err(vm, "tcpSendv() expects (fd: int, parts: []str)", VAL_INT);
+    }
+    ObjArray* parts = (ObjArray*)args[1].as.obj;
+    struct iovec* iov = malloc(sizeof(struct iovec) * (parts->count > 0 ? parts->count : 1));
+    for (int i = 0; i < parts->count; i++) {
+        int64_t length = 0;
+        const char* chars = is_string(parts->items[i]) ? get_string_chars(vm, parts->items[i], &length) : "";
+        iov[i] = (struct iovec){ (void*)chars, (size_t)length };
+    }
+    Value result = send_iov(vm, (int)args[0].as.i_val, iov, parts->count);
+    free(iov);
+    return result;
+}
+
+// Sends a status line, a header block made by httpTemplate, Content-Length
+// and the body in one gather write.
+static Value native_httpRespond(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 4 || TYPE_KIND(args[0].type) != VAL_INT || TYPE_KIND(args[1].type) != VAL_INT ||
+        !is_string(args[2]) || !is_string(args[3])) {
+        return wrap_err(vm, "httpRespond() expects (fd: int, status: int, template: str, body: str)", VAL_INT);
+    }
+    char status_line[HTTP_LINE_MAX];
+    char length_line[HTTP_LINE_MAX];
+    int64_t template_len, body_len;
+    const char* template = get_string_chars(vm, args[2], &template_len);
+    const char* body = get_string_chars(vm, args[3], &body_len);
+    struct iovec iov[4] = {
+        { status_line, http_status_line(status_line, (int)args[1].as.i_val) },
+        { (void*)template, (size_t)template_len },
+        { length_line, http_length_line(length_line, (size_t)body_len) },
+        { (void*)body, (size_t)body_len },
+    };
+    return send_iov(vm, (int)args[0].as.i_val, iov, 4);
+}
+
+// ---- httpServe ----
+//
+// The engine in http.c owns the sockets. Each of its worker threads has a VM
+// of its own, the calling thread keeping the caller's, and only the handler
+// call goes through Opo.
+
+typedef struct {
+    VM* vm;
+    Value handler;
+    HttpFiles* files;
+    int port; // printed once listening when announced
+} ServeWorker;
+
+static ServeWorker* serve_worker_new(VM* vm, Value handler) {
+    ServeWorker* w = malloc(sizeof(ServeWorker));
+    w->vm = vm;
+    w->handler = handler;
+    w->files = http_files_new();
+    return w;
+}
+
+static void* serve_worker_init(void* arg) {
+    ServeWorker* first = (ServeWorker*)arg;
+    VM* vm = malloc(sizeof(VM));
+    vm_init(vm, first->vm->code, first->vm->strings, first->vm->string_lengths, first->vm->strings_count, first->vm->argc, first->vm->argv);
+    retain(first->handler);
+    return serve_worker_new(vm, first->handler);
+}
+
+// Bodies at least this large are not copied into the connection's buffer.
+#define SERVE_ATTACH_MIN (16 * 1024)
+
+static void release_attached(void* ref) {
+    release((Value){VAL_OBJ, {.obj = (HeapObject*)ref}});
+}
+
+// Answers with the file a handler named as "file", or 404 when there is
+// none. Its headers, if any, follow those of the file.
+static void serve_file(VM* vm, HttpFiles* files, const HttpRequest* req, ObjMap* res, Value v_file, HttpOut* out) {
+    int64_t path_len, headers_len = 0;
+    const char* path = get_string_chars(vm, v_file, &path_len);
+    const char* headers = "";
+    HttpOut extra = {0};
+    Value v_template = map_get(vm, res, http_keys.template);
+    if (is_string(v_template)) {
+        headers = get_string_chars(vm, v_template, &headers_len);
+    } else {
+        append_header_lines(vm, map_get(vm, res, http_keys.headers), &extra);
+        headers = extra.data != NULL ? extra.data : "";
+        headers_len = (int64_t)extra.length;
+    }
+    if (!http_out_file(out, files, req, path, (size_t)path_len, headers, (size_t)headers_len)) {
+        http_out_status(out, 404);
+        if (http_out_end(out, req, 404, 9)) http_out_append(out, "Not Found", 9);
+    }
+    free(extra.data);
+}
+
+static void serve_request(void* worker, const HttpRequest* req, HttpOut* out) {
+    ServeWorker* w = (ServeWorker*)worker;
+    VM* vm = w->vm;
+    // One copy of the request outlives the receive buffer; the map's
+    // strings are views of it.
+    const char* base = req->method.chars;
+    ObjString* source = allocate_string(vm, base, req->body.chars + req->body.length - base);
+    ObjMap* map = request_map(vm, source, base, req);
+
+    Value arg = (Value){VAL_MAP, {.obj = (HeapObject*)map}};
+    retain(arg);
+    Value result = vm_call_value(vm, w->handler, 1, &arg);
+    release(arg);
+    if (TYPE_KIND(result.type) != VAL_MAP) {
+        release(result);
+        http_out_status(out, 500);
+        http_out_end(out, req, 500, 0);
+        return;
+    }
+
+    ObjMap* res = (ObjMap*)result.as.obj;
+    Value v_file = map_get(vm, res, http_keys.file);
+    if (is_string(v_file)) {
+        serve_file(vm, w->files, req, res, v_file, out);
+        release(result);
+        return;
+    }
+    Value v_status = map_get(vm, res, http_keys.status);
+    int status = TYPE_KIND(v_status.type) == VAL_INT ? (int)v_status.as.i_val : 200;
+    http_out_status(out, status);
+    // A header block from httpTemplate is copied as it is.
+    Value v_template = map_get(vm, res, http_keys.template);
+    if (is_string(v_template)) {
+        int64_t template_len;
+        const char* template = get_string_chars(vm, v_template, &template_len);
+        http_out_append(out, template, template_len);
+    } else {
+        append_header_lines(vm, map_get(vm, res, http_keys.headers), out);
+    }
+    Value v_body = map_get(vm, res, http_keys.body);
+    int64_t body_len = 0;
+    const char* body = is_string(v_body) ? get_string_chars(vm, v_body, &body_len) : "";
+    if (!http_out_end(out, req, status, body_len)) {
+        release(result);
+        return;
+    }
+    if (body_len >= SERVE_ATTACH_MIN && TYPE_KIND(v_body.type) == VAL_STR) {
+        http_out_attach(out, body, body_len, NULL, NULL); // a constant of the program
+    } else if (body_len >= SERVE_ATTACH_MIN) {
+        // Sent from where it is; the string that owns the bytes stays alive
+        // until then.
+        retain(v_body);
+        http_out_attach(out, body, body_len, release_attached, v_body.as.obj);
+    } else {
+        http_out_append(out, body, body_len);
+    }
+    release(result);
+}
+
+static void serve_announce(void* worker) {
+    char line[64];
+    int length = snprintf(line, sizeof(line), "HTTP Server listening on port %d\n", ((ServeWorker*)worker)->port);
+    output_chars(line, (size_t)length);
+}
+
+static Value serve(VM* vm, Value port, Value handler, int workers, const HttpListen* options, bool announce) {
+    retain(handler);
+    ServeWorker* self = serve_worker_new(vm, handler);
+    self->port = (int)port.as.i_val;
+    int err = http_serve(self->port, workers, options, serve_request, self, serve_worker_init, self,
+                         announce ? serve_announce : NULL);
+    release(handler);
+    http_files_free(self->files);
+    free(self);
+    return wrap_err(vm, strerror(err), VAL_BOOL);
+}
+
+static int cpu_count(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+static Value native_httpServe(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 2 || TYPE_KIND(args[0].type) != VAL_INT ||
+        TYPE_KIND(args[1].type) < VAL_FUNC || TYPE_KIND(args[1].type) > VAL_FUNC_VOID) {
+        return wrap_err(vm, "httpServe() expects a port and a handler", VAL_BOOL);
+    }
+    HttpListen options = {0};
+    return serve(vm, args[0], args[1], cpu_count(), &options, false);
+}
+
+static Value native_httpServeWith(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 3 || TYPE_KIND(args[0].type) != VAL_INT ||
+        TYPE_KIND(args[1].type) < VAL_FUNC || TYPE_KIND(args[1].type) > VAL_FUNC_VOID) {
+        return wrap_err(vm, "httpServeWith() expects a port, a handler and a {str:int} of options", VAL_BOOL);
+    }
+    HttpListen options = {0};
+    int workers = cpu_count();
+    bool announce = false;
+    const char* problem = listen_options(vm, args[2], &options, &workers, &announce);
+    if (problem != NULL) return wrap_err(vm, problem, VAL_BOOL);
+    return serve(vm, args[0], args[1], workers, &options, announce);
+}
+
+static Value native_router(VM* vm, int arg_count, Value* args) {
+    (void)vm; (void)arg_count; (void)args;
+    ObjRouter* router = malloc(sizeof(ObjRouter));
+    router->obj.type = OBJ_ROUTER;
+    router->obj.ref_count = 0;
+    router->router = router_new();
+    router->keys = NULL;
+    router->key_count = 0;
+    return (Value){MAKE_TYPE(VAL_HANDLE, HANDLE_ROUTER, 0), {.obj = (HeapObject*)router}};
+}
+
+static ObjRouter* router_arg(Value v) {
+    if (TYPE_KIND(v.type) != VAL_HANDLE || v.as.obj == NULL || v.as.obj->type != OBJ_ROUTER) return NULL;
+    return (ObjRouter*)v.as.obj;
+}
+
+static Value native_routerAdd(VM* vm, int arg_count, Value* args) {
+    ObjRouter* router = arg_count == 4 ? router_arg(args[0]) : NULL;
+    if (router == NULL || !is_string(args[1]) || !is_string(args[2]) || TYPE_KIND(args[3].type) != VAL_INT || args[3].as.i_val < 0) {
+        return wrap_err(vm, "routerAdd() expects a router, a method, a pattern and an id >= 0", VAL_BOOL);
+    }
+    int64_t method_len, pattern_len;
+    const char* method = get_string_chars(vm, args[1], &method_len);
+    const char* pattern = get_string_chars(vm, args[2], &pattern_len);
+    const char* problem = router_add(router->router, method, method_len, pattern, pattern_len, (int)args[3].as.i_val);
+    if (problem != NULL) return wrap_err(vm, problem, VAL_BOOL);
+    int count = router_param_count(router->router);
+    if (count > router->key_count) {
+        router->keys = realloc(router->keys, sizeof(ObjString*) * count);
+        for (int i = router->key_count; i < count; i++) {
+            size_t length;
+            const char* name = router_param_name(router->router, i, &length);
+            router->keys[i] = intern_string(name, (int64_t)length);
+        }
+        router->key_count = count;
+    }
+    return wrap_ok(vm, (Value){VAL_BOOL, {.b_val = true}}, VAL_BOOL);
+}
+
+// Returns the route's id, -1 when nothing matches the path and -2 when
+// something does but not for the method. Parameters go into args[3], as
+// views of the path; a static route allocates nothing.
+static Value native_routerMatch(VM* vm, int arg_count, Value* args) {
+    ObjRouter* router = arg_count == 4 ? router_arg(args[0]) : NULL;
+    if (router == NULL || !is_string(args[1]) || !is_string(args[2]) || TYPE_KIND(args[3].type) != VAL_MAP) {
+        runtime_error(vm, "routerMatch() expects a router, a method, a path and a map for the parameters");
+        return (Value){VAL_VOID, {0}};
+    }
+    int64_t method_len, path_len;
+    const char* method = get_string_chars(vm, args[1], &method_len);
+    const char* path = get_string_chars(vm, args[2], &path_len);
+    RouteCapture captures[ROUTER_MAX_PARAMS];
+    int count;
+    int id = router_match(router->router, method, method_len, path, path_len, captures, &count);
+    if (count > 0) {
+        ObjMap* params = (ObjMap*)args[3].as.obj;
+        ObjString* source = TYPE_KIND(args[2].type) == VAL_OBJ ? (ObjString*)args[2].as.obj : NULL;
+        for (int i = 0; i < count; i++) {
+            ObjString* value = source != NULL ? allocate_string_view(vm, source, captures[i].start, captures[i].length)
+                                              : allocate_string(vm, path + captures[i].start, captures[i].length);
+            map_set(vm, params, (Value){VAL_OBJ, {.obj = (HeapObject*)router->keys[captures[i].param]}},
+                    (Value){VAL_OBJ, {.obj = (HeapObject*)value}});
+        }
+    }
+    return (Value){VAL_INT, {.i_val = id}};
 }
 
 static Value native_tcpClose(VM* vm, int arg_count, Value* args) {
@@ -1249,8 +2382,7 @@ static Value native_tcpClose(VM* vm, int arg_count, Value* args) {
         runtime_error(vm, "tcpClose() expects 1 integer argument");
         return (Value){VAL_VOID, {0}};
     }
-    int fd = (int)args[0].as.i_val;
-    close(fd);
+    netpoll_close((int)args[0].as.i_val);
     return (Value){VAL_VOID, {0}};
 }
 
@@ -1310,12 +2442,256 @@ static Value native_regexMatch(VM* vm, int arg_count, Value* args) {
     return (Value){VAL_BOOL, {.b_val = result}};
 }
 
-static Value native_httpGet(VM* vm, int arg_count, Value* args) {
-    if (arg_count != 1 || !is_string(args[0])) {
-        return wrap_err(vm, "httpGet() expects 1 string argument", VAL_STR);
+// ---- HTTP client ----
+//
+// The exchange itself is in client.c. A native that has to wait for the
+// socket keeps its call in vm->client and takes it up where it stopped
+// when it runs again.
+
+typedef struct ClientCall {
+    HttpCall* call;
+    ObjArray* responses; // complete ones, in order
+    ObjMap* response;    // the one being read
+    int redirects;       // httpGet: redirects followed so far
+    char origin[300];    // "http://host:port", for relative redirects
+} ClientCall;
+
+typedef struct {
+    Value method, url, headers, body;
+} ClientRequest;
+
+static bool method_has_body(const char* method, int64_t length) {
+    return (length == 4 && memcmp(method, "POST", 4) == 0) || (length == 3 && memcmp(method, "PUT", 3) == 0) ||
+           (length == 5 && memcmp(method, "PATCH", 5) == 0);
+}
+
+// Methods whose request can go out twice with the effect of once.
+static bool method_is_idempotent(const char* method, int64_t length) {
+    return (length == 3 && memcmp(method, "GET", 3) == 0) || (length == 4 && memcmp(method, "HEAD", 4) == 0) ||
+           (length == 3 && memcmp(method, "PUT", 3) == 0) || (length == 6 && memcmp(method, "DELETE", 6) == 0) ||
+           (length == 7 && memcmp(method, "OPTIONS", 7) == 0);
+}
+
+// Writes the requests into one buffer and starts a call that sends them.
+// Returns NULL, or why they cannot be sent.
+static const char* client_start(VM* vm, const ClientRequest* reqs, int count, bool stream) {
+    pthread_once(&http_keys_once, http_keys_init);
+    HttpOut out = {0};
+    bool* head = malloc(sizeof(bool) * count);
+    bool idempotent = true;
+    HttpUrl origin;
+    for (int i = 0; i < count; i++) {
+        const ClientRequest* r = &reqs[i];
+        const char* problem = NULL;
+        int64_t method_len, url_len, body_len = 0;
+        HttpUrl url;
+        if (!is_string(r->method) || !is_string(r->url)) {
+            problem = "a request needs a method and a URL";
+        } else {
+            const char* url_chars = get_string_chars(vm, r->url, &url_len);
+            if (!http_url_parse(url_chars, (size_t)url_len, &url)) problem = "not an http:// URL";
+            else if (i > 0 && (url.port != origin.port || strcmp(url.host, origin.host) != 0)) {
+                problem = "pipelined requests have to go to the same host and port";
+            }
+        }
+        if (problem != NULL) {
+            free(head);
+            free(out.data);
+            return problem;
+        }
+        if (i == 0) origin = url;
+        const char* method = get_string_chars(vm, r->method, &method_len);
+        const char* body = is_string(r->body) ? get_string_chars(vm, r->body, &body_len) : "";
+        head[i] = method_len == 4 && memcmp(method, "HEAD", 4) == 0;
+        if (!method_is_idempotent(method, method_len)) idempotent = false;
+
+        http_out_append(&out, method, method_len);
+        http_out_append(&out, " ", 1);
+        http_out_append(&out, url.path, url.path_len);
+        http_out_append(&out, " HTTP/1.1\r\n", 11);
+        bool has_host = TYPE_KIND(r->headers.type) == VAL_MAP &&
+                        TYPE_KIND(map_get(vm, (ObjMap*)r->headers.as.obj, http_keys.host).type) != VAL_VOID;
+        if (!has_host) http_out_header(&out, "Host", 4, url.authority, url.authority_len);
+        append_header_lines(vm, r->headers, &out);
+        if (body_len > 0 || method_has_body(method, method_len)) {
+            char line[HTTP_LINE_MAX];
+            http_out_append(&out, line, http_length_line(line, (size_t)body_len));
+        } else {
+            http_out_append(&out, "\r\n", 2);
+        }
+        http_out_append(&out, body, body_len);
     }
-    const char* url = get_string_ptr(vm, args[0]);
-    
+    ClientCall* cc = calloc(1, sizeof(ClientCall));
+    cc->call = http_call_new(origin.host, origin.port, out.data, out.length, count, head, idempotent, stream);
+    bool ipv6 = strchr(origin.host, ':') != NULL;
+    snprintf(cc->origin, sizeof(cc->origin), "http://%s%s%s:%d", ipv6 ? "[" : "", origin.host, ipv6 ? "]" : "", origin.port);
+    free(head);
+    cc->responses = allocate_array(vm);
+    retain((Value){VAL_OBJ, {.obj = (HeapObject*)cc->responses}});
+    vm->client = cc;
+    return NULL;
+}
+
+static void client_free(VM* vm) {
+    ClientCall* cc = vm->client;
+    if (cc->response != NULL) release((Value){VAL_MAP, {.obj = (HeapObject*)cc->response}});
+    release((Value){VAL_OBJ, {.obj = (HeapObject*)cc->responses}});
+    http_call_free(cc->call);
+    free(cc);
+    vm->client = NULL;
+}
+
+enum { CLIENT_DONE, CLIENT_PARKED, CLIENT_FAILED };
+
+// Moves vm->client on until every response is in, it fails, or a goroutine
+// has to wait. Each piece of a streamed body is passed to sink.
+static int client_run(VM* vm, Value sink) {
+    ClientCall* cc = vm->client;
+    for (;;) {
+        HttpResponse res;
+        switch (http_call_step(cc->call, &res)) {
+            case HTTP_CALL_WAIT:
+                if (net_block(vm, http_call_fd(cc->call), http_call_events(cc->call))) return CLIENT_PARKED;
+                break;
+            case HTTP_CALL_HEAD: {
+                // The header map keeps the raw lines until it is first used.
+                ObjMap* map = allocate_map(vm);
+                map_set(vm, map, http_keys.status, (Value){VAL_INT, {.i_val = res.status}});
+                ObjMap* headers = allocate_map(vm);
+                if (res.headers.length > 0) {
+                    headers->pending = allocate_string(vm, res.headers.chars, (int64_t)res.headers.length);
+                    retain((Value){VAL_OBJ, {.obj = (HeapObject*)headers->pending}});
+                }
+                map_set(vm, map, http_keys.headers, (Value){VAL_MAP, {.obj = (HeapObject*)headers}});
+                retain((Value){VAL_MAP, {.obj = (HeapObject*)map}});
+                cc->response = map;
+                break;
+            }
+            case HTTP_CALL_DATA: {
+                Value piece = (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, res.data.chars, (int64_t)res.data.length)}};
+                retain(piece);
+                // The sink is free to make calls of its own.
+                vm->client = NULL;
+                release(vm_call_value(vm, sink, 1, &piece));
+                vm->client = cc;
+                release(piece);
+                break;
+            }
+            case HTTP_CALL_END: {
+                size_t capacity;
+                char* chars = http_call_take_body(cc->call, &capacity);
+                ObjString* body = take_string(vm, chars, (int64_t)res.data.length, (int64_t)capacity);
+                map_set(vm, cc->response, http_keys.body, (Value){VAL_OBJ, {.obj = (HeapObject*)body}});
+                ObjArray* responses = cc->responses;
+                if (responses->count >= responses->capacity) {
+                    responses->capacity = responses->capacity < 8 ? 8 : responses->capacity * 2;
+                    responses->items = realloc(responses->items, sizeof(Value) * responses->capacity);
+                }
+                responses->items[responses->count++] = (Value){VAL_MAP, {.obj = (HeapObject*)cc->response}};
+                cc->response = NULL; // the array has its reference
+                break;
+            }
+            case HTTP_CALL_DONE:
+                return CLIENT_DONE;
+            default:
+                return CLIENT_FAILED;
+        }
+    }
+}
+
+// The native's result once client_run has returned: every response, or
+// the first, or the error.
+static Value client_result(VM* vm, int status, bool all) {
+    if (status == CLIENT_PARKED) return (Value){VAL_VOID, {0}};
+    Type inner = all ? VAL_OBJ : VAL_MAP;
+    Value result;
+    if (status == CLIENT_FAILED) {
+        result = wrap_err(vm, http_call_error(vm->client->call), inner);
+    } else if (all) {
+        result = wrap_ok(vm, (Value){MAKE_TYPE(VAL_OBJ, VAL_MAP, 0), {.obj = (HeapObject*)vm->client->responses}}, inner);
+    } else {
+        result = wrap_ok(vm, vm->client->responses->items[0], inner);
+    }
+    client_free(vm);
+    return result;
+}
+
+static Value native_httpRequest(VM* vm, int arg_count, Value* args) {
+    if (vm->client == NULL) {
+        if (arg_count != 4) return wrap_err(vm, "httpRequest() expects (method: str, url: str, headers: {str:str}, body: str)", VAL_MAP);
+        ClientRequest req = { args[0], args[1], args[2], args[3] };
+        const char* problem = client_start(vm, &req, 1, false);
+        if (problem != NULL) return wrap_err(vm, problem, VAL_MAP);
+    }
+    return client_result(vm, client_run(vm, (Value){VAL_VOID, {0}}), false);
+}
+
+// Sends every request in one write over one connection, and returns the
+// responses in the same order.
+static Value native_httpPipeline(VM* vm, int arg_count, Value* args) {
+    if (vm->client == NULL) {
+        if (arg_count != 1 || TYPE_KIND(args[0].type) != VAL_OBJ || args[0].as.obj->type != OBJ_ARRAY) {
+            return wrap_err(vm, "httpPipeline() expects an array of request maps", VAL_OBJ);
+        }
+        pthread_once(&http_keys_once, http_keys_init);
+        ObjArray* requests = (ObjArray*)args[0].as.obj;
+        if (requests->count == 0) {
+            return wrap_ok(vm, (Value){MAKE_TYPE(VAL_OBJ, VAL_MAP, 0), {.obj = (HeapObject*)allocate_array(vm)}}, VAL_OBJ);
+        }
+        ClientRequest* reqs = malloc(sizeof(ClientRequest) * requests->count);
+        for (int i = 0; i < requests->count; i++) {
+            Value item = requests->items[i];
+            ObjMap* map = TYPE_KIND(item.type) == VAL_MAP ? (ObjMap*)item.as.obj : NULL;
+            reqs[i] = (ClientRequest){ map_get(vm, map, http_keys.method), map_get(vm, map, http_keys.url),
+                                       map_get(vm, map, http_keys.headers), map_get(vm, map, http_keys.body) };
+        }
+        const char* problem = client_start(vm, reqs, requests->count, false);
+        free(reqs);
+        if (problem != NULL) return wrap_err(vm, problem, VAL_OBJ);
+    }
+    return client_result(vm, client_run(vm, (Value){VAL_VOID, {0}}), true);
+}
+
+// Like httpRequest, but hands the body to sink piece by piece as it arrives
+// and returns the response without it.
+static Value native_httpStream(VM* vm, int arg_count, Value* args) {
+    if (vm->client == NULL) {
+        if (arg_count != 5 || TYPE_KIND(args[4].type) < VAL_FUNC || TYPE_KIND(args[4].type) > VAL_FUNC_VOID) {
+            return wrap_err(vm, "httpStream() expects (method: str, url: str, headers: {str:str}, body: str, sink: <str> -> void)", VAL_MAP);
+        }
+        ClientRequest req = { args[0], args[1], args[2], args[3] };
+        const char* problem = client_start(vm, &req, 1, true);
+        if (problem != NULL) return wrap_err(vm, problem, VAL_MAP);
+    }
+    return client_result(vm, client_run(vm, args[4]), false);
+}
+
+// Follows a redirect from vm->client's response to location. Returns NULL,
+// or why it cannot.
+static const char* client_redirect(VM* vm, Value location) {
+    int64_t length;
+    const char* chars = get_string_chars(vm, location, &length);
+    ClientCall* cc = vm->client;
+    HttpOut url = {0};
+    if (length > 0 && chars[0] == '/') http_out_append(&url, cc->origin, strlen(cc->origin));
+    http_out_append(&url, chars, length);
+    int redirects = cc->redirects + 1;
+    client_free(vm);
+    ObjString* method = allocate_string(vm, "GET", 3);
+    ObjString* target = take_out(vm, &url);
+    ClientRequest req = { (Value){VAL_OBJ, {.obj = (HeapObject*)method}}, (Value){VAL_OBJ, {.obj = (HeapObject*)target}},
+                          (Value){VAL_VOID, {0}}, (Value){VAL_VOID, {0}} };
+    retain(req.method);
+    retain(req.url);
+    const char* problem = client_start(vm, &req, 1, false);
+    release(req.method);
+    release(req.url);
+    if (problem == NULL) vm->client->redirects = redirects;
+    return problem;
+}
+
+// Anything but plain http://, https:// in particular, is fetched by curl.
+static Value curl_get(VM* vm, const char* url) {
     // Safety check for URL: avoid command injection by only allowing certain characters
     for (const char* c = url; *c; c++) {
         if (!isalnum(*c) && !strchr(":/._-?&=%#+", *c)) {
@@ -1334,8 +2710,8 @@ static Value native_httpGet(VM* vm, int arg_count, Value* args) {
     size_t current_size = 1024 * 64;
     
     char chunk[4096];
-    while (fgets(chunk, sizeof(chunk), fp) != NULL) {
-        size_t chunk_len = strlen(chunk);
+    size_t chunk_len;
+    while ((chunk_len = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
         if (total_read + chunk_len >= current_size) {
             current_size *= 2;
             result = realloc(result, current_size);
@@ -1348,13 +2724,56 @@ static Value native_httpGet(VM* vm, int arg_count, Value* args) {
         free(result);
         return wrap_err(vm, "curl failed", VAL_STR);
     }
-    result[total_read] = '\0';
-    
-    ObjString* s = allocate_string(vm, result, (int)total_read);
-    free(result);
+    ObjString* s = take_string(vm, result, (int64_t)total_read, (int64_t)current_size - 1);
     return wrap_ok(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)s}}, VAL_STR);
 }
 
+// GETs url and returns the body, whatever the status, after following up
+// to 10 redirects.
+static Value native_httpGet(VM* vm, int arg_count, Value* args) {
+    if (vm->client == NULL) {
+        if (arg_count != 1 || !is_string(args[0])) {
+            return wrap_err(vm, "httpGet() expects 1 string argument", VAL_STR);
+        }
+        int64_t length;
+        const char* url = get_string_chars(vm, args[0], &length);
+        if (length < 7 || memcmp(url, "http://", 7) != 0) return curl_get(vm, get_string_ptr(vm, args[0]));
+        Value method = (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, "GET", 3)}};
+        retain(method);
+        ClientRequest req = { method, args[0], (Value){VAL_VOID, {0}}, (Value){VAL_VOID, {0}} };
+        const char* problem = client_start(vm, &req, 1, false);
+        release(method);
+        if (problem != NULL) return wrap_err(vm, problem, VAL_STR);
+    }
+    for (;;) {
+        int status = client_run(vm, (Value){VAL_VOID, {0}});
+        if (status == CLIENT_PARKED) return (Value){VAL_VOID, {0}};
+        if (status == CLIENT_FAILED) {
+            Value result = wrap_err(vm, http_call_error(vm->client->call), VAL_STR);
+            client_free(vm);
+            return result;
+        }
+        ObjMap* res = (ObjMap*)vm->client->responses->items[0].as.obj;
+        int64_t code = map_get(vm, res, http_keys.status).as.i_val;
+        Value location = map_get(vm, (ObjMap*)map_get(vm, res, http_keys.headers).as.obj, http_keys.location);
+        if (code >= 300 && code < 400 && is_string(location) && vm->client->redirects < 10) {
+            int64_t length;
+            const char* chars = get_string_chars(vm, location, &length);
+            if (length > 0 && chars[0] != '/' && (length < 7 || memcmp(chars, "http://", 7) != 0)) {
+                Value result = curl_get(vm, get_string_ptr(vm, location));
+                client_free(vm);
+                return result;
+            }
+            const char* problem = client_redirect(vm, location);
+            if (problem != NULL) return wrap_err(vm, problem, VAL_STR);
+            continue;
+        }
+        Value result = wrap_ok(vm, map_get(vm, res, http_keys.body), VAL_STR);
+        client_free(vm);
+        return result;
+    }
+}
+
 static Value native_json_parse(VM* vm, int arg_count, Value* args) {
     if (arg_count != 1 || !is_string(args[0])) {
         return wrap_err(vm, "json_parse() expects 1 string argument", VAL_ANY);
@@ -1417,32 +2836,808 @@ static Value native_log(VM* vm, int arg_count, Value* args) {
     return (Value){VAL_FLT, {.f_val = log(val)}};
 }
 
+static ObjArray* array_arg(Value v) {
+    if (TYPE_KIND(v.type) == VAL_OBJ && v.as.obj != NULL && v.as.obj->type == OBJ_ARRAY) return (ObjArray*)v.as.obj;
+    return NULL;
+}
+
+// Element kind of a numeric array: taken from the first item, or from the
+// array's own element type when it is empty. An empty literal carries none
+// and counts as int; the compiler tags the result with the static type.
+static int numeric_kind(Value arr_val, ObjArray* array) {
+    if (array->count > 0) return TYPE_KIND(array->items[0].type);
+    return TYPE_SUB(arr_val.type) == VAL_FLT ? VAL_FLT : VAL_INT;
+}
+
+static Value native_arraySum(VM* vm, int arg_count, Value* args) {
+    ObjArray* array = arg_count == 1 ? array_arg(args[0]) : NULL;
+    if (array == NULL) {
+        runtime_error(vm, "arraySum() expects 1 array argument");
+        return (Value){VAL_VOID, {0}};
+    }
+    int kind = numeric_kind(args[0], array);
+    if (kind == VAL_INT) return (Value){VAL_INT, {.i_val = simd_sum_int(array->items, array->count)}};
+    if (kind == VAL_FLT) return (Value){VAL_FLT, {.f_val = simd_sum_flt(array->items, array->count)}};
+    runtime_error(vm, "arraySum() expects an array of int or flt");
+    return (Value){VAL_VOID, {0}};
+}
+
+static Value array_min_max(VM* vm, int arg_count, Value* args, bool want_max) {
+    const char* name = want_max ? "arrayMax" : "arrayMin";
+    ObjArray* array = arg_count == 1 ? array_arg(args[0]) : NULL;
+    if (array == NULL) {
+        runtime_error(vm, "%s() expects 1 array argument", name);
+        return (Value){VAL_VOID, {0}};
+    }
+    int kind = numeric_kind(args[0], array);
+    if (kind == VAL_INT) {
+        if (array->count == 0) return (Value){VAL_INT, {.i_val = 0}};
+        int64_t m = want_max ? simd_max_int(array->items, array->count) : simd_min_int(array->items, array->count);
+        return (Value){VAL_INT, {.i_val = m}};
+    }
+    if (kind == VAL_FLT) {
+        if (array->count == 0) return (Value){VAL_FLT, {.f_val = 0}};
+        double m = want_max ? simd_max_flt(array->items, array->count) : simd_min_flt(array->items, array->count);
+        return (Value){VAL_FLT, {.f_val = m}};
+    }
+    runtime_error(vm, "%s() expects an array of int or flt", name);
+    return (Value){VAL_VOID, {0}};
+}
+
+static Value native_arrayMin(VM* vm, int arg_count, Value* args) {
+    return array_min_max(vm, arg_count, args, false);
+}
+
+static Value native_arrayMax(VM* vm, int arg_count, Value* args) {
+    return array_min_max(vm, arg_count, args, true);
+}
+
+static Value native_arrayIndexOf(VM* vm, int arg_count, Value* args) {
+    ObjArray* array = arg_count == 2 ? array_arg(args[0]) : NULL;
+    if (array == NULL) {
+        runtime_error(vm, "arrayIndexOf() expects (array, value)");
+        return (Value){VAL_VOID, {0}};
+    }
+    Value needle = args[1];
+    int kind = TYPE_KIND(needle.type);
+    if (array->count > 0 && (int)TYPE_KIND(array->items[0].type) == kind) {
+        if (kind == VAL_INT) return (Value){VAL_INT, {.i_val = simd_index_int(array->items, array->count, needle.as.i_val)}};
+        if (kind == VAL_FLT) return (Value){VAL_INT, {.i_val = simd_index_flt(array->items, array->count, needle.as.f_val)}};
+    }
+    for (int i = 0; i < array->count; i++) {
+        if (values_equal(vm, array->items[i], needle)) return (Value){VAL_INT, {.i_val = i}};
+    }
+    return (Value){VAL_INT, {.i_val = -1}};
+}
+
+static Value native_arrayCount(VM* vm, int arg_count, Value* args) {
+    ObjArray* array = arg_count == 2 ? array_arg(args[0]) : NULL;
+    if (array == NULL) {
+        runtime_error(vm, "arrayCount() expects (array, value)");
+        return (Value){VAL_VOID, {0}};
+    }
+    Value needle = args[1];
+    int kind = TYPE_KIND(needle.type);
+    if (array->count > 0 && (int)TYPE_KIND(array->items[0].type) == kind) {
+        if (kind == VAL_INT) return (Value){VAL_INT, {.i_val = simd_count_int(array->items, array->count, needle.as.i_val)}};
+        if (kind == VAL_FLT) return (Value){VAL_INT, {.i_val = simd_count_flt(array->items, array->count, needle.as.f_val)}};
+    }
+    int count = 0;
+    for (int i = 0; i < array->count; i++) {
+        if (values_equal(vm, array->items[i], needle)) count++;
+    }
+    return (Value){VAL_INT, {.i_val = count}};
+}
+
+static Value native_arrayDot(VM* vm, int arg_count, Value* args) {
+    ObjArray* a = arg_count == 2 ? array_arg(args[0]) : NULL;
+    ObjArray* b = arg_count == 2 ? array_arg(args[1]) : NULL;
+    if (a == NULL || b == NULL) {
+        runtime_error(vm, "arrayDot() expects 2 array arguments");
+        return (Value){VAL_VOID, {0}};
+    }
+    if (a->count != b->count) {
+        runtime_error(vm, "arrayDot() length mismatch (%d and %d)", a->count, b->count);
+        return (Value){VAL_VOID, {0}};
+    }
+    int kind = numeric_kind(args[0], a);
+    if (a->count > 0 && (int)TYPE_KIND(b->items[0].type) != kind) {
+        runtime_error(vm, "arrayDot() element types differ");
+        return (Value){VAL_VOID, {0}};
+    }
+    if (kind == VAL_INT) return (Value){VAL_INT, {.i_val = simd_dot_int(a->items, b->items, a->count)}};
+    if (kind == VAL_FLT) return (Value){VAL_FLT, {.f_val = simd_dot_flt(a->items, b->items, a->count)}};
+    runtime_error(vm, "arrayDot() expects arrays of int or flt");
+    return (Value){VAL_VOID, {0}};
+}
+
+
+static bool all_of_kind(ObjArray* array, int kind, int obj_type) {
+    for (int i = 0; i < array->count; i++) {
+        Value v = array->items[i];
+        if ((int)TYPE_KIND(v.type) != kind) return false;
+        if (obj_type >= 0 && (v.as.obj == NULL || (int)v.as.obj->type != obj_type)) return false;
+    }
+    return true;
+}
+
+static Value native_sort(VM* vm, int arg_count, Value* args) {
+    ObjArray* array = arg_count == 1 ? array_arg(args[0]) : NULL;
+    if (array == NULL) {
+        runtime_error(vm, "sort() expects 1 array argument");
+        return (Value){VAL_VOID, {0}};
+    }
+    if (array->count < 2) return args[0];
+    array_make_unique(array);
+    int kind = TYPE_KIND(array->items[0].type);
+    if (kind == VAL_INT && all_of_kind(array, VAL_INT, -1)) {
+        sort_ints(array->items, array->count);
+    } else if (kind == VAL_FLT && all_of_kind(array, VAL_FLT, -1)) {
+        sort_flts(array->items, array->count);
+    } else if (kind == VAL_OBJ && all_of_kind(array, VAL_OBJ, OBJ_STRING)) {
+        sort_strs(array->items, array->count);
+    } else {
+        runtime_error(vm, "sort() expects an array of int, flt or str; use sortBy() for other elements");
+        return (Value){VAL_VOID, {0}};
+    }
+    return args[0];
+}
+
+typedef struct {
+    VM* vm;
+    Value fn;
+} SortCallback;
+
+static bool sort_callback_less(void* ctx, const Value* a, const Value* b) {
+    SortCallback* cb = (SortCallback*)ctx;
+    Value pair[2] = {*a, *b};
+    Value result = vm_call_value(cb->vm, cb->fn, 2, pair);
+    bool less = TYPE_KIND(result.type) == VAL_BOOL ? result.as.b_val
+              : TYPE_KIND(result.type) == VAL_INT ? result.as.i_val < 0 : false;
+    release(result);
+    return less;
+}
+
+static Value native_sortBy(VM* vm, int arg_count, Value* args) {
+    ObjArray* array = arg_count == 2 ? array_arg(args[0]) : NULL;
+    int fn_kind = arg_count == 2 ? (int)TYPE_KIND(args[1].type) : 0;
+    if (array == NULL || fn_kind < VAL_FUNC || fn_kind > VAL_FUNC_VOID) {
+        runtime_error(vm, "sortBy() expects (array, function)");
+        return (Value){VAL_VOID, {0}};
+    }
+    int count = array->count;
+    if (count < 2) return args[0];
+
+    // Sort a private copy so the comparator can look at (or even grow) the
+    // array without the sort reading freed memory.
+    Value* items = malloc(sizeof(Value) * count);
+    for (int i = 0; i < count; i++) {
+        items[i] = array->items[i];
+        retain(items[i]);
+    }
+    SortCallback cb = {vm, args[1]};
+    sort_values(items, count, sort_callback_less, &cb);
+
+    if (array->count != count) {
+        for (int i = 0; i < count; i++) release(items[i]);
+        free(items);
+        runtime_error(vm, "sortBy() comparator changed the array length");
+        return (Value){VAL_VOID, {0}};
+    }
+    array_make_unique(array);
+    for (int i = 0; i < count; i++) {
+        release(array->items[i]);
+        array->items[i] = items[i];
+    }
+    free(items);
+    return args[0];
+}
+
+static Value native_substr(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 3 || !is_string(args[0]) || TYPE_KIND(args[1].type) != VAL_INT || TYPE_KIND(args[2].type) != VAL_INT) {
+        runtime_error(vm, "substr() expects (str, int, int)");
+        return (Value){VAL_VOID, {0}};
+    }
+    int64_t len;
+    const char* chars = get_string_chars(vm, args[0], &len);
+    int64_t lo = args[1].as.i_val;
+    int64_t hi = args[2].as.i_val;
+    if (lo < 0) lo = 0;
+    if (hi > len) hi = len;
+    if (hi < lo) hi = lo;
+    if (TYPE_KIND(args[0].type) == VAL_STR) {
+        ObjString* copy = allocate_string(vm, chars + lo, hi - lo);
+        return (Value){VAL_OBJ, {.obj = (HeapObject*)copy}};
+    }
+    if (lo == 0 && hi == len) return args[0];
+    ObjString* view = allocate_string_view(vm, (ObjString*)args[0].as.obj, lo, hi - lo);
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)view}};
+}
+
+// Unpacks the (haystack, needle) strings shared by the search natives.
+static bool search_args(VM* vm, int arg_count, Value* args, const char* name,
+                        const char** hay, int64_t* hay_len, const char** needle, int64_t* needle_len) {
+    if (arg_count < 2 || !is_string(args[0]) || !is_string(args[1])) {
+        runtime_error(vm, "%s() expects (str, str)", name);
+        return false;
+    }
+    *hay = get_string_chars(vm, args[0], hay_len);
+    *needle = get_string_chars(vm, args[1], needle_len);
+    return true;
+}
+
+static Value native_strFind(VM* vm, int arg_count, Value* args) {
+    const char *hay, *needle;
+    int64_t hay_len, needle_len;
+    if (!search_args(vm, arg_count, args, "strFind", &hay, &hay_len, &needle, &needle_len)) return (Value){VAL_VOID, {0}};
+    return (Value){VAL_INT, {.i_val = simd_find_bytes(hay, hay_len, needle, needle_len)}};
+}
+
+static Value native_strContains(VM* vm, int arg_count, Value* args) {
+    const char *hay, *needle;
+    int64_t hay_len, needle_len;
+    if (!search_args(vm, arg_count, args, "strContains", &hay, &hay_len, &needle, &needle_len)) return (Value){VAL_VOID, {0}};
+    return (Value){VAL_BOOL, {.b_val = simd_find_bytes(hay, hay_len, needle, needle_len) >= 0}};
+}
+
+// Non-overlapping occurrences; an empty needle matches between every byte.
+static Value native_strCount(VM* vm, int arg_count, Value* args) {
+    const char *hay, *needle;
+    int64_t hay_len, needle_len;
+    if (!search_args(vm, arg_count, args, "strCount", &hay, &hay_len, &needle, &needle_len)) return (Value){VAL_VOID, {0}};
+    if (needle_len == 0) return (Value){VAL_INT, {.i_val = hay_len + 1}};
+    int64_t count = 0;
+    int64_t pos = 0;
+    int64_t found;
+    while ((found = simd_find_bytes(hay + pos, hay_len - pos, needle, needle_len)) >= 0) {
+        count++;
+        pos += found + needle_len;
+    }
+    return (Value){VAL_INT, {.i_val = count}};
+}
+
+static void push_piece(VM* vm, ObjArray* array, ObjString* parent, int64_t start, int64_t length) {
+    if (array->count >= array->capacity) {
+        array->capacity = array->capacity < 8 ? 8 : array->capacity * 2;
+        array->items = realloc(array->items, sizeof(Value) * array->capacity);
+    }
+    Value piece = (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string_view(vm, parent, start, length)}};
+    retain(piece);
+    array->items[array->count++] = piece;
+}
+
+// Splits on every occurrence of the separator, or into single bytes when it is
+// empty. The pieces are views of the input, and a trailing empty piece is
+// dropped to match std/string.
+static Value native_strSplit(VM* vm, int arg_count, Value* args) {
+    const char *hay, *sep;
+    int64_t hay_len, sep_len;
+    if (!search_args(vm, arg_count, args, "strSplit", &hay, &hay_len, &sep, &sep_len)) return (Value){VAL_VOID, {0}};
+    // Constant strings cannot be viewed, so copy one once and view the copy.
+    Value parent_val = args[0];
+    if (TYPE_KIND(parent_val.type) == VAL_STR) {
+        parent_val = (Value){VAL_OBJ, {.obj = (HeapObject*)allocate_string(vm, hay, hay_len)}};
+    }
+    retain(parent_val);
+    ObjString* parent = (ObjString*)parent_val.as.obj;
+    hay = parent->chars;
+
+    ObjArray* array = allocate_array(vm);
+    if (sep_len == 0) {
+        for (int64_t i = 0; i < hay_len; i++) push_piece(vm, array, parent, i, 1);
+    } else {
+        int64_t start = 0;
+        int64_t found;
+        while ((found = simd_find_bytes(hay + start, hay_len - start, sep, sep_len)) >= 0) {
+            push_piece(vm, array, parent, start, found);
+            start += found + sep_len;
+        }
+        if (start < hay_len) push_piece(vm, array, parent, start, hay_len - start);
+    }
+    release(parent_val);
+    return (Value){MAKE_TYPE(VAL_OBJ, VAL_STR, 0), {.obj = (HeapObject*)array}};
+}
+
+// ---- bulk stdin ----
+
+// The rest of stdin, copied once into a string.
+static ObjString* read_rest(VM* vm) {
+    vm_flush_output();
+    input_lock();
+    InputSpan rest = input_rest(input_stdin());
+    ObjString* s = allocate_string(vm, rest.chars, (int64_t)rest.length);
+    input_unlock();
+    return s;
+}
+
+static Value native_readAll(VM* vm, int arg_count, Value* args) {
+    (void)arg_count; (void)args;
+    ObjString* s = read_rest(vm);
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
+}
+
+// Up to n whitespace-separated integers, parsed straight from the input
+// buffer; fewer when stdin ends first.
+static Value native_readInts(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 1 || args[0].type != VAL_INT) {
+        runtime_error(vm, "readInts() expects an int");
+        return (Value){VAL_VOID, {0}};
+    }
+    int64_t n = args[0].as.i_val;
+    ObjArray* array = allocate_array(vm);
+    if (n > 0) {
+        array->capacity = n < 1 << 20 ? (int)n : 1 << 20;
+        array->items = malloc(sizeof(Value) * array->capacity);
+    }
+    vm_flush_output();
+    input_lock();
+    InputSpan token;
+    while (array->count < n && input_token(input_stdin(), &token)) {
+        int64_t value;
+        if (token.length > NUM_BUF_SIZE || !parse_int(token.chars, (int64_t)token.length, &value)) {
+            int shown = token.length > 40 ? 40 : (int)token.length;
+            runtime_error(vm, "readInts(): '%.*s' is not an integer", shown, token.chars);
+            input_unlock();
+            Value unused = (Value){MAKE_TYPE(VAL_OBJ, VAL_INT, 0), {.obj = (HeapObject*)array}};
+            retain(unused);
+            release(unused);
+            return (Value){VAL_VOID, {0}};
+        }
+        if (array->count >= array->capacity) {
+            array->capacity *= 2;
+            array->items = realloc(array->items, sizeof(Value) * array->capacity);
+        }
+        array->items[array->count++] = (Value){VAL_INT, {.i_val = value}};
+    }
+    input_unlock();
+    return (Value){MAKE_TYPE(VAL_OBJ, VAL_INT, 0), {.obj = (HeapObject*)array}};
+}
+
+// Every remaining whitespace-separated token, as views of one copy of the
+// input.
+static Value native_readTokens(VM* vm, int arg_count, Value* args) {
+    (void)arg_count; (void)args;
+    ObjString* rest = read_rest(vm);
+    Value rest_val = (Value){VAL_OBJ, {.obj = (HeapObject*)rest}};
+    retain(rest_val);
+    ObjArray* array = allocate_array(vm);
+    const char* chars = rest->chars;
+    int i = 0;
+    while (i < rest->length) {
+        while (i < rest->length && input_is_space(chars[i])) i++;
+        int start = i;
+        while (i < rest->length && !input_is_space(chars[i])) i++;
+        if (i > start) push_piece(vm, array, rest, start, i - start);
+    }
+    release(rest_val);
+    return (Value){MAKE_TYPE(VAL_OBJ, VAL_STR, 0), {.obj = (HeapObject*)array}};
+}
+
+// Every remaining line without its '\n', as views of one copy of the input.
+// A final line needs no newline.
+static Value native_lines(VM* vm, int arg_count, Value* args) {
+    (void)arg_count; (void)args;
+    ObjString* rest = read_rest(vm);
+    Value rest_val = (Value){VAL_OBJ, {.obj = (HeapObject*)rest}};
+    retain(rest_val);
+    ObjArray* array = allocate_array(vm);
+    const char* chars = rest->chars;
+    int64_t start = 0;
+    while (start < rest->length) {
+        const char* nl = memchr(chars + start, '\n', rest->length - start);
+        int64_t end = nl != NULL ? nl - chars : rest->length;
+        push_piece(vm, array, rest, start, end - start);
+        start = end + 1;
+    }
+    release(rest_val);
+    return (Value){MAKE_TYPE(VAL_OBJ, VAL_STR, 0), {.obj = (HeapObject*)array}};
+}
+
+// Replaces every non-overlapping occurrence; the input comes back untouched
+// when there is nothing to replace.
+static Value native_strReplace(VM* vm, int arg_count, Value* args) {
+    const char *hay, *old;
+    int64_t hay_len, old_len;
+    if (!search_args(vm, arg_count, args, "strReplace", &hay, &hay_len, &old, &old_len)) return (Value){VAL_VOID, {0}};
+    if (arg_count != 3 || !is_string(args[2])) {
+        runtime_error(vm, "strReplace() expects (str, str, str)");
+        return (Value){VAL_VOID, {0}};
+    }
+    int64_t with_len;
+    const char* with = get_string_chars(vm, args[2], &with_len);
+    int64_t found = old_len == 0 ? -1 : simd_find_bytes(hay, hay_len, old, old_len);
+    if (found < 0) return args[0];
+
+    StringBuilder sb = {NULL, 0, 0};
+    int64_t pos = 0;
+    do {
+        sb_append(&sb, hay + pos, found);
+        sb_append(&sb, with, with_len);
+        pos += found + old_len;
+    } while ((found = simd_find_bytes(hay + pos, hay_len - pos, old, old_len)) >= 0);
+    sb_append(&sb, hay + pos, hay_len - pos);
+    ObjString* s = take_string(vm, sb.data, sb.length, sb.capacity - 1);
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
+}
+
+static ObjStrBuf* strbuf_arg(VM* vm, int arg_count, Value* args, int expected, const char* name) {
+    if (arg_count != expected || TYPE_KIND(args[0].type) != VAL_HANDLE || args[0].as.obj->type != OBJ_STRBUF) {
+        runtime_error(vm, "%s() expects a strbuf as its first argument", name);
+        return NULL;
+    }
+    return (ObjStrBuf*)args[0].as.obj;
+}
+
+static Value native_strbuf(VM* vm, int arg_count, Value* args) {
+    (void)vm; (void)arg_count; (void)args;
+    ObjStrBuf* buf = malloc(sizeof(ObjStrBuf));
+    buf->obj.type = OBJ_STRBUF;
+    buf->obj.ref_count = 0;
+    buf->sb.data = NULL;
+    buf->sb.length = 0;
+    buf->sb.capacity = 0;
+    return (Value){MAKE_TYPE(VAL_HANDLE, HANDLE_STRBUF, 0), {.obj = (HeapObject*)buf}};
+}
+
+static Value native_strbufPush(VM* vm, int arg_count, Value* args) {
+    ObjStrBuf* buf = strbuf_arg(vm, arg_count, args, 2, "strbufPush");
+    if (buf == NULL) return (Value){VAL_VOID, {0}};
+    int64_t len;
+    const char* chars = get_string_chars(vm, args[1], &len);
+    if (chars == NULL) {
+        runtime_error(vm, "strbufPush() expects a str to append");
+        return (Value){VAL_VOID, {0}};
+    }
+    sb_append(&buf->sb, chars, len);
+    return (Value){VAL_VOID, {0}};
+}
+
+static Value native_strbufPushInt(VM* vm, int arg_count, Value* args) {
+    ObjStrBuf* buf = strbuf_arg(vm, arg_count, args, 2, "strbufPushInt");
+    if (buf == NULL) return (Value){VAL_VOID, {0}};
+    char num[NUM_BUF_SIZE];
+    sb_append(&buf->sb, num, fmt_int(num, args[1].as.i_val));
+    return (Value){VAL_VOID, {0}};
+}
+
+static Value native_strbufPushFlt(VM* vm, int arg_count, Value* args) {
+    ObjStrBuf* buf = strbuf_arg(vm, arg_count, args, 2, "strbufPushFlt");
+    if (buf == NULL) return (Value){VAL_VOID, {0}};
+    char num[NUM_BUF_SIZE];
+    sb_append(&buf->sb, num, fmt_flt(num, args[1].as.f_val));
+    return (Value){VAL_VOID, {0}};
+}
+
+// Hands the accumulated bytes to a new string and leaves the builder empty.
+static Value native_strbufFinish(VM* vm, int arg_count, Value* args) {
+    ObjStrBuf* buf = strbuf_arg(vm, arg_count, args, 1, "strbufFinish");
+    if (buf == NULL) return (Value){VAL_VOID, {0}};
+    ObjString* s;
+    if (buf->sb.data == NULL) {
+        s = allocate_string(vm, "", 0);
+    } else {
+        s = take_string(vm, buf->sb.data, buf->sb.length, buf->sb.capacity - 1);
+    }
+    buf->sb.data = NULL;
+    buf->sb.length = 0;
+    buf->sb.capacity = 0;
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)s}};
+}
+
+// ---- file readers ----
+
+static ObjFileReader* reader_arg(VM* vm, int arg_count, Value* args, int expected, const char* name) {
+    if (arg_count != expected || TYPE_KIND(args[0].type) != VAL_HANDLE || args[0].as.obj->type != OBJ_FILEREADER) {
+        runtime_error(vm, "%s() expects a fileReader as its first argument", name);
+        return NULL;
+    }
+    return (ObjFileReader*)args[0].as.obj;
+}
+
+// Opening never fails here; a file that cannot be opened gives a reader
+// whose reads return the error.
+static Value native_fileReader(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 1 || !is_string(args[0])) {
+        runtime_error(vm, "fileReader() expects a path");
+        return (Value){VAL_VOID, {0}};
+    }
+    ObjFileReader* reader = malloc(sizeof(ObjFileReader));
+    reader->obj.type = OBJ_FILEREADER;
+    reader->obj.ref_count = 0;
+    int fd = open(get_string_ptr(vm, args[0]), O_RDONLY);
+    input_init(&reader->in, fd);
+    if (fd < 0) {
+        reader->in.error = errno;
+        reader->in.eof = true;
+        reader->in.started = true;
+    }
+    return (Value){MAKE_TYPE(VAL_HANDLE, HANDLE_FILEREADER, 0), {.obj = (HeapObject*)reader}};
+}
+
+static Value reader_result(VM* vm, ObjFileReader* reader, InputSpan span) {
+    if (span.length == 0 && reader->in.error != 0) return wrap_err(vm, strerror(reader->in.error), VAL_STR);
+    ObjString* s = allocate_string(vm, span.chars, (int64_t)span.length);
+    return wrap_ok(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)s}}, VAL_STR);
+}
+
+// Up to n bytes; an empty string once the file is exhausted.
+static Value native_readerChunk(VM* vm, int arg_count, Value* args) {
+    ObjFileReader* reader = reader_arg(vm, arg_count, args, 2, "readerChunk");
+    if (reader == NULL) return (Value){VAL_VOID, {0}};
+    if (TYPE_KIND(args[1].type) != VAL_INT || args[1].as.i_val < 0) {
+        runtime_error(vm, "readerChunk() expects a non-negative size");
+        return (Value){VAL_VOID, {0}};
+    }
+    return reader_result(vm, reader, input_chunk(&reader->in, (size_t)args[1].as.i_val));
+}
+
+// The next line without its newline; an empty string once the file is
+// exhausted, which readerEof tells apart from an empty line.
+static Value native_readerLine(VM* vm, int arg_count, Value* args) {
+    ObjFileReader* reader = reader_arg(vm, arg_count, args, 1, "readerLine");
+    if (reader == NULL) return (Value){VAL_VOID, {0}};
+    InputSpan line = {"", 0};
+    input_line(&reader->in, &line);
+    return reader_result(vm, reader, line);
+}
+
+// True once every byte has been read. A reader holding an error is not at
+// its end, so the error surfaces from the next read.
+static Value native_readerEof(VM* vm, int arg_count, Value* args) {
+    ObjFileReader* reader = reader_arg(vm, arg_count, args, 1, "readerEof");
+    if (reader == NULL) return (Value){VAL_VOID, {0}};
+    bool at_end = input_at_end(&reader->in) && reader->in.error == 0;
+    return (Value){VAL_BOOL, {.b_val = at_end}};
+}
+
+// ---- file writers ----
+//
+// Writes collect in a 64 KB buffer and reach the file when it fills, on
+// fileFlush and fileClose, when the writer is freed, and at exit. Larger
+// writes skip the buffer.
+
+#define WRITER_BUFFER (64 * 1024)
+#define WRITEV_MAX 1024 // IOV_MAX on Linux
+
+static ObjFileWriter* open_writers = NULL;
+static pthread_mutex_t open_writers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t writers_atexit_once = PTHREAD_ONCE_INIT;
+
+// Writes every byte of the iovecs, resuming after short writes. Returns 0
+// or the errno of the failure.
+static int write_all(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count > WRITEV_MAX ? WRITEV_MAX : count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int writer_flush_locked(ObjFileWriter* writer) {
+    if (writer->length == 0) return 0;
+    struct iovec iov = { writer->buf, writer->length };
+    writer->length = 0;
+    return write_all(writer->fd, &iov, 1);
+}
+
+static void flush_open_writers(void) {
+    pthread_mutex_lock(&open_writers_lock);
+    for (ObjFileWriter* w = open_writers; w != NULL; w = w->next) {
+        pthread_mutex_lock(&w->lock);
+        writer_flush_locked(w);
+        pthread_mutex_unlock(&w->lock);
+    }
+    pthread_mutex_unlock(&open_writers_lock);
+}
+
+static void register_writers_atexit(void) {
+    atexit(flush_open_writers);
+}
+
+static int writer_close(ObjFileWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    if (writer->fd < 0) {
+        pthread_mutex_unlock(&writer->lock);
+        return 0;
+    }
+    int err = writer_flush_locked(writer);
+    if (close(writer->fd) != 0 && err == 0) err = errno;
+    writer->fd = -1;
+    free(writer->buf);
+    writer->buf = NULL;
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_mutex_lock(&open_writers_lock);
+    if (writer->prev != NULL) writer->prev->next = writer->next;
+    else open_writers = writer->next;
+    if (writer->next != NULL) writer->next->prev = writer->prev;
+    pthread_mutex_unlock(&open_writers_lock);
+    return err;
+}
+
+static ObjFileWriter* writer_arg(VM* vm, int arg_count, Value* args, int expected, const char* name) {
+    if (arg_count != expected || TYPE_KIND(args[0].type) != VAL_HANDLE || args[0].as.obj->type != OBJ_FILEWRITER) {
+        runtime_error(vm, "%s() expects a fileWriter as its first argument", name);
+        return NULL;
+    }
+    return (ObjFileWriter*)args[0].as.obj;
+}
+
+static Value writer_result(VM* vm, ObjFileWriter* writer, int err) {
+    if (err != 0) return wrap_err(vm, strerror(err), VAL_BOOL);
+    if (writer->error != 0) return wrap_err(vm, strerror(writer->error), VAL_BOOL);
+    return wrap_ok(vm, (Value){VAL_BOOL, {.b_val = true}}, VAL_BOOL);
+}
+
+// Mode "w" truncates the file and "a" appends to it; both create it. As with
+// fileReader, a failed open is reported by the first write.
+static Value native_fileOpen(VM* vm, int arg_count, Value* args) {
+    if (arg_count != 2 || !is_string(args[0]) || !is_string(args[1])) {
+        runtime_error(vm, "fileOpen() expects (path: str, mode: str)");
+        return (Value){VAL_VOID, {0}};
+    }
+    const char* mode = get_string_ptr(vm, args[1]);
+    int flags;
+    if (strcmp(mode, "w") == 0) flags = O_WRONLY | O_CREAT | O_TRUNC;
+    else if (strcmp(mode, "a") == 0) flags = O_WRONLY | O_CREAT | O_APPEND;
+    else {
+        runtime_error(vm, "fileOpen() mode must be \"w\" or \"a\", got \"%s\"", mode);
+        return (Value){VAL_VOID, {0}};
+    }
+    ObjFileWriter* writer = malloc(sizeof(ObjFileWriter));
+    writer->obj.type = OBJ_FILEWRITER;
+    writer->obj.ref_count = 0;
+    pthread_mutex_init(&writer->lock, NULL);
+    writer->fd = open(get_string_ptr(vm, args[0]), flags | O_CLOEXEC, 0644);
+    writer->error = writer->fd < 0 ? errno : 0;
+    writer->buf = writer->fd < 0 ? NULL : malloc(WRITER_BUFFER);
+    writer->length = 0;
+    writer->prev = NULL;
+    writer->next = NULL;
+    if (writer->fd >= 0) {
+        pthread_once(&writers_atexit_once, register_writers_atexit);
+        pthread_mutex_lock(&open_writers_lock);
+        writer->next = open_writers;
+        if (open_writers != NULL) open_writers->prev = writer;
+        open_writers = writer;
+        pthread_mutex_unlock(&open_writers_lock);
+    }
+    return (Value){MAKE_TYPE(VAL_HANDLE, HANDLE_FILEWRITER, 0), {.obj = (HeapObject*)writer}};
+}
+
+// Buffers chars, plus a newline when asked. What does not fit goes out
+// together with the buffer in one writev.
+static Value writer_write(VM* vm, ObjFileWriter* writer, Value s, bool newline) {
+    int64_t len;
+    const char* chars = get_string_chars(vm, s, &len);
+    pthread_mutex_lock(&writer->lock);
+    int err = 0;
+    if (writer->fd < 0) {
+        err = writer->error != 0 ? writer->error : EBADF;
+    } else if (writer->length + len + newline <= WRITER_BUFFER) {
+        memcpy(writer->buf + writer->length, chars, len);
+        writer->length += len;
+        if (newline) writer->buf[writer->length++] = '\n';
+    } else {
+        struct iovec iov[3] = {
+            { writer->buf, writer->length },
+            { (void*)chars, len },
+            { "\n", newline ? 1 : 0 }
+        };
+        writer->length = 0;
+        err = write_all(writer->fd, iov, 3);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return writer_result(vm, writer, err);
+}
+
+static Value native_fileWrite(VM* vm, int arg_count, Value* args) {
+    ObjFileWriter* writer = writer_arg(vm, arg_count, args, 2, "fileWrite");
+    if (writer == NULL) return (Value){VAL_VOID, {0}};
+    return writer_write(vm, writer, args[1], false);
+}
+
+static Value native_fileWriteLine(VM* vm, int arg_count, Value* args) {
+    ObjFileWriter* writer = writer_arg(vm, arg_count, args, 2, "fileWriteLine");
+    if (writer == NULL) return (Value){VAL_VOID, {0}};
+    return writer_write(vm, writer, args[1], true);
+}
+
+// Writes the buffered bytes and then every string of the array with a
+// single writev; only short writes need another call.
+static Value native_fileWritev(VM* vm, int arg_count, Value* args) {
+    ObjFileWriter* writer = writer_arg(vm, arg_count, args, 2, "fileWritev");
+    if (writer == NULL) return (Value){VAL_VOID, {0}};
+    ObjArray* parts = array_arg(args[1]);
+    if (parts == NULL) {
+        runtime_error(vm, "fileWritev() expects an array of strings");
+        return (Value){VAL_VOID, {0}};
+    }
+    struct iovec* iov = malloc(sizeof(struct iovec) * (parts->count + 1));
+    int count = 0;
+    pthread_mutex_lock(&writer->lock);
+    int err = 0;
+    if (writer->fd < 0) {
+        err = writer->error != 0 ? writer->error : EBADF;
+    } else {
+        iov[count++] = (struct iovec){ writer->buf, writer->length };
+        for (int i = 0; i < parts->count; i++) {
+            int64_t len;
+            const char* chars = get_string_chars(vm, parts->items[i], &len);
+            if (chars != NULL && len > 0) iov[count++] = (struct iovec){ (void*)chars, len };
+        }
+        writer->length = 0;
+        err = write_all(writer->fd, iov, count);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    free(iov);
+    return writer_result(vm, writer, err);
+}
+
+static Value native_fileFlush(VM* vm, int arg_count, Value* args) {
+    ObjFileWriter* writer = writer_arg(vm, arg_count, args, 1, "fileFlush");
+    if (writer == NULL) return (Value){VAL_VOID, {0}};
+    pthread_mutex_lock(&writer->lock);
+    int err = writer->fd < 0 ? (writer->error != 0 ? writer->error : EBADF) : writer_flush_locked(writer);
+    pthread_mutex_unlock(&writer->lock);
+    return writer_result(vm, writer, err);
+}
+
+static Value native_fileClose(VM* vm, int arg_count, Value* args) {
+    ObjFileWriter* writer = writer_arg(vm, arg_count, args, 1, "fileClose");
+    if (writer == NULL) return (Value){VAL_VOID, {0}};
+    return writer_result(vm, writer, writer_close(writer));
+}
+
 void vm_define_native(VM* vm, const char* name, NativeFn function, int index) {
     ObjNative* native = malloc(sizeof(ObjNative));
     native->obj.type = OBJ_NATIVE;
     native->obj.ref_count = 1;
     native->name = name;
     native->function = function;
-    vm->locals[index] = (Value){VAL_OBJ, {.obj = (HeapObject*)native}};
+    vm->natives[index] = (Value){VAL_OBJ, {.obj = (HeapObject*)native}};
 }
 
-void vm_init(VM* vm, uint8_t* code, char** strings, int strings_count, int argc, char** argv) {
+void vm_init(VM* vm, uint8_t* code, char** strings, int* string_lengths, int strings_count, int argc, char** argv) {
     vm->code = code;
     vm->ip = 0;
     vm->stack_ptr = 0;
     vm->locals_ptr = 0;
     vm->frame_ptr = 1;
     vm->try_ptr = 0;
+    vm->try_base = 0;
     vm->frames[0].locals_offset = 0;
     vm->frames[0].return_addr = -1;
     vm->strings = strings;
+    vm->string_lengths = string_lengths;
+    vm->constants = calloc(strings_count, sizeof(ObjString*));
     vm->strings_count = strings_count;
     vm->argc = argc;
     vm->argv = argv;
     vm->panic = false;
+    vm->can_park = false;
+    vm->parked = false;
+    vm->io_done = false;
+    vm->net_progress = 0;
+    vm->client = NULL;
     for (int i = 0; i < LOCALS_MAX; i++) {
         vm->locals[i].type = VAL_VOID;
     }
+    for (int i = 0; i < NATIVES_MAX; i++) {
+        vm->natives[i].type = VAL_VOID;
+    }
     
     vm_define_native(vm, "len", native_len, 0);
     vm_define_native(vm, "append", native_append, 1);
@@ -1489,6 +3684,57 @@ void vm_init(VM* vm, uint8_t* code, char** strings, int strings_count, int argc,
     vm_define_native(vm, "tcpClose", native_tcpClose, 42);
     vm_define_native(vm, "httpParse", native_httpParse, 43);
     vm_define_native(vm, "httpFormat", native_httpFormat, 44);
+    vm_define_native(vm, "arraySum", native_arraySum, 45);
+    vm_define_native(vm, "arrayMin", native_arrayMin, 46);
+    vm_define_native(vm, "arrayMax", native_arrayMax, 47);
+    vm_define_native(vm, "arrayIndexOf", native_arrayIndexOf, 48);
+    vm_define_native(vm, "arrayCount", native_arrayCount, 49);
+    vm_define_native(vm, "arrayDot", native_arrayDot, 50);
+    vm_define_native(vm, "sort", native_sort, 51);
+    vm_define_native(vm, "sortBy", native_sortBy, 52);
+    vm_define_native(vm, "substr", native_substr, 53);
+    vm_define_native(vm, "strbuf", native_strbuf, 54);
+    vm_define_native(vm, "strbufPush", native_strbufPush, 55);
+    vm_define_native(vm, "strbufPushInt", native_strbufPushInt, 56);
+    vm_define_native(vm, "strbufPushFlt", native_strbufPushFlt, 57);
+    vm_define_native(vm, "strbufFinish", native_strbufFinish, 58);
+    vm_define_native(vm, "strFind", native_strFind, 59);
+    vm_define_native(vm, "strContains", native_strContains, 60);
+    vm_define_native(vm, "strCount", native_strCount, 61);
+    vm_define_native(vm, "strSplit", native_strSplit, 62);
+    vm_define_native(vm, "strReplace", native_strReplace, 63);
+    vm_define_native(vm, "readAll", native_readAll, 64);
+    vm_define_native(vm, "readInts", native_readInts, 65);
+    vm_define_native(vm, "readTokens", native_readTokens, 66);
+    vm_define_native(vm, "lines", native_lines, 67);
+    vm_define_native(vm, "mmapFile", native_mmapFile, 68);
+    vm_define_native(vm, "fileReader", native_fileReader, 69);
+    vm_define_native(vm, "readerChunk", native_readerChunk, 70);
+    vm_define_native(vm, "readerLine", native_readerLine, 71);
+    vm_define_native(vm, "readerEof", native_readerEof, 72);
+    vm_define_native(vm, "fileOpen", native_fileOpen, 73);
+    vm_define_native(vm, "fileWrite", native_fileWrite, 74);
+    vm_define_native(vm, "fileWriteLine", native_fileWriteLine, 75);
+    vm_define_native(vm, "fileWritev", native_fileWritev, 76);
+    vm_define_native(vm, "fileFlush", native_fileFlush, 77);
+    vm_define_native(vm, "fileClose", native_fileClose, 78);
+    vm_define_native(vm, "httpServe", native_httpServe, 79);
+    vm_define_native(vm, "router", native_router, 80);
+    vm_define_native(vm, "routerAdd", native_routerAdd, 81);
+    vm_define_native(vm, "routerMatch", native_routerMatch, 82);
+    vm_define_native(vm, "httpTemplate", native_httpTemplate, 83);
+    vm_define_native(vm, "httpRespond", native_httpRespond, 84);
+    vm_define_native(vm, "tcpSendv", native_tcpSendv, 85);
+    vm_define_native(vm, "tcpSendFile", native_tcpSendFile, 86);
+    vm_define_native(vm, "httpRequest", native_httpRequest, 87);
+    vm_define_native(vm, "httpPipeline", native_httpPipeline, 88);
+    vm_define_native(vm, "httpStream", native_httpStream, 89);
+    vm_define_native(vm, "tcpListenWith", native_tcpListenWith, 90);
+    vm_define_native(vm, "httpServeWith", native_httpServeWith, 91);
+    vm_define_native(vm, "netbuf", native_netbuf, 92);
+    vm_define_native(vm, "recvInto", native_recvInto, 93);
+    vm_define_native(vm, "netbufPeek", native_netbufPeek, 94);
+    vm_define_native(vm, "netbufTake", native_netbufTake, 95);
 }
 
 typedef struct {
@@ -1496,6 +3742,7 @@ typedef struct {
     Value callable;
     int arg_count;
     Value args[32];
+    bool started;
 } ThreadArgs;
 
 static void begin_call(VM* vm, int32_t addr, int return_addr, ObjClosure* closure) {
@@ -1516,51 +3763,174 @@ static void begin_call(VM* vm, int32_t addr, int return_addr, ObjClosure* closur
     vm->ip = addr;
 }
 
-static void* thread_routine(void* arg) {
-    ThreadArgs* targs = (ThreadArgs*)arg;
+// Calls an Opo function value from native code and returns its result, which
+// the caller owns. The callee runs in a nested dispatch loop that stops when
+// its frame returns. Errors raised inside it cannot unwind into try blocks of
+// the surrounding code, so uncaught ones end the program.
+static Value vm_call_value(VM* vm, Value callable, int arg_count, Value* args) {
+    int saved_ip = vm->ip;
+    int saved_try_base = vm->try_base;
+    bool saved_can_park = vm->can_park;
+    int base = vm->stack_ptr;
+    vm->try_base = vm->try_ptr;
+    vm->can_park = false;
+
+    for (int i = 0; i < arg_count; i++) vm_push(vm, args[i]);
+    if (callable.as.obj != NULL && callable.as.obj->type == OBJ_CLOSURE) {
+        ObjClosure* closure = (ObjClosure*)callable.as.obj;
+        begin_call(vm, (int32_t)closure->addr, -1, closure);
+    } else {
+        begin_call(vm, (int32_t)callable.as.i_val, -1, NULL);
+    }
+    vm_run(vm);
+
+    Value result = (Value){VAL_VOID, {0}};
+    if (vm->stack_ptr > base) result = vm_pop(vm);
+    while (vm->stack_ptr > base) release(vm_pop(vm));
+    vm->try_base = saved_try_base;
+    vm->can_park = saved_can_park;
+    vm->ip = saved_ip;
+    return result;
+}
+
+// ---- goroutine scheduling ----
+//
+// Goroutines run on a pool of threads. A goroutine keeps its thread while it
+// runs or waits on a channel, but one whose I/O would block parks: it leaves
+// vm_run, the netpoller takes the operation, and its thread goes back to the
+// pool. Once the I/O is ready or done the goroutine continues on whichever
+// pool thread is free, so idle connections cost a VM each rather than a
+// thread. Threads idle for WORKER_IDLE_SECONDS exit.
+
+#define WORKER_IDLE_SECONDS 10
+
+typedef struct Worker {
+    pthread_cond_t wake;
+    ThreadArgs* job;
+    struct Worker* next;
+} Worker;
+
+static Worker* idle_workers = NULL;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* worker_main(void* arg);
+
+// Hands the goroutine to an idle thread, or to a new one when none is idle.
+static void schedule_goroutine(ThreadArgs* job) {
+    pthread_mutex_lock(&sched_lock);
+    Worker* worker = idle_workers;
+    if (worker != NULL) {
+        idle_workers = worker->next;
+        worker->job = job;
+        pthread_cond_signal(&worker->wake);
+        pthread_mutex_unlock(&sched_lock);
+        return;
+    }
+    pthread_mutex_unlock(&sched_lock);
+    pthread_t thread;
+    pthread_create(&thread, NULL, worker_main, job);
+    pthread_detach(thread);
+}
+
+static void goroutine_ready(void* waiter) {
+    schedule_goroutine((ThreadArgs*)waiter);
+}
+
+// Pushes the goroutine's first call. A native runs to completion here, as it
+// has no frame to come back to.
+static void goroutine_start(ThreadArgs* targs) {
     VM* vm = targs->vm;
-    
+    targs->started = true;
     if (TYPE_KIND(targs->callable.type) == VAL_OBJ && targs->callable.as.obj->type == OBJ_NATIVE) {
         ObjNative* native = (ObjNative*)targs->callable.as.obj;
         native->function(vm, targs->arg_count, targs->args);
-    } else if (TYPE_KIND(targs->callable.type) >= VAL_FUNC && TYPE_KIND(targs->callable.type) <= VAL_FUNC_VOID &&
-               targs->callable.as.obj != NULL && targs->callable.as.obj->type == OBJ_CLOSURE) {
-        ObjClosure* closure = (ObjClosure*)targs->callable.as.obj;
-        begin_call(vm, (int32_t)closure->addr, -1, closure);
-        for (int i = 0; i < targs->arg_count; i++) {
-            vm_push(vm, targs->args[i]);
-        }
-        vm_run(vm);
     } else {
-        int32_t addr = (int32_t)targs->callable.as.i_val;
-        begin_call(vm, addr, -1, NULL);
-        
+        if (TYPE_KIND(targs->callable.type) >= VAL_FUNC && TYPE_KIND(targs->callable.type) <= VAL_FUNC_VOID &&
+            targs->callable.as.obj != NULL && targs->callable.as.obj->type == OBJ_CLOSURE) {
+            ObjClosure* closure = (ObjClosure*)targs->callable.as.obj;
+            begin_call(vm, (int32_t)closure->addr, -1, closure);
+        } else {
+            begin_call(vm, (int32_t)targs->callable.as.i_val, -1, NULL);
+        }
         for (int i = 0; i < targs->arg_count; i++) {
             vm_push(vm, targs->args[i]);
         }
-        
+        vm->can_park = true;
         vm_run(vm);
     }
-    
     release(targs->callable);
     for (int i = 0; i < targs->arg_count; i++) release(targs->args[i]);
-    
+    targs->arg_count = 0;
+}
+
+static void goroutine_finish(ThreadArgs* targs) {
+    VM* vm = targs->vm;
     // Clean up locals
     for (int i = 0; i < LOCALS_MAX; i++) {
         release(vm->locals[i]);
     }
+    for (int i = 0; i < NATIVES_MAX; i++) {
+        release(vm->natives[i]);
+    }
     // Clean up stack
     for (int i = 0; i < vm->stack_ptr; i++) {
         release(vm->stack[i]);
     }
 
+    free(vm->constants);
     free(vm);
     free(targs);
+}
+
+// Runs the goroutine until it finishes or parks. After a successful park
+// another thread may already be running it, so it must not be touched.
+static void goroutine_run(ThreadArgs* targs) {
+    VM* vm = targs->vm;
+    if (!targs->started) goroutine_start(targs);
+    else vm_run(vm);
+    while (vm->parked) {
+        vm->parked = false;
+        vm->io_done = vm->io.op != NETPOLL_POLL;
+        netpoll_start(goroutine_ready);
+        if (netpoll_submit(&vm->io, targs)) return;
+        netpoll_run(&vm->io);
+        vm_run(vm);
+    }
+    goroutine_finish(targs);
+}
+
+static void* worker_main(void* arg) {
+    ThreadArgs* job = (ThreadArgs*)arg;
+    Worker self;
+    pthread_cond_init(&self.wake, NULL);
+    while (job != NULL) {
+        goroutine_run(job);
+
+        pthread_mutex_lock(&sched_lock);
+        self.job = NULL;
+        self.next = idle_workers;
+        idle_workers = &self;
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += WORKER_IDLE_SECONDS;
+        while (self.job == NULL) {
+            if (pthread_cond_timedwait(&self.wake, &sched_lock, &deadline) == ETIMEDOUT && self.job == NULL) {
+                Worker** link = &idle_workers;
+                while (*link != &self) link = &(*link)->next;
+                *link = self.next;
+                break;
+            }
+        }
+        job = self.job;
+        pthread_mutex_unlock(&sched_lock);
+    }
+    pthread_cond_destroy(&self.wake);
     return NULL;
 }
 
 void vm_push(VM* vm, Value val) {
     if (vm->stack_ptr >= STACK_MAX) {
+        vm_flush_output();
         fprintf(stderr, "Stack overflow\n");
         exit(1);
     }
@@ -1570,6 +3940,7 @@ void vm_push(VM* vm, Value val) {
 
 Value vm_pop(VM* vm) {
     if (vm->stack_ptr <= 0) {
+        vm_flush_output();
         fprintf(stderr, "Stack underflow\n");
         exit(1);
     }
@@ -1587,7 +3958,7 @@ static void runtime_error(VM* vm, const char* format, ...) {
     retain(err_msg);
     vm->panic = true;
     
-    if (vm->try_ptr > 0) {
+    if (vm->try_ptr > vm->try_base) {
         TryFrame frame = vm->try_stack[--vm->try_ptr];
         while (vm->stack_ptr > frame.stack_ptr) release(vm_pop(vm));
         while (vm->frame_ptr > frame.frame_ptr) {
@@ -1601,6 +3972,7 @@ static void runtime_error(VM* vm, const char* format, ...) {
         vm->ip = frame.handler_addr;
         release(err_msg);
     } else {
+        vm_flush_output();
         fprintf(stderr, "Runtime Error: %s\n", buf);
         release(err_msg);
         exit(1);
@@ -1623,6 +3995,16 @@ static int64_t read_int64(VM* vm) {
     return val;
 }
 
+static Value concat_strings(VM* vm, Value a, Value b) {
+    int64_t la, lb;
+    const char* sa = get_string_chars(vm, a, &la);
+    const char* sb = get_string_chars(vm, b, &lb);
+    ObjString* res = allocate_string(vm, NULL, la + lb);
+    memcpy(res->chars, sa, la);
+    memcpy(res->chars + la, sb, lb);
+    return (Value){VAL_OBJ, {.obj = (HeapObject*)res}};
+}
+
 void vm_run(VM* vm) {
     while (true) {
         uint8_t instruction = vm->code[vm->ip++];
@@ -1642,7 +4024,11 @@ void vm_run(VM* vm) {
             }
             case OP_PUSH_STR: {
                 int index = vm->code[vm->ip++];
-                ObjString* s = allocate_string(vm, vm->strings[index], (int)strlen(vm->strings[index]));
+                ObjString* s = vm->constants[index];
+                if (s == NULL) {
+                    s = intern_string(vm->strings[index], vm->string_lengths[index]);
+                    vm->constants[index] = s;
+                }
                 vm_push(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)s}});
                 break;
             }
@@ -1653,10 +4039,7 @@ void vm_run(VM* vm) {
             }
             case OP_PRINT: {
                 Value val = vm_pop(vm);
-                Value s = native_str(vm, 1, &val);
-                printf("%s\n", ((ObjString*)s.as.obj)->chars);
-                fflush(stdout);
-                release(s);
+                output_values(vm, 1, &val, true);
                 release(val);
                 break;
             }
@@ -1765,17 +4148,7 @@ void vm_run(VM* vm) {
                 } else if (TYPE_KIND(a.type) == VAL_FLT && TYPE_KIND(b.type) == VAL_FLT) {
                     vm_push(vm, (Value){VAL_FLT, {.f_val = a.as.f_val + b.as.f_val}});
                 } else if (is_string(a) && is_string(b)) {
-                    Value v_sa = native_str(vm, 1, &a);
-                    Value v_sb = native_str(vm, 1, &b);
-                    const char* sa = ((ObjString*)v_sa.as.obj)->chars;
-                    const char* sb = ((ObjString*)v_sb.as.obj)->chars;
-                    int la = ((ObjString*)v_sa.as.obj)->length;
-                    int lb = ((ObjString*)v_sb.as.obj)->length;
-                    ObjString* res = allocate_string(vm, NULL, la + lb);
-                    memcpy(res->chars, sa, la);
-                    memcpy(res->chars + la, sb, lb);
-                    vm_push(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)res}});
-                    release(v_sa); release(v_sb);
+                    vm_push(vm, concat_strings(vm, a, b));
                 } else {
                     release(a); release(b);
                     runtime_error(vm, "Type error in ADD: incompatible types %d and %d.", TYPE_KIND(a.type), TYPE_KIND(b.type));
@@ -1877,7 +4250,7 @@ void vm_run(VM* vm) {
             }
             case OP_LOAD_G: {
                 int index = vm->code[vm->ip++];
-                vm_push(vm, vm->locals[index]);
+                vm_push(vm, vm->natives[index]);
                 break;
             }
             case OP_POP: {
@@ -1946,17 +4319,15 @@ void vm_run(VM* vm) {
                     }
                     vm_push(vm, array->items[idx]);
                 } else if (is_string(obj)) {
-                    const char* s = get_string_ptr(vm, obj);
-                    int len = (TYPE_KIND(obj.type) == VAL_STR) ? (int)strlen(s) : ((ObjString*)obj.as.obj)->length;
-                    int idx = (int)index.as.i_val;
+                    int64_t len;
+                    const char* s = get_string_chars(vm, obj, &len);
+                    int64_t idx = index.as.i_val;
                     if (idx < 0 || idx >= len) {
                         release(obj); release(index);
-                        runtime_error(vm, "String index %d out of bounds (length %d)", idx, len);
+                        runtime_error(vm, "String index %lld out of bounds (length %lld)", (long long)idx, (long long)len);
                         break;
                     }
-                    char buf[2] = {s[idx], '\0'};
-                    ObjString* res = allocate_string(vm, buf, 1);
-                    vm_push(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)res}});
+                    vm_push(vm, (Value){VAL_OBJ, {.obj = (HeapObject*)byte_string((uint8_t)s[idx])}});
                 } else if ((TYPE_KIND(obj.type) == VAL_OBJ || TYPE_KIND(obj.type) == VAL_MAP) && obj.as.obj->type == OBJ_MAP) {
                     ObjMap* map = (ObjMap*)obj.as.obj;
                     Value val = map_get(vm, map, index);
@@ -2010,15 +4381,16 @@ void vm_run(VM* vm) {
                 break;
             }
             case OP_END_TRY: {
-                if (vm->try_ptr > 0) vm->try_ptr--;
+                if (vm->try_ptr > vm->try_base) vm->try_ptr--;
                 break;
             }
             case OP_THROW: {
                 Value err = vm_pop(vm);
-                if (vm->try_ptr == 0) {
+                if (vm->try_ptr == vm->try_base) {
+                    vm_flush_output();
                     fprintf(stderr, "Unhandled Exception: ");
                     Value s = native_str(vm, 1, &err);
-                    printf("%s\n", ((ObjString*)s.as.obj)->chars);
+                    printf("%s\n", string_cstr((ObjString*)s.as.obj));
                     release(s);
                     exit(1);
                 }
@@ -2035,6 +4407,54 @@ void vm_run(VM* vm) {
                 vm->ip = frame.handler_addr;
                 break;
             }
+            case OP_CONCAT_LOCAL: {
+                // acc + piece => acc: when the stack copy and the local are the
+                // only references to acc, append to it instead of copying.
+                int index = vm->code[vm->ip++];
+                int locals_offset = vm->frames[vm->frame_ptr-1].locals_offset;
+                Value b = vm_pop(vm);
+                Value a = vm_pop(vm);
+                if (!is_string(a) || !is_string(b)) {
+                    release(a); release(b);
+                    runtime_error(vm, "Type error in ADD: incompatible types %d and %d.", TYPE_KIND(a.type), TYPE_KIND(b.type));
+                    break;
+                }
+                ObjString* acc = TYPE_KIND(a.type) == VAL_OBJ ? (ObjString*)a.as.obj : NULL;
+                if (acc != NULL && acc->owner == NULL && acc->obj.ref_count == 2 &&
+                    vm->locals[locals_offset + index].as.obj == a.as.obj) {
+                    int64_t lb;
+                    const char* sb = get_string_chars(vm, b, &lb);
+                    string_append_in_place(acc, sb, lb);
+                    vm_push(vm, a);
+                } else {
+                    vm_push(vm, concat_strings(vm, a, b));
+                }
+                release(a); release(b);
+                break;
+            }
+            case OP_SLICE: {
+                uint8_t bounds = vm->code[vm->ip++];
+                Value hi_val = (bounds & 2) ? vm_pop(vm) : (Value){VAL_VOID, {0}};
+                Value lo_val = (bounds & 1) ? vm_pop(vm) : (Value){VAL_VOID, {0}};
+                Value obj = vm_pop(vm);
+                ObjArray* array = array_arg(obj);
+                if (array == NULL) {
+                    release(obj);
+                    runtime_error(vm, "Can only slice arrays");
+                    break;
+                }
+                int lo = (bounds & 1) ? (int)lo_val.as.i_val : 0;
+                int hi = (bounds & 2) ? (int)hi_val.as.i_val : array->count;
+                if (lo < 0 || hi < lo || hi > array->count) {
+                    release(obj);
+                    runtime_error(vm, "Slice bounds [%d..%d] out of range (length %d)", lo, hi, array->count);
+                    break;
+                }
+                ObjArray* view = allocate_array_view(vm, array, lo, hi);
+                vm_push(vm, (Value){obj.type, {.obj = (HeapObject*)view}});
+                release(obj);
+                break;
+            }
             case OP_SET_INDEX: {
                 Value index = vm_pop(vm);
                 Value obj = vm_pop(vm);
@@ -2047,6 +4467,7 @@ void vm_run(VM* vm) {
                         runtime_error(vm, "Array index %d out of bounds in assignment (length %d)", idx, array->count);
                         break;
                     }
+                    array_make_unique(array);
                     release(array->items[idx]);
                     retain(val);
                     array->items[idx] = val;
@@ -2202,6 +4623,13 @@ void vm_run(VM* vm) {
                     ObjNative* native = (ObjNative*)callable.as.obj;
                     Value* args = &vm->stack[vm->stack_ptr - arg_count];
                     Value result = native->function(vm, arg_count, args);
+                    if (vm->parked) {
+                        // The native would block. Leave with the call still
+                        // on the stack so it runs again once resumed.
+                        vm->stack[vm->stack_ptr++] = callable;
+                        vm->ip -= 2;
+                        return;
+                    }
                     if (vm->panic) {
                         vm->panic = false;
                         release(callable);
@@ -2219,7 +4647,7 @@ void vm_run(VM* vm) {
                         begin_call(vm, (int32_t)callable.as.i_val, vm->ip, NULL);
                     }
                     release(callable);
-                } else { fprintf(stderr, "Can only invoke functions or natives. Type: %d\n", TYPE_KIND(callable.type)); exit(1); }
+                } else { vm_flush_output(); fprintf(stderr, "Can only invoke functions or natives. Type: %d\n", TYPE_KIND(callable.type)); exit(1); }
                 break;
             }
             case OP_GO: {
@@ -2233,12 +4661,10 @@ void vm_run(VM* vm) {
                 }
                 
                 VM* new_vm = malloc(sizeof(VM));
-                vm_init(new_vm, vm->code, vm->strings, vm->strings_count, vm->argc, vm->argv);
+                vm_init(new_vm, vm->code, vm->strings, vm->string_lengths, vm->strings_count, vm->argc, vm->argv);
                 targs->vm = new_vm;
-                
-                pthread_t thread;
-                pthread_create(&thread, NULL, thread_routine, targs);
-                pthread_detach(thread);
+                targs->started = false;
+                schedule_goroutine(targs);
                 break;
             }
             case OP_CHAN: {
@@ -2354,6 +4780,7 @@ void vm_run(VM* vm) {
                 break;
             }
             default:
+                vm_flush_output();
                 fprintf(stderr, "Unknown opcode %d\n", instruction);
                 exit(1);
         }
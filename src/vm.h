@@ -2,12 +2,16 @@
 #define OPO_VM_H
 
 #include "common.h"
+#include "input.h"
+#include "netpoll.h"
+#include "router.h"
 #include <pthread.h>
 
 #define STACK_MAX 256
 #define LOCALS_PER_FRAME 48
 #define FRAMES_MAX 64
 #define LOCALS_MAX (FRAMES_MAX * LOCALS_PER_FRAME)
+#define NATIVES_MAX 256
 
 typedef struct {
     int return_addr;
@@ -33,22 +37,41 @@ struct VM {
     int frame_ptr;
     TryFrame try_stack[TRY_STACK_MAX];
     int try_ptr;
+    int try_base; // try frames below this belong to code outside a native callback
+    Value natives[NATIVES_MAX];
     char** strings;
+    int* string_lengths;
+    ObjString** constants; // interned string constants, filled on first use
     int strings_count;
     int argc;
     char** argv;
     bool panic;
+    // A goroutine whose I/O would block describes it in io, sets parked and
+    // leaves vm_run, to be resumed once the netpoller finds it ready or done
+    // (io_done, with the outcome in io.result). Only possible where vm_run
+    // can be left: not on the main thread or inside a native callback.
+    bool can_park;
+    bool parked;
+    bool io_done;
+    NetpollOp io;
+    int64_t net_progress; // bytes a parked tcpSend had already sent
+    struct ClientCall* client; // the HTTP client call a parked native is in
 };
 
-void vm_init(VM* vm, uint8_t* code, char** strings, int strings_count, int argc, char** argv);
+void vm_init(VM* vm, uint8_t* code, char** strings, int* string_lengths, int strings_count, int argc, char** argv);
 void vm_run(VM* vm);
+void vm_set_buffered_output(bool buffered);
+void vm_flush_output(void);
 void vm_push(VM* vm, Value val);
 Value vm_pop(VM* vm);
 
 void retain(Value val);
 void release(Value val);
 
-ObjString* allocate_string(VM* vm, const char* chars, int length);
+ObjString* allocate_string(VM* vm, const char* chars, int64_t length);
+ObjString* allocate_string_view(VM* vm, ObjString* parent, int64_t start, int64_t length);
+ObjString* intern_string(const char* chars, int64_t length);
+const char* string_cstr(ObjString* string);
 ObjArray* allocate_array(VM* vm);
 
 typedef struct {
@@ -69,4 +92,48 @@ typedef struct {
 
 ObjChan* allocate_chan(VM* vm, int capacity);
 
+typedef struct {
+    char* data;
+    int64_t length;
+    int64_t capacity;
+} StringBuilder;
+
+typedef struct {
+    HeapObject obj;
+    StringBuilder sb;
+} ObjStrBuf;
+
+typedef struct {
+    HeapObject obj;
+    InputReader in; // fd is -1 when the file could not be opened
+} ObjFileReader;
+
+typedef struct ObjFileWriter {
+    HeapObject obj;
+    pthread_mutex_t lock;
+    int fd;        // -1 once closed or when the open failed
+    int error;     // errno of the failed open, or 0
+    char* buf;
+    size_t length; // bytes buffered and not yet written
+    struct ObjFileWriter* prev; // open writers, flushed at exit
+    struct ObjFileWriter* next;
+} ObjFileWriter;
+
+typedef struct {
+    HeapObject obj;
+    Router* router;
+    ObjString** keys; // interned parameter names, by router_param_name index
+    int key_count;
+} ObjRouter;
+
+// A receive buffer recvInto fills in place. Its bytes are a string's, so
+// the views netbufPeek and netbufTake hand out are ordinary strings that
+// pin it; while any does, room is made by moving the unread bytes to a new
+// string rather than over what they see.
+typedef struct {
+    HeapObject obj;
+    ObjString* data; // chars[start, length) are unread
+    int64_t start;
+} ObjNetBuf;
+
 #endif